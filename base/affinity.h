@@ -0,0 +1,136 @@
+/*
+ * CPU and NUMA topology from sysfs, and thread pinning. Linux only:
+ * elsewhere there is one node, no known cpu, and pinning fails.
+ */
+
+#ifndef BASE_AFFINITY_H_
+#define BASE_AFFINITY_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#define COS_HAS_AFFINITY 1
+#else
+#define COS_HAS_AFFINITY 0
+#endif
+
+namespace cos {
+namespace base {
+
+// Parses the kernel's list format, e.g. "0-3,8,10-11".
+inline std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::size_t pos = 0;
+  while (pos < list.size()) {
+    std::size_t end = list.find(',', pos);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string range = list.substr(pos, end - pos);
+    std::size_t dash = range.find('-');
+    if (!range.empty() && range[0] >= '0' && range[0] <= '9') {
+      int first = std::atoi(range.c_str());
+      int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+      for (int cpu = first; cpu <= last; cpu ++) {
+        cpus.push_back(cpu);
+      }
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+inline std::vector<int> read_cpu_list(const std::string& path) {
+  std::ifstream in(path);
+  std::string line;
+  std::getline(in, line);
+  return ParseCpuList(line);
+}
+
+inline std::vector<int> OnlineCpus() {
+  return read_cpu_list("/sys/devices/system/cpu/online");
+}
+
+// Ids of the online NUMA nodes, {0} if unknown.
+inline std::vector<int> NumaNodes() {
+  std::vector<int> nodes = read_cpu_list("/sys/devices/system/node/online");
+  return nodes.empty() ? std::vector<int>(1, 0) : nodes;
+}
+
+// Cpus of 'node'. Without NUMA information node 0 has every online cpu.
+inline std::vector<int> NodeCpus(int node) {
+  std::vector<int> cpus = read_cpu_list("/sys/devices/system/node/node" +
+                                        std::to_string(node) + "/cpulist");
+  if (cpus.empty() && node == 0) {
+    return OnlineCpus();
+  }
+  return cpus;
+}
+
+// Node of 'cpu', 0 if unknown. The topology is read once.
+inline int CpuNode(int cpu) {
+  static const std::vector<int> nodes = [] {
+    std::vector<int> map;
+    for (int node : NumaNodes()) {
+      for (int c : NodeCpus(node)) {
+        if (c >= (int)map.size()) {
+          map.resize(c + 1, 0);
+        }
+        map[c] = node;
+      }
+    }
+    return map;
+  }();
+  return (cpu >= 0 && cpu < (int)nodes.size()) ? nodes[cpu] : 0;
+}
+
+// Cpu the calling thread runs on, -1 if unknown.
+inline int CurrentCpu() {
+#if COS_HAS_AFFINITY
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+inline int CurrentNode() {
+  return CpuNode(CurrentCpu());
+}
+
+// Restricts the calling thread to 'cpus'. Returns false if unsupported or
+// refused, e.g. none of them is allowed to this process.
+inline bool SetThreadAffinity(const std::vector<int>& cpus) {
+#if COS_HAS_AFFINITY
+  if (cpus.empty()) {
+    return false;
+  }
+  int max_cpu = *std::max_element(cpus.begin(), cpus.end());
+  if (max_cpu < 0) {
+    return false;
+  }
+  cpu_set_t* set = CPU_ALLOC(max_cpu + 1);
+  std::size_t size = CPU_ALLOC_SIZE(max_cpu + 1);
+  CPU_ZERO_S(size, set);
+  for (int cpu : cpus) {
+    if (cpu >= 0) {
+      CPU_SET_S(cpu, size, set);
+    }
+  }
+  bool ok = sched_setaffinity(0, size, set) == 0;    // 0: the calling thread
+  CPU_FREE(set);
+  return ok;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+}  // namespace base
+}  // namespace cos
+
+#endif  // BASE_AFFINITY_H_
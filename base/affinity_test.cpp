@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "affinity.h"
+
+using cos::base::CurrentCpu;
+using cos::base::NodeCpus;
+using cos::base::NumaNodes;
+using cos::base::OnlineCpus;
+using cos::base::ParseCpuList;
+using cos::base::SetThreadAffinity;
+
+// Cpus a thread of this process may run on, from /proc/self/task/<tid>/status.
+static std::vector<int> AllowedCpus(long tid) {
+  std::ifstream in("/proc/self/task/" + std::to_string(tid) + "/status");
+  std::string line;
+  const std::string key = "Cpus_allowed_list:";
+  while (std::getline(in, line)) {
+    if (line.compare(0, key.size(), key) == 0) {
+      std::size_t begin = line.find_first_not_of(" \t", key.size());
+      return ParseCpuList(line.substr(begin));
+    }
+  }
+  return std::vector<int>();
+}
+
+static long ThreadId() {
+  return syscall(SYS_gettid);
+}
+
+TEST(AffinityTest, ParseCpuList) {
+  EXPECT_EQ(ParseCpuList("0"), std::vector<int>({0}));
+  EXPECT_EQ(ParseCpuList("0-3,8,10-11\n"), std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_TRUE(ParseCpuList("").empty());
+}
+
+TEST(AffinityTest, Topology) {
+  std::vector<int> online = OnlineCpus();
+  ASSERT_FALSE(online.empty());
+  ASSERT_FALSE(NumaNodes().empty());
+  std::size_t cpus = 0;
+  for (int node : NumaNodes()) {
+    for (int cpu : NodeCpus(node)) {
+      EXPECT_EQ(cos::base::CpuNode(cpu), node);
+      cpus ++;
+    }
+  }
+  EXPECT_GE(cpus, online.size());
+  EXPECT_NE(std::find(online.begin(), online.end(), CurrentCpu()), online.end());
+}
+
+TEST(AffinityTest, PinThread) {
+  std::vector<int> allowed = AllowedCpus(ThreadId());
+  ASSERT_FALSE(allowed.empty());
+  int cpu = allowed.back();
+  std::vector<int> seen;
+  std::thread thrd([cpu, &seen] {
+    EXPECT_TRUE(SetThreadAffinity(std::vector<int>(1, cpu)));
+    seen = AllowedCpus(ThreadId());
+    EXPECT_EQ(CurrentCpu(), cpu);
+  });
+  thrd.join();
+  EXPECT_EQ(seen, std::vector<int>(1, cpu));
+  EXPECT_FALSE(SetThreadAffinity(std::vector<int>()));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
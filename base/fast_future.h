@@ -0,0 +1,559 @@
+/*
+ * A lightweight future/promise pair. One state block holds the callable,
+ * its result (or exception) and the ready flag. Blocks come from a
+ * FuturePool, so a round trip does not touch the heap once the pool is
+ * warm. FastFuture::Then() chains a continuation without blocking.
+ */
+
+#ifndef BASE_FAST_FUTURE_H_
+#define BASE_FAST_FUTURE_H_
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t FUTURE_BLOCK_SIZE = 256;
+constexpr std::size_t FUTURE_BLOCKS_PER_CHUNK = 64;
+
+// Fixed-size blocks recycled through a free list. The pool is reference
+// counted by its owner and by every block in use, so futures may outlive
+// the WorkBranch that created them.
+class FuturePool {
+ public:
+  static FuturePool* Create() {
+    return new FuturePool();
+  }
+
+  FuturePool(const FuturePool&) = delete;
+  FuturePool& operator=(const FuturePool&) = delete;
+
+  // Returns nullptr if 'size' does not fit in a block.
+  void* Allocate(std::size_t size) {
+    if (size > FUTURE_BLOCK_SIZE) {
+      return nullptr;
+    }
+    refs_ ++;
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (free_list_ == nullptr) {
+      grow();
+    }
+    FreeBlock* block = free_list_;
+    free_list_ = block->next;
+    return block;
+  }
+
+  void Deallocate(void* ptr) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      FreeBlock* block = static_cast<FreeBlock*>(ptr);
+      block->next = free_list_;
+      free_list_ = block;
+    }
+    Release();
+  }
+
+  // Drops one reference, the last one deletes the pool.
+  void Release() {
+    if (-- refs_ == 0) {
+      delete this;
+    }
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  using Block = typename std::aligned_storage<FUTURE_BLOCK_SIZE, alignof(std::max_align_t)>::type;
+
+  FuturePool() { }
+
+  ~FuturePool() {
+    for (Block* chunk : chunks_) {
+      delete[] chunk;
+    }
+  }
+
+  void grow() {
+    Block* chunk = new Block[FUTURE_BLOCKS_PER_CHUNK];
+    chunks_.push_back(chunk);
+    for (std::size_t i = 0; i < FUTURE_BLOCKS_PER_CHUNK; i ++) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i);
+      block->next = free_list_;
+      free_list_ = block;
+    }
+  }
+
+  std::atomic<std::size_t> refs_{1};
+  FreeBlock* free_list_ = nullptr;
+  std::vector<Block*> chunks_;
+  std::mutex mtx_;
+};
+
+// Holds a result of type R, or nothing for void.
+template <typename R>
+class FutureValue {
+ public:
+  FutureValue() { }
+  FutureValue(const FutureValue&) = delete;
+  ~FutureValue() {
+    if (has_value_) {
+      reinterpret_cast<R*>(&storage_)->~R();
+    }
+  }
+
+  template <typename F>
+  void set(F& func) {
+    new (&storage_) R(func());
+    has_value_ = true;
+  }
+
+  R take() {
+    return std::move(*reinterpret_cast<R*>(&storage_));
+  }
+
+ private:
+  typename std::aligned_storage<sizeof(R), alignof(R)>::type storage_;
+  bool has_value_ = false;
+};
+
+template <>
+class FutureValue<void> {
+ public:
+  template <typename F>
+  void set(F& func) {
+    func();
+  }
+
+  void take() { }
+};
+
+// Attached to a state by FastFuture::Then(), fired once it is ready.
+struct FutureLink {
+  void (*fire)(FutureLink*);
+};
+
+// Marks a state whose link slot is closed because it is ready.
+inline FutureLink* future_closed() {
+  static FutureLink closed = {nullptr};
+  return &closed;
+}
+
+// Shared by one FastFuture and one FutureRunner.
+template <typename R>
+class FutureState {
+ public:
+  FutureState(const FutureState&) = delete;
+  FutureState& operator=(const FutureState&) = delete;
+
+  bool is_ready() const {
+    return ready_.load(std::memory_order_acquire);
+  }
+
+  void wait() {
+    if (is_ready()) {
+      return;
+    }
+    std::unique_lock<std::mutex> ulk(mtx_);
+    waiting_ = true;
+    cv_.wait(ulk, [this] { return ready_after_waiting(); });
+  }
+
+  template <typename Clock, typename Duration>
+  bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+    if (is_ready()) {
+      return true;
+    }
+    std::unique_lock<std::mutex> ulk(mtx_);
+    waiting_ = true;
+    return cv_.wait_until(ulk, deadline, [this] { return ready_after_waiting(); });
+  }
+
+  R take() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return value_.take();
+  }
+
+  void run() {
+    run_(this);
+  }
+
+  void set_exception(std::exception_ptr error) {
+    error_ = error;
+    finish();
+  }
+
+  void release() {
+    if (-- refs_ == 0) {
+      destroy_(this);
+    }
+  }
+
+  // Fires 'link' when the state gets ready, or at once if it already is.
+  // One CAS, no lock.
+  void attach(FutureLink* link) {
+    FutureLink* expected = nullptr;
+    if (!link_.compare_exchange_strong(expected, link, std::memory_order_acq_rel)) {
+      link->fire(link);
+    }
+  }
+
+  FuturePool* pool() const {
+    return pool_;
+  }
+
+ protected:
+  using Hook = void (*)(FutureState*);
+
+  FutureState(FuturePool* pool, Hook run, Hook destroy)
+      : pool_(pool), run_(run), destroy_(destroy) { }
+  ~FutureState() { }
+
+  // Pairs with wait(): 'ready_' is published before 'waiting_' is read,
+  // and 'waiting_' before 'ready_' is, both seq_cst so that one side sees
+  // the other.
+  void finish() {
+    ready_.store(true);
+    if (waiting_.load()) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      cv_.notify_all();
+    }
+    FutureLink* link = link_.exchange(future_closed(), std::memory_order_acq_rel);
+    if (link != nullptr) {
+      link->fire(link);
+    }
+  }
+
+  FutureValue<R> value_;
+  std::exception_ptr error_;
+  FuturePool* const pool_;            // nullptr if the block came from the heap
+
+ private:
+  // Read after setting 'waiting_', see finish().
+  bool ready_after_waiting() const {
+    return ready_.load(std::memory_order_seq_cst);
+  }
+
+  const Hook run_;
+  const Hook destroy_;
+  std::atomic<int> refs_{2};          // the future and the runner
+  std::atomic<bool> ready_{false};
+  std::atomic<bool> waiting_{false};
+  std::atomic<FutureLink*> link_{nullptr};
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
+
+// The state block with the callable inlined.
+template <typename R, typename F>
+class FutureTask : public FutureState<R> {
+ public:
+  template <typename Fn>
+  static FutureTask* Create(FuturePool* pool, Fn&& func) {
+    bool fits = alignof(FutureTask) <= alignof(std::max_align_t);
+    void* block = (pool != nullptr && fits) ? pool->Allocate(sizeof(FutureTask)) : nullptr;
+    if (block == nullptr) {
+      return new FutureTask(nullptr, std::forward<Fn>(func));
+    }
+    return new (block) FutureTask(pool, std::forward<Fn>(func));
+  }
+
+ private:
+  template <typename Fn>
+  FutureTask(FuturePool* pool, Fn&& func)
+      : FutureState<R>(pool, &FutureTask::run_hook, &FutureTask::destroy_hook),
+        func_(std::forward<Fn>(func)) { }
+
+  static void run_hook(FutureState<R>* state) {
+    FutureTask* self = static_cast<FutureTask*>(state);
+    try {
+      self->value_.set(self->func_);
+    } catch (...) {
+      self->error_ = std::current_exception();
+    }
+    self->finish();
+  }
+
+  static void destroy_hook(FutureState<R>* state) {
+    FutureTask* self = static_cast<FutureTask*>(state);
+    FuturePool* pool = self->pool_;
+    if (pool == nullptr) {
+      delete self;
+    } else {
+      self->~FutureTask();
+      pool->Deallocate(self);
+    }
+  }
+
+  F func_;
+};
+
+template <typename R>
+class FutureRunner;
+
+// What a continuation of a FastFuture<R> returns.
+template <typename R, typename F>
+struct then_result {
+  using type = decltype(std::declval<F&>()(std::declval<R>()));
+};
+
+template <typename F>
+struct then_result<void, F> {
+  using type = decltype(std::declval<F&>()());
+};
+
+// The state block of a continuation: it owns the predecessor's state and
+// is its link. Once the predecessor is ready, it runs inline or is
+// submitted to an executor. An exception of the predecessor skips 'func'
+// and becomes the result.
+template <typename R, typename R2, typename F>
+class FutureThen : public FutureState<R2>, public FutureLink {
+ public:
+  using Submitter = void (*)(void*, FutureRunner<R2>&&);
+
+  template <typename Fn>
+  static FutureThen* Create(FutureState<R>* prev, void* exec, Submitter submit, Fn&& func) {
+    FuturePool* pool = prev->pool();
+    bool fits = alignof(FutureThen) <= alignof(std::max_align_t);
+    void* block = (pool != nullptr && fits) ? pool->Allocate(sizeof(FutureThen)) : nullptr;
+    if (block == nullptr) {
+      return new FutureThen(nullptr, prev, exec, submit, std::forward<Fn>(func));
+    }
+    return new (block) FutureThen(pool, prev, exec, submit, std::forward<Fn>(func));
+  }
+
+ private:
+  template <typename Fn>
+  FutureThen(FuturePool* pool, FutureState<R>* prev, void* exec, Submitter submit, Fn&& func)
+      : FutureState<R2>(pool, &FutureThen::run_hook, &FutureThen::destroy_hook),
+        FutureLink{&FutureThen::fire_hook},
+        prev_(prev), exec_(exec), submit_(submit), func_(std::forward<Fn>(func)) { }
+
+  ~FutureThen() {
+    if (prev_ != nullptr) {
+      prev_->release();
+    }
+  }
+
+  struct Apply {
+    R2 operator()() { return call(std::is_void<R>()); }
+    R2 call(std::false_type) { return self->func_(self->prev_->take()); }
+    R2 call(std::true_type) {
+      self->prev_->take();
+      return self->func_();
+    }
+    FutureThen* self;
+  };
+
+  static void fire_hook(FutureLink* link) {
+    FutureThen* self = static_cast<FutureThen*>(link);
+    FutureRunner<R2> runner(self);
+    if (self->submit_ == nullptr) {
+      runner();
+    } else {
+      self->submit_(self->exec_, std::move(runner));
+    }
+  }
+
+  static void run_hook(FutureState<R2>* state) {
+    FutureThen* self = static_cast<FutureThen*>(state);
+    try {
+      Apply apply{self};
+      self->value_.set(apply);
+    } catch (...) {
+      self->error_ = std::current_exception();
+    }
+    self->prev_->release();
+    self->prev_ = nullptr;
+    self->finish();
+  }
+
+  static void destroy_hook(FutureState<R2>* state) {
+    FutureThen* self = static_cast<FutureThen*>(state);
+    FuturePool* pool = self->pool_;
+    if (pool == nullptr) {
+      delete self;
+    } else {
+      self->~FutureThen();
+      pool->Deallocate(self);
+    }
+  }
+
+  FutureState<R>* prev_;
+  void* const exec_;
+  const Submitter submit_;            // nullptr to run inline
+  F func_;
+};
+
+template <typename R>
+class FastFuture {
+ public:
+  FastFuture() { }
+  explicit FastFuture(FutureState<R>* state) : state_(state) { }
+  FastFuture(const FastFuture&) = delete;
+  FastFuture& operator=(const FastFuture&) = delete;
+
+  FastFuture(FastFuture&& other) noexcept : state_(other.state_) {
+    other.state_ = nullptr;
+  }
+
+  FastFuture& operator=(FastFuture&& other) noexcept {
+    if (this != &other) {
+      reset();
+      state_ = other.state_;
+      other.state_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~FastFuture() {
+    reset();
+  }
+
+  bool valid() const {
+    return state_ != nullptr;
+  }
+
+  bool is_ready() const {
+    assert(valid());
+    return state_->is_ready();
+  }
+
+  void wait() const {
+    assert(valid());
+    state_->wait();
+  }
+
+  template <typename Rep, typename Period>
+  std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+    return wait_until(std::chrono::steady_clock::now() + timeout);
+  }
+
+  template <typename Clock, typename Duration>
+  std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const {
+    assert(valid());
+    return state_->wait_until(deadline) ? std::future_status::ready : std::future_status::timeout;
+  }
+
+  // Blocks until the result is ready, then returns it or rethrows the
+  // task's exception. Like std::future, the future is invalid afterwards.
+  R get() {
+    assert(valid());
+    state_->wait();
+    FutureGuard guard(this);
+    return state_->take();
+  }
+
+  // Returns the future of 'func' applied to the result, without waiting.
+  // 'func' runs on the thread that completes this future, or right here if
+  // it already is complete. The future is invalid afterwards.
+  template <typename F, typename R2 = typename then_result<R, typename std::decay<F>::type>::type>
+  FastFuture<R2> Then(F&& func) {
+    return then<R2>(nullptr, nullptr, std::forward<F>(func));
+  }
+
+  // Same, but 'func' is submitted to 'exec', e.g. a WorkBranch or a
+  // Workspace, once the result is there.
+  template <typename Executor, typename F,
+            typename R2 = typename then_result<R, typename std::decay<F>::type>::type>
+  FastFuture<R2> Then(Executor& exec, F&& func) {
+    return then<R2>(&exec, &submit_to<Executor, R2>, std::forward<F>(func));
+  }
+
+ private:
+  struct FutureGuard {
+    explicit FutureGuard(FastFuture* future) : future_(future) { }
+    ~FutureGuard() { future_->reset(); }
+    FastFuture* future_;
+  };
+
+  void reset() {
+    if (state_ != nullptr) {
+      state_->release();
+      state_ = nullptr;
+    }
+  }
+
+  template <typename Executor, typename R2>
+  static void submit_to(void* exec, FutureRunner<R2>&& runner) {
+    static_cast<Executor*>(exec)->Submit(std::move(runner));
+  }
+
+  // Our reference to the state moves to the continuation.
+  template <typename R2, typename F>
+  FastFuture<R2> then(void* exec, typename FutureThen<R, R2, typename std::decay<F>::type>::Submitter submit,
+                      F&& func) {
+    assert(valid());
+    FutureState<R>* prev = state_;
+    state_ = nullptr;
+    auto next = FutureThen<R, R2, typename std::decay<F>::type>::Create(prev, exec, submit,
+                                                                         std::forward<F>(func));
+    FastFuture<R2> future(next);
+    prev->attach(next);
+    return future;
+  }
+
+  FutureState<R>* state_ = nullptr;
+};
+
+// The producer side, a move-only callable that runs the task once. If it
+// is destroyed without running, the future reports a broken promise.
+template <typename R>
+class FutureRunner {
+ public:
+  explicit FutureRunner(FutureState<R>* state) : state_(state) { }
+  FutureRunner(const FutureRunner&) = delete;
+  FutureRunner& operator=(const FutureRunner&) = delete;
+
+  FutureRunner(FutureRunner&& other) noexcept : state_(other.state_) {
+    other.state_ = nullptr;
+  }
+
+  ~FutureRunner() {
+    if (state_ != nullptr) {
+      state_->set_exception(std::make_exception_ptr(
+          std::future_error(std::future_errc::broken_promise)));
+      state_->release();
+    }
+  }
+
+  void operator()() {
+    FutureState<R>* state = state_;
+    state_ = nullptr;
+    state->run();
+    state->release();
+  }
+
+ private:
+  FutureState<R>* state_;
+};
+
+// Packs 'func' into a state block from 'pool' (or the heap if the pool is
+// null or the block too small) and returns both ends.
+template <typename R, typename F>
+std::pair<FastFuture<R>, FutureRunner<R>> MakeFutureTask(FuturePool* pool, F&& func) {
+  FutureState<R>* state = FutureTask<R, typename std::decay<F>::type>::Create(pool, std::forward<F>(func));
+  return std::pair<FastFuture<R>, FutureRunner<R>>(std::piecewise_construct,
+                                                   std::forward_as_tuple(state),
+                                                   std::forward_as_tuple(state));
+}
+
+} // namespace base
+} // namespace cos
+
+#endif // BASE_FAST_FUTURE_H_
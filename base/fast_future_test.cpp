@@ -0,0 +1,123 @@
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "autothread.h"
+#include "fast_future.h"
+
+using cos::base::AutoThread;
+using cos::base::FastFuture;
+using cos::base::FuturePool;
+using cos::base::MakeFutureTask;
+using cos::base::join;
+
+TEST(FastFutureTest, GetValue) {
+  FuturePool* pool = FuturePool::Create();
+  auto packed = MakeFutureTask<std::string>(pool, [] { return std::string("done"); });
+  FastFuture<std::string> future = std::move(packed.first);
+  EXPECT_TRUE(future.valid());
+  EXPECT_FALSE(future.is_ready());
+
+  AutoThread<join> thrd(std::thread(std::move(packed.second)));
+  EXPECT_EQ(future.get(), "done");
+  EXPECT_FALSE(future.valid());
+  pool->Release();
+}
+
+TEST(FastFutureTest, WaitFor) {
+  FuturePool* pool = FuturePool::Create();
+  auto packed = MakeFutureTask<void>(pool, [] { });
+  EXPECT_EQ(packed.first.wait_for(std::chrono::milliseconds(10)), std::future_status::timeout);
+  packed.second();
+  EXPECT_TRUE(packed.first.is_ready());
+  EXPECT_EQ(packed.first.wait_for(std::chrono::milliseconds(10)), std::future_status::ready);
+  packed.first.get();
+  pool->Release();
+}
+
+TEST(FastFutureTest, Exception) {
+  auto packed = MakeFutureTask<int>(nullptr, []() -> int { throw std::runtime_error("oops"); });
+  packed.second();
+  EXPECT_THROW(packed.first.get(), std::runtime_error);
+}
+
+TEST(FastFutureTest, BrokenPromise) {
+  FastFuture<int> future;
+  {
+    auto packed = MakeFutureTask<int>(nullptr, [] { return 1; });
+    future = std::move(packed.first);
+  }
+  EXPECT_TRUE(future.is_ready());
+  EXPECT_THROW(future.get(), std::future_error);
+}
+
+TEST(FastFutureTest, PoolOutlivesOwner) {
+  FuturePool* pool = FuturePool::Create();
+  auto packed = MakeFutureTask<std::unique_ptr<int>>(pool, [] {
+    return std::unique_ptr<int>(new int(3));
+  });
+  pool->Release();        // the owner goes away first
+  packed.second();
+  EXPECT_EQ(*packed.first.get(), 3);
+}
+
+TEST(FastFutureTest, Then) {
+  FuturePool* pool = FuturePool::Create();
+  auto packed = MakeFutureTask<int>(pool, [] { return 20; });
+  FastFuture<std::string> future = std::move(packed.first)
+      .Then([](int v) { return v + 1; })
+      .Then([](int v) { return std::to_string(v * 2); });
+  EXPECT_FALSE(packed.first.valid());
+  EXPECT_FALSE(future.is_ready());
+  packed.second();        // runs the whole chain here
+  EXPECT_TRUE(future.is_ready());
+  EXPECT_EQ(future.get(), "42");
+
+  // Already complete: the continuation runs inline.
+  auto done = MakeFutureTask<void>(pool, [] { });
+  done.second();
+  int calls = 0;
+  FastFuture<void> next = std::move(done.first).Then([&calls] { calls ++; });
+  EXPECT_EQ(calls, 1);
+  next.get();
+  pool->Release();
+}
+
+TEST(FastFutureTest, ThenPassesErrors) {
+  auto packed = MakeFutureTask<int>(nullptr, []() -> int { throw std::runtime_error("oops"); });
+  bool skipped = true;
+  FastFuture<int> future = std::move(packed.first).Then([&skipped](int v) {
+    skipped = false;
+    return v;
+  });
+  packed.second();
+  EXPECT_THROW(future.get(), std::runtime_error);
+  EXPECT_TRUE(skipped);
+
+  auto broken = MakeFutureTask<int>(nullptr, [] { return 1; });
+  FastFuture<void> tail = std::move(broken.first).Then([](int) { });
+  { auto runner = std::move(broken.second); }
+  EXPECT_THROW(tail.get(), std::future_error);
+}
+
+TEST(FastFutureTest, ThenOnExecutor) {
+  struct Inbox {
+    void Submit(cos::base::FutureRunner<int>&& runner) { runners.push_back(std::move(runner)); }
+    std::vector<cos::base::FutureRunner<int>> runners;
+  } inbox;
+  auto packed = MakeFutureTask<int>(nullptr, [] { return 1; });
+  FastFuture<int> future = std::move(packed.first).Then(inbox, [](int v) { return v + 1; });
+  packed.second();
+  EXPECT_FALSE(future.is_ready());
+  ASSERT_EQ(inbox.runners.size(), 1u);
+  inbox.runners[0]();
+  EXPECT_EQ(future.get(), 2);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
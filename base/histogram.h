@@ -0,0 +1,168 @@
+/*
+ * Log-linear latency histograms in the spirit of HdrHistogram: every power
+ * of two is split into 16 linear sub-buckets, so any recorded value is
+ * known within 1/16 of itself. Values are nanoseconds up to about 18
+ * minutes; larger ones land in the last bucket.
+ */
+
+#ifndef BASE_HISTOGRAM_H_
+#define BASE_HISTOGRAM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t HISTOGRAM_SUB_BITS = 4;
+constexpr std::size_t HISTOGRAM_MAX_BITS = 40;
+constexpr std::size_t HISTOGRAM_BUCKETS =
+    (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS;
+
+inline std::size_t histogram_bucket(std::uint64_t value) {
+  const std::uint64_t sub = 1ULL << HISTOGRAM_SUB_BITS;
+  if (value < sub) {
+    return (std::size_t)value;
+  }
+  std::size_t exp = 63 - __builtin_clzll(value);
+  if (exp >= HISTOGRAM_MAX_BITS) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  std::size_t shift = exp - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) + (std::size_t)((value >> shift) & (sub - 1));
+}
+
+// Largest value that falls into 'bucket'.
+inline std::uint64_t histogram_upper(std::size_t bucket) {
+  const std::size_t sub = 1 << HISTOGRAM_SUB_BITS;
+  if (bucket < sub) {
+    return bucket;
+  }
+  std::size_t shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+  std::uint64_t base = (std::uint64_t)(sub + (bucket & (sub - 1))) << shift;
+  return base + ((1ULL << shift) - 1);
+}
+
+// A plain histogram, for snapshots and merging.
+class Histogram {
+ public:
+  Histogram() : counts_(HISTOGRAM_BUCKETS, 0) { }
+
+  void Record(std::uint64_t value, std::uint64_t times = 1) {
+    counts_[histogram_bucket(value)] += times;
+    count_ += times;
+    sum_ += value * times;
+    max_ = std::max(max_, value);
+  }
+
+  void Merge(const Histogram& other) {
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i ++) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  // What was recorded after 'earlier', a snapshot of the same histogram.
+  // The maximum cannot be told apart and stays the overall one.
+  Histogram Since(const Histogram& earlier) const {
+    Histogram diff;
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i ++) {
+      diff.counts_[i] = counts_[i] - earlier.counts_[i];
+    }
+    diff.count_ = count_ - earlier.count_;
+    diff.sum_ = sum_ - earlier.sum_;
+    diff.max_ = diff.count_ > 0 ? max_ : 0;
+    return diff;
+  }
+
+  std::uint64_t Count() const { return count_; }
+  std::uint64_t Sum() const { return sum_; }
+  std::uint64_t Max() const { return max_; }
+
+  double Mean() const {
+    return count_ == 0 ? 0.0 : (double)sum_ / (double)count_;
+  }
+
+  // Upper bound of the bucket holding the q-th quantile, q in [0, 1].
+  std::uint64_t Percentile(double q) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    std::uint64_t rank = (std::uint64_t)(q * (double)(count_ - 1)) + 1;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i ++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(max_, histogram_upper(i));
+      }
+    }
+    return max_;
+  }
+
+  const std::vector<std::uint64_t>& Buckets() const { return counts_; }
+
+ private:
+  friend class AtomicHistogram;
+
+  std::vector<std::uint64_t> counts_;
+  std::uint64_t count_ = 0;
+  std::uint64_t sum_ = 0;
+  std::uint64_t max_ = 0;
+};
+
+// Written by one thread, read by any. Recording is a few relaxed loads and
+// stores, no read-modify-write.
+class AtomicHistogram {
+ public:
+  AtomicHistogram() {
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i ++) {
+      counts_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  AtomicHistogram(const AtomicHistogram&) = delete;
+  AtomicHistogram& operator=(const AtomicHistogram&) = delete;
+
+  // Only from the owning thread.
+  void Record(std::uint64_t value) {
+    bump(counts_[histogram_bucket(value)], 1);
+    bump(count_, 1);
+    bump(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // Adds the current contents to 'hist'. Concurrent records may be torn
+  // between the counters, which is fine for monitoring.
+  void CopyTo(Histogram& hist) const {
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i ++) {
+      std::uint64_t n = counts_[i].load(std::memory_order_relaxed);
+      hist.counts_[i] += n;
+      count += n;
+    }
+    hist.count_ += count;
+    hist.sum_ += sum_.load(std::memory_order_relaxed);
+    hist.max_ = std::max(hist.max_, max_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t> counts_[HISTOGRAM_BUCKETS];
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<std::uint64_t> sum_{0};
+  std::atomic<std::uint64_t> max_{0};
+};
+
+}  // namespace base
+}  // namespace cos
+
+#endif  // BASE_HISTOGRAM_H_
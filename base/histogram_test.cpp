@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <thread>
+#include "gtest/gtest.h"
+#include "histogram.h"
+
+using cos::base::AtomicHistogram;
+using cos::base::Histogram;
+using cos::base::HISTOGRAM_BUCKETS;
+using cos::base::histogram_bucket;
+using cos::base::histogram_upper;
+
+TEST(HistogramTest, BucketsAreContiguous) {
+  EXPECT_EQ(histogram_bucket(0), 0);
+  EXPECT_EQ(histogram_bucket(15), 15);
+  EXPECT_EQ(histogram_bucket(16), 16);
+  for (std::size_t i = 0; i + 1 < HISTOGRAM_BUCKETS; i ++) {
+    EXPECT_EQ(histogram_bucket(histogram_upper(i)), i);
+    EXPECT_EQ(histogram_bucket(histogram_upper(i) + 1), i + 1);
+  }
+  EXPECT_EQ(histogram_bucket(UINT64_MAX), HISTOGRAM_BUCKETS - 1);
+}
+
+TEST(HistogramTest, RelativeError) {
+  for (std::uint64_t v = 1; v < (1ULL << 39); v = v * 3 + 1) {
+    std::uint64_t upper = histogram_upper(histogram_bucket(v));
+    EXPECT_GE(upper, v);
+    EXPECT_LE(upper - v, v / 16);
+  }
+}
+
+TEST(HistogramTest, Percentiles) {
+  Histogram hist;
+  for (std::uint64_t v = 1; v <= 1000; v ++) {
+    hist.Record(v * 1000);
+  }
+  EXPECT_EQ(hist.Count(), 1000);
+  EXPECT_EQ(hist.Max(), 1000000);
+  EXPECT_DOUBLE_EQ(hist.Mean(), 500500.0);
+  EXPECT_NEAR(hist.Percentile(0.5), 500000, 500000 / 16);
+  EXPECT_NEAR(hist.Percentile(0.99), 990000, 990000 / 16);
+  EXPECT_EQ(hist.Percentile(1.0), 1000000);
+  EXPECT_EQ(Histogram().Percentile(0.5), 0);
+}
+
+TEST(HistogramTest, MergeAndSince) {
+  Histogram a, b;
+  a.Record(100, 10);
+  b.Record(100000, 10);
+  Histogram before = a;
+  a.Merge(b);
+  EXPECT_EQ(a.Count(), 20);
+  EXPECT_NEAR(a.Percentile(0.25), 100, 100 / 16);
+  EXPECT_GE(a.Percentile(0.75), 100000);
+
+  Histogram recent = a.Since(before);
+  EXPECT_EQ(recent.Count(), 10);
+  EXPECT_GE(recent.Percentile(0.0), 100000);
+}
+
+TEST(HistogramTest, AtomicSingleWriter) {
+  AtomicHistogram atomic;
+  std::thread writer([&atomic] {
+    for (std::uint64_t i = 0; i < 100000; i ++) {
+      atomic.Record(i % 1000);
+    }
+  });
+  Histogram partial;
+  atomic.CopyTo(partial);    // concurrent read
+  writer.join();
+  EXPECT_LE(partial.Count(), 100000);
+
+  Histogram full;
+  atomic.CopyTo(full);
+  EXPECT_EQ(full.Count(), 100000);
+  EXPECT_EQ(full.Max(), 999);
+  EXPECT_EQ(full.Sum(), 100ULL * 999 * 1000 / 2);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,126 @@
+/*
+ * A thread safe queue with weighted priority lanes. Inside a lane the
+ * element with the smallest key comes first, ties in push order. Across
+ * lanes, stride scheduling: when several lanes are busy each gets pops in
+ * proportion to its weight, so no lane starves.
+ */
+
+#ifndef BASE_LANE_QUEUE_H_
+#define BASE_LANE_QUEUE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace cos {
+namespace base {
+
+constexpr std::uint64_t LANE_STRIDE = 1 << 20;
+
+template <typename T>
+class LaneQueue {
+ public:
+  // One lane per weight, a weight of 0 counts as 1.
+  explicit LaneQueue(const std::vector<std::size_t>& weights) : lanes_(weights.size()) {
+    for (std::size_t i = 0; i < weights.size(); i ++) {
+      lanes_[i].stride = LANE_STRIDE / std::max<std::size_t>(1, weights[i]);
+    }
+  }
+
+  LaneQueue(const LaneQueue&) = delete;
+  LaneQueue& operator=(const LaneQueue&) = delete;
+
+  std::size_t lanes() const {
+    return lanes_.size();
+  }
+
+  // 'lane' is clamped to the last one.
+  void push(std::size_t lane, std::uint64_t key, T&& element) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    push_locked(lane, key, std::move(element));
+  }
+
+  // Pushes [first, last) into one lane under one lock.
+  template <typename It>
+  void push_bulk(std::size_t lane, std::uint64_t key, It first, It last) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (; first != last; ++ first) {
+      T element(*first);
+      push_locked(lane, key, std::move(element));
+    }
+  }
+
+  // Pops from the busy lane that is the most behind its share.
+  bool try_pop(T& element) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (size_ == 0) {
+      return false;
+    }
+    Lane* next = nullptr;
+    for (Lane& lane : lanes_) {
+      if (!lane.heap.empty() && (next == nullptr || lane.pass < next->pass)) {
+        next = &lane;
+      }
+    }
+    std::pop_heap(next->heap.begin(), next->heap.end(), Later());
+    element = std::move(next->heap.back().element);
+    next->heap.pop_back();
+    vtime_ = next->pass;
+    next->pass += next->stride;
+    size_ --;
+    return true;
+  }
+
+  std::size_t size() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return size_;
+  }
+
+  bool empty() {
+    return size() == 0;
+  }
+
+ private:
+  struct Item {
+    std::uint64_t key;
+    std::uint64_t seq;
+    T element;
+  };
+
+  // Orders the heap so that its front is the earliest item.
+  struct Later {
+    bool operator()(const Item& a, const Item& b) const {
+      return a.key != b.key ? a.key > b.key : a.seq > b.seq;
+    }
+  };
+
+  struct Lane {
+    std::vector<Item> heap;
+    std::uint64_t stride = LANE_STRIDE;
+    std::uint64_t pass = 0;
+  };
+
+  void push_locked(std::size_t lane, std::uint64_t key, T&& element) {
+    Lane& target = lanes_[std::min(lane, lanes_.size() - 1)];
+    if (target.heap.empty()) {
+      // An idle lane saves no credit: it joins at the current virtual time.
+      target.pass = std::max(target.pass, vtime_);
+    }
+    target.heap.push_back(Item{key, seq_ ++, std::move(element)});
+    std::push_heap(target.heap.begin(), target.heap.end(), Later());
+    size_ ++;
+  }
+
+  std::vector<Lane> lanes_;
+  std::uint64_t vtime_ = 0;
+  std::uint64_t seq_ = 0;
+  std::size_t size_ = 0;
+  std::mutex mtx_;
+};
+
+}  // namespace base
+}  // namespace cos
+
+#endif  // BASE_LANE_QUEUE_H_
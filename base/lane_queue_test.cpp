@@ -0,0 +1,115 @@
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "lane_queue.h"
+
+using cos::base::LaneQueue;
+
+TEST(LaneQueueTest, EarliestKeyFirst) {
+  LaneQueue<int> que({1});
+  que.push(0, 30, 3);
+  que.push(0, 10, 1);
+  que.push(0, 20, 2);
+  que.push(0, 10, 4);     // same key, after the first one
+  std::vector<int> order;
+  int value = 0;
+  while (que.try_pop(value)) {
+    order.push_back(value);
+  }
+  EXPECT_EQ(order, std::vector<int>({1, 4, 2, 3}));
+  EXPECT_TRUE(que.empty());
+}
+
+TEST(LaneQueueTest, WeightedShares) {
+  LaneQueue<int> que({3, 1});
+  for (int i = 0; i < 400; i ++) {
+    que.push(0, i, 0);
+    que.push(1, i, 1);
+  }
+  int pops[2] = {0, 0};
+  int value = 0;
+  for (int i = 0; i < 400; i ++) {
+    ASSERT_TRUE(que.try_pop(value));
+    pops[value] ++;
+  }
+  EXPECT_EQ(pops[0], 300);
+  EXPECT_EQ(pops[1], 100);
+  EXPECT_EQ(que.size(), 400);
+}
+
+TEST(LaneQueueTest, NoStarvation) {
+  LaneQueue<int> que({100, 1});
+  que.push(1, 0, 1);
+  int value = 0;
+  int rounds = 0;
+  // The first lane is never empty, yet the last one is served.
+  do {
+    que.push(0, rounds, 0);
+    que.push(0, rounds, 0);
+    ASSERT_TRUE(que.try_pop(value));
+    rounds ++;
+  } while (value != 1);
+  EXPECT_LE(rounds, 101);
+}
+
+TEST(LaneQueueTest, IdleLaneSavesNoCredit) {
+  LaneQueue<int> que({1, 1});
+  int value = 0;
+  for (int i = 0; i < 100; i ++) {
+    que.push(0, i, 0);
+    ASSERT_TRUE(que.try_pop(value));
+  }
+  // Lane 1 was idle all along, it does not get 100 pops in a row now.
+  for (int i = 0; i < 10; i ++) {
+    que.push(0, i, 0);
+    que.push(1, i, 1);
+  }
+  int pops[2] = {0, 0};
+  for (int i = 0; i < 10; i ++) {
+    ASSERT_TRUE(que.try_pop(value));
+    pops[value] ++;
+  }
+  EXPECT_EQ(pops[0], 5);
+  EXPECT_EQ(pops[1], 5);
+}
+
+TEST(LaneQueueTest, ClampsLane) {
+  LaneQueue<int> que({1, 1});
+  que.push(7, 0, 7);
+  std::vector<int> values = {1, 2};
+  que.push_bulk(9, 0, values.begin(), values.end());
+  EXPECT_EQ(que.size(), 3);
+  int value = 0;
+  EXPECT_TRUE(que.try_pop(value));
+  EXPECT_EQ(value, 7);
+}
+
+TEST(LaneQueueTest, Concurrent) {
+  LaneQueue<int> que({2, 1});
+  std::vector<std::thread> producers;
+  for (int p = 0; p < 2; p ++) {
+    producers.emplace_back([&que, p] {
+      for (int i = 0; i < 10000; i ++) {
+        que.push(p, i, 1);
+      }
+    });
+  }
+  int total = 0;
+  int value = 0;
+  while (total < 20000) {
+    if (que.try_pop(value)) {
+      total += value;
+    }
+  }
+  for (auto& thrd : producers) {
+    thrd.join();
+  }
+  EXPECT_EQ(total, 20000);
+  EXPECT_TRUE(que.empty());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,428 @@
+/*
+ * A mutex that profiles its own contention: acquisitions, how long they
+ * waited, how long the lock was held and from where the waiting ones came.
+ * base::Mutex and base::CondVar are std::mutex and std::condition_variable
+ * unless COS_PROFILE_LOCKS is set to 1, the same in every translation unit,
+ * then they are ProfiledMutex and std::condition_variable_any. The queues
+ * and branches lock through them, LockProfiler::Report() tells what they
+ * cost so far and the profile goes to stderr at exit. ProfiledMutex and
+ * LockProfiler exist only then, the default build pays for <mutex> alone.
+ *
+ * A call site is the stack above lock(), captured only when the lock was
+ * busy. Frames get names when the binary is linked with -rdynamic,
+ * otherwise they are addresses for addr2line.
+ */
+
+#ifndef BASE_PROFILED_MUTEX_H_
+#define BASE_PROFILED_MUTEX_H_
+
+#include <condition_variable>
+#include <mutex>
+
+#ifndef COS_PROFILE_LOCKS
+#define COS_PROFILE_LOCKS 0
+#endif
+
+#if COS_PROFILE_LOCKS
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cxxabi.h>
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#define COS_HAS_BACKTRACE 1
+#else
+#define COS_HAS_BACKTRACE 0
+#endif
+
+#include "base/histogram.h"
+#endif
+
+namespace cos {
+namespace base {
+
+#if COS_PROFILE_LOCKS
+
+constexpr std::size_t LOCK_SITES = 16;          // call sites kept per lock
+constexpr std::size_t LOCK_SITE_DEPTH = 6;      // frames kept per call site
+
+struct LockSite {
+  std::vector<void*> frames;        // innermost first
+  std::uint64_t waits = 0;
+  std::uint64_t wait_ns = 0;
+};
+
+// A lock, or all the locks of the same name merged.
+struct LockStats {
+  std::string name;
+  std::size_t instances = 0;
+  std::uint64_t acquisitions = 0;
+  std::uint64_t contended = 0;      // found the lock busy
+  Histogram wait_ns;                // 0 for the uncontended ones
+  Histogram hold_ns;
+  std::vector<LockSite> sites;      // most waited first
+  std::uint64_t other_waits = 0;    // from sites beyond LOCK_SITES
+  std::uint64_t other_wait_ns = 0;
+
+  void Merge(const LockStats& other) {
+    instances += other.instances;
+    acquisitions += other.acquisitions;
+    contended += other.contended;
+    wait_ns.Merge(other.wait_ns);
+    hold_ns.Merge(other.hold_ns);
+    for (const LockSite& site : other.sites) {
+      auto it = std::find_if(sites.begin(), sites.end(), [&site](const LockSite& mine) {
+        return mine.frames == site.frames;
+      });
+      if (it == sites.end()) {
+        sites.push_back(site);
+      } else {
+        it->waits += site.waits;
+        it->wait_ns += site.wait_ns;
+      }
+    }
+    other_waits += other.other_waits;
+    other_wait_ns += other.other_wait_ns;
+    std::sort(sites.begin(), sites.end(), [](const LockSite& a, const LockSite& b) {
+      return a.wait_ns > b.wait_ns;
+    });
+  }
+};
+
+// A std::mutex recording its acquisitions. The counters are written by
+// the holder and read by anyone. 'name' must outlive the process, it
+// defaults to the function constructing the mutex, e.g. the constructor
+// of the class holding it.
+class ProfiledMutex {
+ public:
+  explicit ProfiledMutex(const char* name = __builtin_FUNCTION());
+
+  ProfiledMutex(const ProfiledMutex&) = delete;
+  ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+  ~ProfiledMutex();
+
+  void lock() {
+    if (mtx_.try_lock()) {
+      acquired(0);
+      return;
+    }
+    void* frames[LOCK_SITE_DEPTH];
+    std::size_t depth = capture(frames);
+    std::uint64_t begin = now_ns();
+    mtx_.lock();
+    std::uint64_t waited = std::max<std::uint64_t>(now_ns() - begin, 1);
+    acquired(waited);
+    record_site(frames, depth, waited);
+  }
+
+  bool try_lock() {
+    if (!mtx_.try_lock()) {
+      return false;
+    }
+    acquired(0);
+    return true;
+  }
+
+  void unlock() {
+    hold_ns_.Record(now_ns() - held_since_);
+    mtx_.unlock();
+  }
+
+  const char* Name() const { return name_; }
+
+  // What this lock recorded so far. Racy with the holder, which is fine
+  // for profiling.
+  LockStats Stats() const {
+    LockStats stats;
+    stats.name = name_;
+    stats.instances = 1;
+    stats.acquisitions = acquisitions_.load(std::memory_order_relaxed);
+    stats.contended = contended_.load(std::memory_order_relaxed);
+    wait_ns_.CopyTo(stats.wait_ns);
+    hold_ns_.CopyTo(stats.hold_ns);
+    std::size_t used = sites_used_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < used; i ++) {
+      LockSite site;
+      site.frames.assign(sites_[i].frames, sites_[i].frames + sites_[i].depth);
+      site.waits = sites_[i].waits.load(std::memory_order_relaxed);
+      site.wait_ns = sites_[i].wait_ns.load(std::memory_order_relaxed);
+      stats.sites.push_back(site);
+    }
+    stats.other_waits = other_waits_.load(std::memory_order_relaxed);
+    stats.other_wait_ns = other_wait_ns_.load(std::memory_order_relaxed);
+    std::sort(stats.sites.begin(), stats.sites.end(), [](const LockSite& a, const LockSite& b) {
+      return a.wait_ns > b.wait_ns;
+    });
+    return stats;
+  }
+
+ private:
+  struct Site {
+    void* frames[LOCK_SITE_DEPTH];
+    std::size_t depth = 0;
+    std::atomic<std::uint64_t> waits{0};
+    std::atomic<std::uint64_t> wait_ns{0};
+  };
+
+  static std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  // Skips its own frame, never inlined so there is one.
+  __attribute__((noinline)) static std::size_t capture(void** frames) {
+#if COS_HAS_BACKTRACE
+    void* raw[LOCK_SITE_DEPTH + 1];
+    int depth = backtrace(raw, (int)(LOCK_SITE_DEPTH + 1));
+    std::size_t kept = depth > 1 ? (std::size_t)depth - 1 : 0;
+    std::copy(raw + 1, raw + 1 + kept, frames);
+    return kept;
+#else
+    (void)frames;
+    return 0;
+#endif
+  }
+
+  // With the lock held.
+  void acquired(std::uint64_t waited) {
+    held_since_ = now_ns();
+    bump(acquisitions_, 1);
+    if (waited > 0) {
+      bump(contended_, 1);
+    }
+    wait_ns_.Record(waited);
+  }
+
+  // With the lock held, so a slot is claimed by one thread at a time.
+  void record_site(void* const* frames, std::size_t depth, std::uint64_t waited) {
+    std::size_t used = sites_used_.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < used; i ++) {
+      if (sites_[i].depth == depth && std::equal(frames, frames + depth, sites_[i].frames)) {
+        bump(sites_[i].waits, 1);
+        bump(sites_[i].wait_ns, waited);
+        return;
+      }
+    }
+    if (used == LOCK_SITES) {
+      bump(other_waits_, 1);
+      bump(other_wait_ns_, waited);
+      return;
+    }
+    Site& slot = sites_[used];
+    std::copy(frames, frames + depth, slot.frames);
+    slot.depth = depth;
+    slot.waits.store(1, std::memory_order_relaxed);
+    slot.wait_ns.store(waited, std::memory_order_relaxed);
+    sites_used_.store(used + 1, std::memory_order_release);
+  }
+
+  std::mutex mtx_;
+  const char* const name_;
+  std::uint64_t held_since_ = 0;
+  std::atomic<std::uint64_t> acquisitions_{0};
+  std::atomic<std::uint64_t> contended_{0};
+  AtomicHistogram wait_ns_;
+  AtomicHistogram hold_ns_;
+  Site sites_[LOCK_SITES];
+  std::atomic<std::size_t> sites_used_{0};
+  std::atomic<std::uint64_t> other_waits_{0};
+  std::atomic<std::uint64_t> other_wait_ns_{0};
+};
+
+// Every ProfiledMutex of the process, alive or not.
+class LockProfiler {
+ public:
+  // One entry per lock name, the live locks and the destroyed ones merged,
+  // most waited first.
+  static std::vector<LockStats> Report() {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    std::vector<LockStats> report = registry.retired;
+    for (ProfiledMutex* mutex : registry.live) {
+      merge_into(report, mutex->Stats());
+    }
+    std::sort(report.begin(), report.end(), [](const LockStats& a, const LockStats& b) {
+      return a.wait_ns.Sum() > b.wait_ns.Sum();
+    });
+    return report;
+  }
+
+  // Forgets the destroyed locks. Live ones keep their counts.
+  static void Reset() {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.retired.clear();
+  }
+
+  // Report() as text, with the 'sites' busiest call sites of each lock.
+  static void Print(std::ostream& os, std::size_t sites = 3) {
+    std::vector<LockStats> report = Report();
+    os << "lock profile, by time waited (ns):\n";
+    for (const LockStats& stats : report) {
+      double share = stats.acquisitions == 0 ? 0.0 : 100.0 * stats.contended / stats.acquisitions;
+      os << "  " << stats.name << " x" << stats.instances << ": " << stats.acquisitions
+         << " acquisitions, " << stats.contended << " contended (" << fixed(share) << "%)"
+         << ", wait total " << stats.wait_ns.Sum() << " p50 " << stats.wait_ns.Percentile(0.5)
+         << " p99 " << stats.wait_ns.Percentile(0.99) << " max " << stats.wait_ns.Max()
+         << ", hold mean " << fixed(stats.hold_ns.Mean()) << " p99 " << stats.hold_ns.Percentile(0.99)
+         << " max " << stats.hold_ns.Max() << "\n";
+      for (std::size_t i = 0; i < stats.sites.size() && i < sites; i ++) {
+        const LockSite& site = stats.sites[i];
+        os << "    " << site.waits << " waits, " << site.wait_ns << " ns: " << Describe(site) << "\n";
+      }
+      if (stats.other_waits > 0) {
+        os << "    " << stats.other_waits << " waits, " << stats.other_wait_ns << " ns: other sites\n";
+      }
+    }
+  }
+
+  // The innermost 'depth' frames of a call site, without those of the
+  // standard library and of ProfiledMutex.
+  static std::string Describe(const LockSite& site, std::size_t depth = 3) {
+    if (site.frames.empty()) {
+      return "unknown";
+    }
+    std::vector<std::string> names = symbolize(site.frames);
+    std::string out;
+    std::size_t kept = 0;
+    for (const std::string& name : names) {
+      if (name.compare(0, 5, "std::") == 0 || name.find("ProfiledMutex") != std::string::npos) {
+        continue;
+      }
+      if (kept ++ == depth) {
+        break;
+      }
+      out += out.empty() ? name : " <- " + name;
+    }
+    return out.empty() ? names.front() : out;
+  }
+
+  // The report at exit, on by default.
+  static void SetExitReport(bool on) {
+    Registry::Get().exit_report.store(on, std::memory_order_relaxed);
+  }
+
+ private:
+  friend class ProfiledMutex;
+
+  static void add(ProfiledMutex* mutex) {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.live.push_back(mutex);
+  }
+
+  // Keeps what it recorded under its name.
+  static void retire(ProfiledMutex* mutex) {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.live.erase(std::find(registry.live.begin(), registry.live.end(), mutex));
+    merge_into(registry.retired, mutex->Stats());
+  }
+
+  // Never destroyed: detached workers may still lock at exit.
+  struct Registry {
+    static Registry& Get() {
+      static Registry* registry = new Registry();
+      return *registry;
+    }
+    Registry() {
+      std::atexit([] {
+        if (Get().exit_report.load(std::memory_order_relaxed)) {
+          std::ostringstream os;
+          Print(os);
+          std::cerr << os.str() << std::flush;
+        }
+      });
+    }
+    std::mutex mtx;
+    std::vector<ProfiledMutex*> live;
+    std::vector<LockStats> retired;     // one per name
+    std::atomic<bool> exit_report{true};
+  };
+
+  static void merge_into(std::vector<LockStats>& report, const LockStats& stats) {
+    for (LockStats& entry : report) {
+      if (entry.name == stats.name) {
+        entry.Merge(stats);
+        return;
+      }
+    }
+    report.push_back(stats);
+  }
+
+  static std::string fixed(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.1f", value);
+    return buf;
+  }
+
+  // "module(mangled+0x1f) [0x...]" from backtrace_symbols, demangled when
+  // there is a name.
+  static std::vector<std::string> symbolize(const std::vector<void*>& frames) {
+    std::vector<std::string> names;
+#if COS_HAS_BACKTRACE
+    char** symbols = backtrace_symbols(const_cast<void* const*>(frames.data()), (int)frames.size());
+    for (std::size_t i = 0; symbols != nullptr && i < frames.size(); i ++) {
+      std::string symbol = symbols[i];
+      std::size_t open = symbol.find('(');
+      std::size_t plus = symbol.find('+', open);
+      if (open != std::string::npos && plus != std::string::npos && plus > open + 1) {
+        std::string mangled = symbol.substr(open + 1, plus - open - 1);
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+        if (status == 0 && demangled != nullptr) {
+          symbol = demangled;
+        }
+        std::free(demangled);
+      }
+      names.push_back(symbol);
+    }
+    std::free(symbols);
+#endif
+    if (names.size() != frames.size()) {
+      names.clear();
+      for (void* frame : frames) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%p", frame);
+        names.push_back(buf);
+      }
+    }
+    return names;
+  }
+};
+
+inline ProfiledMutex::ProfiledMutex(const char* name) : name_(name) {
+  LockProfiler::add(this);
+}
+
+inline ProfiledMutex::~ProfiledMutex() {
+  LockProfiler::retire(this);
+}
+
+using Mutex = ProfiledMutex;
+using CondVar = std::condition_variable_any;
+
+#else
+
+using Mutex = std::mutex;
+using CondVar = std::condition_variable;
+
+#endif  // COS_PROFILE_LOCKS
+
+}  // namespace base
+}  // namespace cos
+
+#endif  // BASE_PROFILED_MUTEX_H_
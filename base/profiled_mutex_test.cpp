@@ -0,0 +1,139 @@
+// Profiles the locks of this binary, ThreadSafeQueue's included.
+#define COS_PROFILE_LOCKS 1
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "profiled_mutex.h"
+#include "thread_safe_queue.h"
+
+using cos::base::LockProfiler;
+using cos::base::LockStats;
+using cos::base::ProfiledMutex;
+using cos::base::ThreadSafeQueue;
+
+static LockStats Find(const std::string& name) {
+  for (const LockStats& stats : LockProfiler::Report()) {
+    if (stats.name == name) {
+      return stats;
+    }
+  }
+  return LockStats();
+}
+
+TEST(ProfiledMutex, counts_uncontended_acquisitions) {
+  ProfiledMutex mtx("uncontended");
+  for (int i = 0; i < 100; i ++) {
+    std::lock_guard<ProfiledMutex> lock(mtx);
+  }
+  EXPECT_TRUE(mtx.try_lock());
+  mtx.unlock();
+  LockStats stats = mtx.Stats();
+  EXPECT_EQ(stats.name, "uncontended");
+  EXPECT_EQ(stats.acquisitions, 101);
+  EXPECT_EQ(stats.contended, 0);
+  EXPECT_EQ(stats.wait_ns.Count(), 101);
+  EXPECT_EQ(stats.wait_ns.Max(), 0);
+  EXPECT_EQ(stats.hold_ns.Count(), 101);
+  EXPECT_TRUE(stats.sites.empty());
+}
+
+TEST(ProfiledMutex, records_waits_and_their_call_site) {
+  ProfiledMutex mtx("contended");
+  mtx.lock();
+  std::thread waiter([&mtx] {
+    std::lock_guard<ProfiledMutex> lock(mtx);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  mtx.unlock();
+  waiter.join();
+
+  LockStats stats = mtx.Stats();
+  EXPECT_EQ(stats.acquisitions, 2);
+  ASSERT_EQ(stats.contended, 1);
+  EXPECT_GE(stats.wait_ns.Max(), 10000000);
+  EXPECT_GE(stats.hold_ns.Max(), 50000000);
+  ASSERT_EQ(stats.sites.size(), 1);
+  EXPECT_EQ(stats.sites[0].waits, 1);
+  EXPECT_FALSE(stats.sites[0].frames.empty());
+  EXPECT_FALSE(LockProfiler::Describe(stats.sites[0]).empty());
+}
+
+TEST(ProfiledMutex, works_with_condition_variable_any) {
+  ProfiledMutex mtx("condvar");
+  std::condition_variable_any cv;
+  bool ready = false;
+  std::thread notifier([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::lock_guard<ProfiledMutex> lock(mtx);
+    ready = true;
+    cv.notify_one();
+  });
+  {
+    std::unique_lock<ProfiledMutex> ulk(mtx);
+    cv.wait(ulk, [&ready] { return ready; });
+  }
+  notifier.join();
+  // Waiting released the lock, the time asleep is not held.
+  LockStats stats = mtx.Stats();
+  EXPECT_GE(stats.acquisitions, 3);
+  EXPECT_LT(stats.hold_ns.Max(), 10000000);
+}
+
+TEST(LockProfiler, merges_locks_of_a_name_and_keeps_the_destroyed) {
+  LockProfiler::Reset();
+  {
+    ProfiledMutex first("merged");
+    ProfiledMutex second("merged");
+    first.lock();
+    first.unlock();
+    second.lock();
+    second.unlock();
+    LockStats live = Find("merged");
+    EXPECT_EQ(live.instances, 2);
+    EXPECT_EQ(live.acquisitions, 2);
+  }
+  LockStats gone = Find("merged");
+  EXPECT_EQ(gone.instances, 2);
+  EXPECT_EQ(gone.acquisitions, 2);
+  LockProfiler::Reset();
+  EXPECT_EQ(Find("merged").instances, 0);
+}
+
+TEST(LockProfiler, profiles_thread_safe_queue) {
+  LockStats before = Find("ThreadSafeQueue");
+  {
+    ThreadSafeQueue<int> que;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t ++) {
+      threads.emplace_back([&que] {
+        for (int i = 0; i < 10000; i ++) {
+          que.push_back(i);
+          int out;
+          que.try_pop(out);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  LockStats after = Find("ThreadSafeQueue");
+  EXPECT_EQ(after.instances - before.instances, 1);
+  EXPECT_EQ(after.acquisitions - before.acquisitions, 80000);
+
+  std::ostringstream os;
+  LockProfiler::Print(os);
+  EXPECT_NE(os.str().find("ThreadSafeQueue x"), std::string::npos);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  LockProfiler::SetExitReport(false);
+  return RUN_ALL_TESTS();
+}
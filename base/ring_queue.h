@@ -0,0 +1,280 @@
+/*
+ * A bounded lock-free multi-producer/multi-consumer ring queue.
+ * Every cell carries a sequence number telling producers and consumers
+ * whose turn it is, so the two ends never touch the same lock.
+ */
+
+#ifndef BASE_RING_QUEUE_H_
+#define BASE_RING_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+#include "base/utility.h"
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t DEFAULT_RING_CAPACITY = 1 << 14;
+constexpr std::size_t DEFAULT_FRONT_RING_CAPACITY = 1 << 10;
+
+template <typename T>
+class RingBuffer {
+ public:
+  using size_type = std::size_t;
+
+  // The capacity is rounded up to a power of two.
+  explicit RingBuffer(size_type capacity = DEFAULT_RING_CAPACITY)
+      : mask_(round_up(capacity) - 1),
+        stride_((sizeof(Cell) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE) {
+    raw_ = static_cast<char*>(::operator new(stride_ * (mask_ + 1) + CACHE_LINE_SIZE));
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(raw_);
+    cells_ = raw_ + (CACHE_LINE_SIZE - addr % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+    for (size_type i = 0; i <= mask_; i ++) {
+      new (cell_at(i)) Cell();
+      cell_at(i)->seq.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  ~RingBuffer() {
+    T element;
+    while (try_pop(element)) { }
+    for (size_type i = 0; i <= mask_; i ++) {
+      cell_at(i)->~Cell();
+    }
+    ::operator delete(raw_);
+  }
+
+  // Leaves 'element' untouched when the ring is full.
+  bool try_push(T&& element) {
+    Cell* cell = nullptr;
+    size_type pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = cell_at(pos);
+      size_type seq = cell->seq.load(std::memory_order_acquire);
+      std::intptr_t dif = (std::intptr_t)seq - (std::intptr_t)pos;
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;   // full
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&cell->storage) T(std::move(element));
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_push(const T& element) {
+    T copy(element);
+    return try_push(std::move(copy));
+  }
+
+  // Reserves 'n' consecutive cells with a single CAS and fills them from
+  // 'first'. Fails without touching the input if fewer than 'n' are free.
+  template <typename It>
+  bool try_push_bulk(It first, size_type n) {
+    size_type pos = enqueue_pos_.load(std::memory_order_relaxed);
+    do {
+      if (pos + n - dequeue_pos_.load(std::memory_order_acquire) > capacity()) {
+        return false;
+      }
+    } while (!enqueue_pos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed));
+
+    for (size_type i = 0; i < n; i ++, ++ first) {
+      Cell* cell = cell_at(pos + i);
+      // A consumer of the previous lap may still be moving out of the cell.
+      while (cell->seq.load(std::memory_order_acquire) != pos + i) {
+        cpu_relax();
+      }
+      new (&cell->storage) T(*first);
+      cell->seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return true;
+  }
+
+  bool try_pop(T& element) {
+    Cell* cell = nullptr;
+    size_type pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = cell_at(pos);
+      size_type seq = cell->seq.load(std::memory_order_acquire);
+      std::intptr_t dif = (std::intptr_t)seq - (std::intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;   // empty
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    T* ptr = reinterpret_cast<T*>(&cell->storage);
+    element = std::move(*ptr);
+    ptr->~T();
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Approximate under concurrent access, but never negative.
+  size_type size() const {
+    size_type deq = dequeue_pos_.load();
+    size_type enq = enqueue_pos_.load();
+    return enq - deq;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_type capacity() const {
+    return mask_ + 1;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_type> seq;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  static size_type round_up(size_type capacity) {
+    size_type n = 2;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+  Cell* cell_at(size_type pos) const {
+    return reinterpret_cast<Cell*>(cells_ + (pos & mask_) * stride_);
+  }
+
+  const size_type mask_;
+  const size_type stride_;          // sizeof(Cell) padded to whole cache lines
+  char* raw_ = nullptr;
+  char* cells_ = nullptr;
+
+  char pad0_[CACHE_LINE_SIZE];
+  std::atomic<size_type> enqueue_pos_;
+  char pad1_[CACHE_LINE_SIZE - sizeof(std::atomic<size_type>)];
+  std::atomic<size_type> dequeue_pos_;
+  char pad2_[CACHE_LINE_SIZE - sizeof(std::atomic<size_type>)];
+};
+
+// Lock-free counterpart of ThreadSafeQueue. push_front() goes into a small
+// ring that consumers always drain first, which keeps the "run next"
+// meaning of urgent tasks. Pushing into a full ring yields until there is
+// room again, so a consumer must not push, it would wait for itself: it
+// uses try_push_front()/try_push_back() and pops when they fail.
+template <typename T>
+class RingQueue {
+ public:
+  using size_type = std::size_t;
+
+  explicit RingQueue(size_type capacity = DEFAULT_RING_CAPACITY,
+                     size_type front_capacity = DEFAULT_FRONT_RING_CAPACITY)
+      : front_(front_capacity), back_(capacity) { }
+  RingQueue(const RingQueue&) = delete;
+  RingQueue& operator=(const RingQueue&) = delete;
+  ~RingQueue() { }
+
+  void push_front(const T& element) {
+    T copy(element);
+    push_front(std::move(copy));
+  }
+
+  void push_front(T&& element) {
+    while (!front_.try_push(std::move(element))) {
+      std::this_thread::yield();
+    }
+  }
+
+  void push_back(const T& element) {
+    T copy(element);
+    push_back(std::move(copy));
+  }
+
+  void push_back(T&& element) {
+    while (!back_.try_push(std::move(element))) {
+      std::this_thread::yield();
+    }
+  }
+
+  template <typename It>
+  void push_front_bulk(It first, It last) {
+    push_bulk(front_, first, last);
+  }
+
+  template <typename It>
+  void push_back_bulk(It first, It last) {
+    push_bulk(back_, first, last);
+  }
+
+  // Leave 'element' untouched when the ring is full.
+  bool try_push_front(T&& element) {
+    return front_.try_push(std::move(element));
+  }
+
+  bool try_push_back(T&& element) {
+    return back_.try_push(std::move(element));
+  }
+
+  bool try_pop(T& element) {
+    return front_.try_pop(element) || back_.try_pop(element);
+  }
+
+  size_type size() const {
+    return front_.size() + back_.size();
+  }
+
+  bool empty() const {
+    return front_.empty() && back_.empty();
+  }
+
+  size_type capacity() const {
+    return back_.capacity();
+  }
+
+  // The largest batch that may go in without waiting for consumers. Bigger
+  // batches should be pushed in pieces, waking consumers in between.
+  size_type max_batch() const {
+    return std::min(front_.capacity(), back_.capacity()) / 2;
+  }
+
+ private:
+  // Batches larger than the ring go in ring-sized pieces.
+  template <typename It>
+  static void push_bulk(RingBuffer<T>& ring, It first, It last) {
+    size_type left = std::distance(first, last);
+    while (left > 0) {
+      size_type n = std::min(left, ring.capacity());
+      while (!ring.try_push_bulk(first, n)) {
+        std::this_thread::yield();
+      }
+      std::advance(first, n);
+      left -= n;
+    }
+  }
+
+  RingBuffer<T> front_;
+  RingBuffer<T> back_;
+};
+
+} // namespace base
+} // namespace cos
+
+#endif // BASE_RING_QUEUE_H_
@@ -0,0 +1,297 @@
+/*
+ * A slab allocator with thread-local caches. Blocks come in a few size
+ * classes carved from chunks, bigger requests go to malloc. A thread
+ * allocates from its own cache without locking. A block freed by another
+ * thread goes back to the cache it came from through a lock-free list the
+ * owner collects when it runs dry, so what a submitter allocates and a
+ * worker frees is reused by the submitter. The cache of an exited thread
+ * is adopted by the next new one. Chunks are never given back.
+ */
+
+#ifndef BASE_SLAB_H_
+#define BASE_SLAB_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t SLAB_CLASSES = 5;              // blocks of 64 to 1024 bytes
+constexpr std::size_t SLAB_MIN_BLOCK = 64;
+constexpr std::size_t SLAB_CHUNK_SIZE = 64 * 1024;
+
+// Bytes counted in whole blocks, headers included.
+struct SlabStats {
+  std::size_t live_bytes = 0;       // handed out, see Slab::Stats()
+  std::size_t peak_bytes = 0;
+  std::size_t reserved_bytes = 0;   // in chunks and big blocks
+};
+
+class Slab {
+ public:
+  // Aligned for any type, like malloc. Throws std::bad_alloc.
+  static void* Allocate(std::size_t size) {
+    std::size_t cls = class_of(size + sizeof(Header));
+    Cache* cache = local_cache(true);
+    Header* header;
+    std::size_t bytes;
+    if (cls == SLAB_CLASSES) {
+      // A big block is preceded by its size.
+      bytes = size + 2 * sizeof(Header);
+      char* raw = static_cast<char*>(std::malloc(bytes));
+      if (raw == nullptr) {
+        throw std::bad_alloc();
+      }
+      *reinterpret_cast<std::size_t*>(raw) = bytes;
+      header = reinterpret_cast<Header*>(raw + sizeof(Header));
+      cache->reserved.fetch_add(bytes, std::memory_order_relaxed);
+    } else {
+      header = cache->pop(cls);
+      bytes = block_size(cls);
+    }
+    header->cache = cache;
+    header->cls = cls;
+    cache->count_allocated(bytes);
+    return header + 1;
+  }
+
+  static void Deallocate(void* ptr) noexcept {
+    if (ptr == nullptr) {
+      return;
+    }
+    Header* header = static_cast<Header*>(ptr) - 1;
+    Cache* owner = header->cache;
+    if (header->cls == SLAB_CLASSES) {
+      char* raw = reinterpret_cast<char*>(header) - sizeof(Header);
+      std::size_t bytes = *reinterpret_cast<std::size_t*>(raw);
+      owner->reserved.fetch_sub(bytes, std::memory_order_relaxed);
+      owner->remote_freed.fetch_add(bytes, std::memory_order_relaxed);
+      std::free(raw);
+    } else if (owner == local_cache(false)) {
+      owner->push(header);
+      owner->freed.store(owner->freed.load(std::memory_order_relaxed) + block_size(header->cls),
+                         std::memory_order_relaxed);
+    } else {
+      owner->push_remote(header);
+    }
+  }
+
+  // Summed over the caches. Blocks freed by another thread count as live
+  // until their owner collects them, and the peak is the sum of the peaks
+  // of the caches, an upper bound of the peak of the total.
+  static SlabStats Stats() {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    SlabStats stats;
+    for (Cache* cache : registry.caches) {
+      stats.live_bytes += cache->live();
+      stats.peak_bytes += cache->peak.load(std::memory_order_relaxed);
+      stats.reserved_bytes += cache->reserved.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+ private:
+  struct Cache;
+
+  // 16 bytes, so blocks stay aligned like malloc's.
+  struct Header {
+    Cache* cache;
+    std::size_t cls;          // SLAB_CLASSES for a big block
+  };
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Free lists link through the first bytes after the header, so a block
+  // keeps its owner and class while it is free.
+  static FreeBlock* link_of(Header* header) {
+    return reinterpret_cast<FreeBlock*>(header + 1);
+  }
+
+  static Header* header_of(FreeBlock* block) {
+    return reinterpret_cast<Header*>(block) - 1;
+  }
+
+  // Only the owning thread touches the free lists and the chunk, and
+  // writes 'allocated' and 'freed'.
+  struct Cache {
+    Header* pop(std::size_t cls) {
+      if (free[cls] == nullptr) {
+        collect();
+      }
+      if (free[cls] == nullptr) {
+        return carve(cls);
+      }
+      Header* header = header_of(free[cls]);
+      free[cls] = free[cls]->next;
+      return header;
+    }
+
+    void push(Header* header) {
+      link_of(header)->next = free[header->cls];
+      free[header->cls] = link_of(header);
+    }
+
+    void push_remote(Header* header) {
+      FreeBlock* block = link_of(header);
+      block->next = remote.load(std::memory_order_relaxed);
+      while (!remote.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+      }
+    }
+
+    // Takes back the blocks other threads freed.
+    void collect() {
+      if (remote.load(std::memory_order_relaxed) == nullptr) {
+        return;
+      }
+      FreeBlock* block = remote.exchange(nullptr, std::memory_order_acquire);
+      std::size_t bytes = 0;
+      while (block != nullptr) {
+        FreeBlock* next = block->next;
+        Header* header = header_of(block);
+        bytes += block_size(header->cls);
+        push(header);
+        block = next;
+      }
+      freed.store(freed.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    }
+
+    Header* carve(std::size_t cls) {
+      std::size_t size = block_size(cls);
+      if ((std::size_t)(end - next) < size) {
+        next = static_cast<char*>(std::malloc(SLAB_CHUNK_SIZE));
+        if (next == nullptr) {
+          throw std::bad_alloc();
+        }
+        end = next + SLAB_CHUNK_SIZE;
+        reserved.fetch_add(SLAB_CHUNK_SIZE, std::memory_order_relaxed);
+      }
+      Header* header = reinterpret_cast<Header*>(next);
+      next += size;
+      return header;
+    }
+
+    void count_allocated(std::size_t bytes) {
+      allocated.store(allocated.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+      std::size_t now = live();
+      if (now > peak.load(std::memory_order_relaxed)) {
+        peak.store(now, std::memory_order_relaxed);
+      }
+    }
+
+    std::size_t live() const {
+      std::size_t out = freed.load(std::memory_order_relaxed) + remote_freed.load(std::memory_order_relaxed);
+      std::size_t in = allocated.load(std::memory_order_relaxed);
+      return in > out ? in - out : 0;
+    }
+
+    FreeBlock* free[SLAB_CLASSES] = {};
+    std::atomic<FreeBlock*> remote{nullptr};
+    char* next = nullptr;                 // the rest of the last chunk
+    char* end = nullptr;
+    std::atomic<std::size_t> allocated{0};
+    std::atomic<std::size_t> freed{0};
+    std::atomic<std::size_t> remote_freed{0};   // big blocks, by any thread
+    std::atomic<std::size_t> peak{0};
+    std::atomic<std::size_t> reserved{0};
+  };
+
+  // Never destroyed: detached threads may still free blocks at exit.
+  struct Registry {
+    static Registry& Get() {
+      static Registry* registry = new Registry();
+      return *registry;
+    }
+    std::mutex mtx;
+    std::vector<Cache*> caches;
+    std::vector<Cache*> orphans;
+  };
+
+  // Hands the cache over to the next new thread when the thread exits.
+  struct Owner {
+    ~Owner() {
+      if (cache != nullptr) {
+        Registry& registry = Registry::Get();
+        std::lock_guard<std::mutex> lock(registry.mtx);
+        registry.orphans.push_back(cache);
+        cache = nullptr;
+      }
+    }
+    Cache* cache = nullptr;
+  };
+
+  static Cache* local_cache(bool create) {
+    static thread_local Owner owner;
+    if (owner.cache == nullptr && create) {
+      Registry& registry = Registry::Get();
+      std::lock_guard<std::mutex> lock(registry.mtx);
+      if (!registry.orphans.empty()) {
+        owner.cache = registry.orphans.back();
+        registry.orphans.pop_back();
+      } else {
+        owner.cache = new Cache();
+        registry.caches.push_back(owner.cache);
+      }
+    }
+    return owner.cache;
+  }
+
+  static std::size_t block_size(std::size_t cls) {
+    return SLAB_MIN_BLOCK << cls;
+  }
+
+  // SLAB_CLASSES if too big for a block.
+  static std::size_t class_of(std::size_t bytes) {
+    std::size_t cls = 0;
+    while (cls < SLAB_CLASSES && block_size(cls) < bytes) {
+      cls ++;
+    }
+    return cls;
+  }
+};
+
+// A standard allocator drawing from the Slab.
+template <typename T>
+class SlabAllocator {
+ public:
+  using value_type = T;
+
+  SlabAllocator() noexcept { }
+
+  template <typename U>
+  SlabAllocator(const SlabAllocator<U>&) noexcept { }
+
+  T* allocate(std::size_t num) {
+    static_assert(alignof(T) <= 16, "over-aligned types are not supported");
+    return static_cast<T*>(Slab::Allocate(num * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, std::size_t) noexcept {
+    Slab::Deallocate(ptr);
+  }
+
+  template <typename U>
+  bool operator==(const SlabAllocator<U>&) const noexcept {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const SlabAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
+}  // namespace base
+}  // namespace cos
+
+#endif  // BASE_SLAB_H_
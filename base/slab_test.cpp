@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "slab.h"
+#include "thread_safe_queue.h"
+
+using cos::base::Slab;
+using cos::base::SlabAllocator;
+using cos::base::SlabStats;
+using cos::base::ThreadSafeQueue;
+
+TEST(Slab, reuses_freed_blocks) {
+  void* first = Slab::Allocate(100);
+  Slab::Deallocate(first);
+  void* second = Slab::Allocate(100);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ((std::uintptr_t)second % alignof(std::max_align_t), 0);
+  Slab::Deallocate(second);
+}
+
+TEST(Slab, counts_live_and_peak_bytes) {
+  // Runs on its own thread, so only its cache changes meanwhile.
+  std::thread([] {
+    SlabStats before = Slab::Stats();
+    std::vector<void*> blocks;
+    for (int i = 0; i < 10; i ++) {
+      blocks.push_back(Slab::Allocate(48));     // 64 bytes with the header
+    }
+    SlabStats during = Slab::Stats();
+    EXPECT_EQ(during.live_bytes - before.live_bytes, 640);
+    EXPECT_GE(during.peak_bytes, during.live_bytes);
+    EXPECT_GE(during.reserved_bytes, during.live_bytes);
+    for (void* block : blocks) {
+      Slab::Deallocate(block);
+    }
+    SlabStats after = Slab::Stats();
+    EXPECT_EQ(after.live_bytes, before.live_bytes);
+    EXPECT_EQ(after.peak_bytes, during.peak_bytes);
+  }).join();
+}
+
+TEST(Slab, remote_frees_return_to_owner) {
+  std::vector<void*> blocks;
+  for (int i = 0; i < 100; i ++) {
+    blocks.push_back(Slab::Allocate(200));
+  }
+  std::thread([&blocks] {
+    for (void* block : blocks) {
+      Slab::Deallocate(block);
+    }
+  }).join();
+
+  // The owner takes them back once its free list runs dry.
+  std::size_t reserved = Slab::Stats().reserved_bytes;
+  std::vector<void*> again;
+  for (int i = 0; i < 100; i ++) {
+    again.push_back(Slab::Allocate(200));
+  }
+  EXPECT_EQ(Slab::Stats().reserved_bytes, reserved);
+  std::sort(blocks.begin(), blocks.end());
+  std::sort(again.begin(), again.end());
+  EXPECT_EQ(blocks, again);
+  for (void* block : again) {
+    Slab::Deallocate(block);
+  }
+}
+
+TEST(Slab, big_blocks) {
+  SlabStats before = Slab::Stats();
+  char* big = static_cast<char*>(Slab::Allocate(1 << 20));
+  big[(1 << 20) - 1] = 1;
+  EXPECT_GE(Slab::Stats().live_bytes - before.live_bytes, 1 << 20);
+  std::thread([big] { Slab::Deallocate(big); }).join();
+  EXPECT_EQ(Slab::Stats().live_bytes, before.live_bytes);
+}
+
+TEST(Slab, adopts_caches_of_exited_threads) {
+  void* kept = nullptr;
+  std::thread([&kept] { kept = Slab::Allocate(64); }).join();
+  Slab::Deallocate(kept);
+  std::size_t reserved = Slab::Stats().reserved_bytes;
+  for (int i = 0; i < 4; i ++) {
+    std::thread([] { Slab::Deallocate(Slab::Allocate(64)); }).join();
+  }
+  EXPECT_EQ(Slab::Stats().reserved_bytes, reserved);
+}
+
+TEST(Slab, allocator) {
+  std::deque<int, SlabAllocator<int>> deque;
+  for (int i = 0; i < 10000; i ++) {
+    deque.push_back(i);
+  }
+  EXPECT_EQ(deque[9999], 9999);
+
+  ThreadSafeQueue<int, SlabAllocator<int>> que;
+  std::thread producer([&que] {
+    for (int i = 0; i < 10000; i ++) {
+      que.push_back(i);
+    }
+  });
+  int expected = 0, value = 0;
+  while (expected < 10000) {
+    if (que.try_pop(value)) {
+      EXPECT_EQ(value, expected ++);
+    }
+  }
+  producer.join();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
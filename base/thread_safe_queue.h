@@ -1,17 +1,22 @@
 /*
- * A simple thread safe queue
+ * A simple thread safe queue. 'Alloc' allocates the blocks of the
+ * underlying std::deque, e.g. a SlabAllocator. Its mutex is profiled
+ * with COS_PROFILE_LOCKS, see profiled_mutex.h.
  */
 
 #ifndef BASE_THREAD_SAFE_QUEUE_
 #define BASE_THREAD_SAFE_QUEUE_
 
 #include <deque>
+#include <memory>
 #include <mutex>
 
+#include "base/profiled_mutex.h"
+
 namespace cos {
 namespace base {
 
-template<typename T>
+template<typename T, typename Alloc = std::allocator<T>>
 class ThreadSafeQueue {
  public:
   ThreadSafeQueue() {}
@@ -20,27 +25,41 @@ class ThreadSafeQueue {
   ~ThreadSafeQueue() { }
 
   void push_front(const T& element) {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     queue_.emplace_front(element);
   }
 
   void push_front(T&& element) {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     queue_.emplace_front(std::move(element));
   }
 
   void push_back(const T& element) {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     queue_.emplace_back(element);
   }
 
   void push_back(T&& element) {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     queue_.emplace_back(std::move(element));
   }
 
+  // Inserts [first, last) in order in front of the queue under one lock.
+  template <typename It>
+  void push_front_bulk(It first, It last) {
+    std::lock_guard<Mutex> lock(mtx_);
+    queue_.insert(queue_.begin(), first, last);
+  }
+
+  // Appends [first, last) under one lock.
+  template <typename It>
+  void push_back_bulk(It first, It last) {
+    std::lock_guard<Mutex> lock(mtx_);
+    queue_.insert(queue_.end(), first, last);
+  }
+
   bool try_pop(T& element) {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     if (queue_.empty()) {
       return false;
     }
@@ -49,20 +68,20 @@ class ThreadSafeQueue {
     return true;
   }
 
-  using size_type = typename std::deque<T>::size_type;
+  using size_type = typename std::deque<T, Alloc>::size_type;
   size_type size() {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     return queue_.size();
   }
 
   bool empty() {
-    std::lock_guard<std::mutex> lock(mtx_);
+    std::lock_guard<Mutex> lock(mtx_);
     return queue_.empty();
   }
   
  private:
-  std::deque<T> queue_;
-  std::mutex mtx_;
+  std::deque<T, Alloc> queue_;
+  Mutex mtx_;
 };
 
 
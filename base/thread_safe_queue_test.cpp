@@ -1,13 +1,62 @@
 
+#include <atomic>
 #include <thread>
+#include <vector>
 #include "gtest/gtest.h"
 #include "autothread.h"
+#include "ring_queue.h"
 #include "thread_safe_queue.h"
 
 using cos::base::AutoThread;
+using cos::base::RingBuffer;
+using cos::base::RingQueue;
 using cos::base::ThreadSafeQueue;
 using cos::base::join;
 
+// 'producers' threads push disjoint ranges of values while 'consumers'
+// threads pop concurrently; every value must come out exactly once.
+template <typename Queue>
+void ContentionStress(Queue& que, int producers, int consumers, int per_producer) {
+  const int total = producers * per_producer;
+  std::atomic<int> popped(0);
+  std::vector<std::atomic<int>> seen(total);
+  for (auto& each : seen) {
+    each.store(0);
+  }
+  {
+    std::vector<AutoThread<join>> threads;
+    for (int p = 0; p < producers; p ++) {
+      threads.emplace_back(std::thread([&que, p, per_producer] {
+        for (int i = p * per_producer; i < (p + 1) * per_producer; i ++) {
+          if (i % 3 == 0) {
+            que.push_front(i);
+          } else {
+            que.push_back(i);
+          }
+        }
+      }));
+    }
+    for (int c = 0; c < consumers; c ++) {
+      threads.emplace_back(std::thread([&que, &popped, &seen, total] {
+        int value = 0;
+        while (popped.load() < total) {
+          if (que.try_pop(value)) {
+            seen[value] ++;
+            popped ++;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+      }));
+    }
+  }
+  EXPECT_EQ(popped.load(), total);
+  EXPECT_TRUE(que.empty());
+  for (int i = 0; i < total; i ++) {
+    ASSERT_EQ(seen[i].load(), 1) << "value " << i;
+  }
+}
+
 TEST(ThreadSafeQueueTest, PushPop) {
   ThreadSafeQueue<int> que;
   int bound = 10000000;
@@ -40,6 +89,73 @@ TEST(ThreadSafeQueueTest, PushPop) {
   AutoThread<join> athrd3(std::move(thrd3));
 }
 
+TEST(ThreadSafeQueueTest, Contention) {
+  ThreadSafeQueue<int> que;
+  ContentionStress(que, 4, 4, 200000);
+}
+
+TEST(RingQueueTest, PushPop) {
+  RingBuffer<int> ring(5);
+  EXPECT_EQ(ring.capacity(), 8);
+  for (int i = 0; i < 8; i ++) {
+    EXPECT_TRUE(ring.try_push(i));
+  }
+  EXPECT_FALSE(ring.try_push(8));
+  EXPECT_EQ(ring.size(), 8);
+
+  int value = -1;
+  for (int i = 0; i < 8; i ++) {
+    EXPECT_TRUE(ring.try_pop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(ring.try_pop(value));
+  EXPECT_TRUE(ring.empty());
+
+  RingQueue<int> que(16, 4);
+  que.push_back(1);
+  que.push_back(2);
+  que.push_front(3);
+  EXPECT_EQ(que.size(), 3);
+  EXPECT_TRUE(que.try_pop(value));
+  EXPECT_EQ(value, 3);
+  EXPECT_TRUE(que.try_pop(value));
+  EXPECT_EQ(value, 1);
+}
+
+TEST(RingQueueTest, Bulk) {
+  std::vector<int> values = {1, 2, 3, 4, 5, 6};
+  RingBuffer<int> ring(8);
+  EXPECT_TRUE(ring.try_push_bulk(values.begin(), 6));
+  EXPECT_FALSE(ring.try_push_bulk(values.begin(), 3));   // only 2 free cells
+  EXPECT_EQ(ring.size(), 6);
+  int value = 0;
+  for (int i = 1; i <= 6; i ++) {
+    EXPECT_TRUE(ring.try_pop(value));
+    EXPECT_EQ(value, i);
+  }
+
+  ThreadSafeQueue<int> que;
+  que.push_back(0);
+  que.push_back_bulk(values.begin(), values.begin() + 2);
+  que.push_front_bulk(values.begin() + 2, values.end());
+  std::vector<int> order;
+  while (que.try_pop(value)) {
+    order.push_back(value);
+  }
+  EXPECT_EQ(order, std::vector<int>({3, 4, 5, 6, 0, 1, 2}));
+}
+
+TEST(RingQueueTest, Contention) {
+  // A small ring keeps producers bumping into the full condition.
+  RingQueue<int> que(64, 16);
+  ContentionStress(que, 4, 4, 200000);
+}
+
+TEST(RingQueueTest, ManyProducersOneConsumer) {
+  RingQueue<int> que(1024);
+  ContentionStress(que, 8, 1, 50000);
+}
+
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
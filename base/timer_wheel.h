@@ -0,0 +1,266 @@
+/*
+ * A hierarchical timer wheel: four levels of 256 slots, each slot of a
+ * level spanning a whole turn of the level below. Timers are kept in
+ * intrusive lists over a node array, so adding and cancelling are O(1)
+ * whatever the number of pending timers. Far timers move down a level
+ * when their slot comes up. Not thread safe.
+ */
+
+#ifndef BASE_TIMER_WHEEL_H_
+#define BASE_TIMER_WHEEL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t TIMER_WHEEL_BITS = 8;
+constexpr std::size_t TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_BITS;
+constexpr std::size_t TIMER_WHEEL_LEVELS = 4;
+
+// Ticks are whatever unit the owner advances the wheel by. Ids carry a
+// generation, so cancelling a fired timer is harmless.
+template <typename T>
+class TimerWheel {
+ public:
+  using Id = std::uint64_t;
+
+  explicit TimerWheel(std::uint64_t now = 0) : current_(now) {
+    for (std::size_t i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i ++) {
+      heads_[i] = NIL;
+    }
+  }
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Due at tick 'expire', then every 'period' ticks if not 0. A past tick
+  // is due at the next Advance().
+  Id Add(std::uint64_t expire, T value, std::uint64_t period = 0) {
+    std::uint32_t index;
+    if (free_ != NIL) {
+      index = free_;
+      free_ = nodes_[index].next;
+      nodes_[index].value = std::move(value);
+    } else {
+      index = (std::uint32_t)nodes_.size();
+      nodes_.emplace_back(std::move(value));
+    }
+    Node& node = nodes_[index];
+    node.expire = expire;
+    node.period = period;
+    node.live = true;
+    link(index);
+    size_ ++;
+    return ((Id)node.generation << 32) | index;
+  }
+
+  // False if the timer already fired (and is not periodic) or is unknown.
+  bool Cancel(Id id) {
+    std::uint32_t index = (std::uint32_t)id;
+    if (index >= nodes_.size()) {
+      return false;
+    }
+    Node& node = nodes_[index];
+    if (!node.live || node.generation != (std::uint32_t)(id >> 32)) {
+      return false;
+    }
+    unlink(index);
+    release(index);
+    return true;
+  }
+
+  // Calls 'fire(value)' for every timer due up to tick 'now', in tick
+  // order. Periodic timers are re-armed for their first tick after 'now',
+  // skipping missed periods. 'fire' must not touch the wheel.
+  template <typename F>
+  void Advance(std::uint64_t now, F&& fire) {
+    if (size_ == 0) {
+      current_ = std::max(current_, now + 1);
+      return;
+    }
+    while (current_ <= now) {
+      if (!skip_idle_levels(now)) {
+        break;
+      }
+      if ((current_ & (TIMER_WHEEL_SLOTS - 1)) == 0) {
+        cascade();
+      }
+      std::size_t slot = current_ & (TIMER_WHEEL_SLOTS - 1);
+      std::uint32_t index = heads_[slot];
+      heads_[slot] = NIL;
+      while (index != NIL) {
+        Node& node = nodes_[index];
+        std::uint32_t next = node.next;
+        counts_[0] --;
+        fire(node.value);
+        if (node.period > 0) {
+          node.expire += node.period * (1 + (now - node.expire) / node.period);
+          link(index);
+        } else {
+          release(index);
+        }
+        index = next;
+      }
+      current_ ++;
+      // Skip empty slots up to the next cascade.
+      while (current_ <= now && (current_ & (TIMER_WHEEL_SLOTS - 1)) != 0 &&
+             heads_[current_ & (TIMER_WHEEL_SLOTS - 1)] == NIL) {
+        current_ ++;
+      }
+    }
+  }
+
+  // A tick at or before the next due timer, to sleep until: the next busy
+  // slot of the first level, or the next turn of the first busy level.
+  // UINT64_MAX if empty.
+  std::uint64_t NextTick() const {
+    if (size_ == 0) {
+      return UINT64_MAX;
+    }
+    if (counts_[0] == 0) {
+      std::size_t level = 1;
+      while (level + 1 < TIMER_WHEEL_LEVELS && counts_[level] == 0) {
+        level ++;
+      }
+      std::uint64_t span = 1ULL << (TIMER_WHEEL_BITS * level);
+      return (current_ + span - 1) & ~(span - 1);
+    }
+    std::uint64_t tick = current_;
+    do {
+      if (heads_[tick & (TIMER_WHEEL_SLOTS - 1)] != NIL) {
+        return tick;
+      }
+      tick ++;
+    } while ((tick & (TIMER_WHEEL_SLOTS - 1)) != 0);
+    return tick;
+  }
+
+  // The next tick Advance() will look at.
+  std::uint64_t Now() const {
+    return current_;
+  }
+
+  std::size_t Size() const {
+    return size_;
+  }
+
+ private:
+  static constexpr std::uint32_t NIL = UINT32_MAX;
+
+  struct Node {
+    explicit Node(T&& v) : value(std::move(v)) { }
+    T value;
+    std::uint64_t expire = 0;
+    std::uint64_t period = 0;
+    std::uint32_t prev = NIL;
+    std::uint32_t next = NIL;      // also links the free list
+    std::uint32_t slot = 0;
+    std::uint32_t generation = 0;
+    bool live = false;
+  };
+
+  // With the lower levels empty nothing is due before the next turn of
+  // the first busy one, so jump there. False if that is after 'now'.
+  bool skip_idle_levels(std::uint64_t now) {
+    std::size_t level = 0;
+    while (level + 1 < TIMER_WHEEL_LEVELS && counts_[level] == 0) {
+      level ++;
+    }
+    if (level == 0) {
+      return true;
+    }
+    std::uint64_t span = 1ULL << (TIMER_WHEEL_BITS * level);
+    std::uint64_t turn = (current_ + span - 1) & ~(span - 1);
+    if (turn > now) {
+      current_ = now + 1;
+      return false;
+    }
+    current_ = turn;
+    return true;
+  }
+
+  // Picks the level by the distance to the expiry; beyond the last level
+  // the timer waits in its farthest slot and is placed again from there.
+  void link(std::uint32_t index) {
+    Node& node = nodes_[index];
+    std::uint64_t expire = std::max(node.expire, current_);
+    std::uint64_t delta = expire - current_;
+    std::size_t level = 0;
+    while (level + 1 < TIMER_WHEEL_LEVELS && delta >> (TIMER_WHEEL_BITS * (level + 1)) != 0) {
+      level ++;
+    }
+    std::size_t shift = TIMER_WHEEL_BITS * level;
+    if (delta >> (shift + TIMER_WHEEL_BITS) != 0) {
+      expire = current_ + (1ULL << (shift + TIMER_WHEEL_BITS)) - 1;
+    }
+    std::uint32_t slot = (std::uint32_t)(level * TIMER_WHEEL_SLOTS +
+                                         ((expire >> shift) & (TIMER_WHEEL_SLOTS - 1)));
+    node.slot = slot;
+    counts_[level] ++;
+    node.prev = NIL;
+    node.next = heads_[slot];
+    if (node.next != NIL) {
+      nodes_[node.next].prev = index;
+    }
+    heads_[slot] = index;
+  }
+
+  void unlink(std::uint32_t index) {
+    Node& node = nodes_[index];
+    counts_[node.slot / TIMER_WHEEL_SLOTS] --;
+    if (node.prev != NIL) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.slot] = node.next;
+    }
+    if (node.next != NIL) {
+      nodes_[node.next].prev = node.prev;
+    }
+  }
+
+  void release(std::uint32_t index) {
+    Node& node = nodes_[index];
+    node.value = T();
+    node.live = false;
+    node.generation ++;
+    node.next = free_;
+    free_ = index;
+    size_ --;
+  }
+
+  // At each turn of a level, moves the timers of the next slot of the
+  // level above down, and so on while that level turns too.
+  void cascade() {
+    for (std::size_t level = 1; level < TIMER_WHEEL_LEVELS; level ++) {
+      std::size_t shift = TIMER_WHEEL_BITS * level;
+      std::size_t slot = level * TIMER_WHEEL_SLOTS + ((current_ >> shift) & (TIMER_WHEEL_SLOTS - 1));
+      std::uint32_t index = heads_[slot];
+      heads_[slot] = NIL;
+      while (index != NIL) {
+        std::uint32_t next = nodes_[index].next;
+        counts_[level] --;
+        link(index);
+        index = next;
+      }
+      if (((current_ >> shift) & (TIMER_WHEEL_SLOTS - 1)) != 0) {
+        break;
+      }
+    }
+  }
+
+  std::vector<Node> nodes_;
+  std::uint32_t heads_[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+  std::size_t counts_[TIMER_WHEEL_LEVELS] = {};     // timers per level
+  std::uint32_t free_ = NIL;
+  std::size_t size_ = 0;
+  std::uint64_t current_;
+};
+
+}  // namespace base
+}  // namespace cos
+
+#endif  // BASE_TIMER_WHEEL_H_
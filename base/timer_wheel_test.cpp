@@ -0,0 +1,113 @@
+#include <cstdint>
+#include <vector>
+#include "gtest/gtest.h"
+#include "timer_wheel.h"
+
+using cos::base::TimerWheel;
+
+// Deterministic xorshift, the same sequence on every run.
+static std::uint64_t Next(std::uint64_t& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+TEST(TimerWheelTest, FiresInTime) {
+  TimerWheel<std::uint64_t> wheel;
+  std::uint64_t state = 88172645463325252ULL;
+  std::vector<std::uint64_t> expires;
+  for (int i = 0; i < 20000; i ++) {
+    expires.push_back(Next(state) % (1 << 20));
+  }
+  expires.push_back((1ULL << 25) + 3);      // beyond the second level
+  expires.push_back((1ULL << 33) + 7);      // beyond the last one
+  for (std::uint64_t expire : expires) {
+    wheel.Add(expire, expire);
+  }
+
+  std::uint64_t now = 0;
+  std::size_t fired = 0;
+  auto advance = [&](std::uint64_t to) {
+    now = to;
+    wheel.Advance(now, [&](std::uint64_t& expire) {
+      EXPECT_LE(expire, now);
+      fired ++;
+    });
+    std::size_t due = 0;
+    for (std::uint64_t expire : expires) {
+      due += expire <= now ? 1 : 0;
+    }
+    EXPECT_EQ(fired, due);
+  };
+  while (now < (1 << 20)) {
+    advance(now + 1 + Next(state) % 1000);
+  }
+  advance((1ULL << 25) + 2);
+  advance((1ULL << 25) + 3);
+  advance((1ULL << 33) + 6);
+  EXPECT_EQ(wheel.Size(), 1);
+  advance((1ULL << 33) + 7);
+  EXPECT_EQ(wheel.Size(), 0);
+}
+
+TEST(TimerWheelTest, Cancel) {
+  TimerWheel<int> wheel;
+  std::vector<TimerWheel<int>::Id> ids;
+  for (int i = 0; i < 1000; i ++) {
+    ids.push_back(wheel.Add(i * 100, i));
+  }
+  for (int i = 0; i < 1000; i += 2) {
+    EXPECT_TRUE(wheel.Cancel(ids[i]));
+    EXPECT_FALSE(wheel.Cancel(ids[i]));
+  }
+  EXPECT_EQ(wheel.Size(), 500);
+  int fired = 0;
+  wheel.Advance(100000, [&fired](int& i) {
+    EXPECT_EQ(i % 2, 1);
+    fired ++;
+  });
+  EXPECT_EQ(fired, 500);
+  EXPECT_FALSE(wheel.Cancel(ids[1]));
+
+  // A recycled node does not answer to the old id.
+  TimerWheel<int>::Id id = wheel.Add(200000, 0);
+  EXPECT_FALSE(wheel.Cancel(ids[0]));
+  EXPECT_TRUE(wheel.Cancel(id));
+}
+
+TEST(TimerWheelTest, Periodic) {
+  TimerWheel<int> wheel;
+  std::vector<std::uint64_t> ticks;
+  std::uint64_t now = 0;
+  auto id = wheel.Add(5, 0, 10);
+  for (now = 0; now < 100; now ++) {
+    wheel.Advance(now, [&](int&) { ticks.push_back(now); });
+  }
+  EXPECT_EQ(ticks, std::vector<std::uint64_t>({5, 15, 25, 35, 45, 55, 65, 75, 85, 95}));
+
+  // Missed periods are skipped.
+  ticks.clear();
+  now = 1000;
+  wheel.Advance(now, [&](int&) { ticks.push_back(now); });
+  EXPECT_EQ(ticks.size(), 1);
+  EXPECT_EQ(wheel.NextTick(), 1005);
+  EXPECT_TRUE(wheel.Cancel(id));
+  EXPECT_EQ(wheel.NextTick(), UINT64_MAX);
+}
+
+TEST(TimerWheelTest, NextTick) {
+  TimerWheel<int> wheel(1000);
+  EXPECT_EQ(wheel.NextTick(), UINT64_MAX);
+  wheel.Add(1010, 0);
+  EXPECT_EQ(wheel.NextTick(), 1010);
+  wheel.Add(5000, 0);
+  wheel.Advance(1010, [](int&) { });
+  EXPECT_EQ(wheel.NextTick(), 1024);      // next turn of the first level
+  EXPECT_EQ(wheel.Now(), 1011);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,216 @@
+/*
+ * A move-only replacement for std::function<void()>. Callables up to
+ * TASK_INLINE_SIZE bytes are stored inline, larger ones on the heap, or
+ * with the allocator given along with them.
+ */
+
+#ifndef BASE_UNIQUE_TASK_H_
+#define BASE_UNIQUE_TASK_H_
+
+#include <assert.h>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t TASK_INLINE_SIZE = 64;
+
+class UniqueTask {
+ public:
+  UniqueTask() noexcept { }
+  UniqueTask(std::nullptr_t) noexcept { }
+
+  template <typename F, typename Fn = typename std::decay<F>::type,
+            typename = typename std::enable_if<!std::is_same<Fn, UniqueTask>::value>::type>
+  UniqueTask(F&& func) {
+    construct<Fn>(std::forward<F>(func), std::integral_constant<bool, is_inline<Fn>()>());
+  }
+
+  // Stores a callable too big to be inline with a copy of 'alloc'.
+  template <typename Alloc, typename F, typename Fn = typename std::decay<F>::type,
+            typename = typename std::enable_if<!std::is_same<Fn, UniqueTask>::value>::type>
+  UniqueTask(std::allocator_arg_t, const Alloc& alloc, F&& func) {
+    construct<Fn>(std::forward<F>(func), std::integral_constant<bool, is_inline<Fn>()>(), alloc);
+  }
+
+  UniqueTask(const UniqueTask&) = delete;
+  UniqueTask& operator=(const UniqueTask&) = delete;
+
+  UniqueTask(UniqueTask&& other) noexcept {
+    move_from(other);
+  }
+
+  UniqueTask& operator=(UniqueTask&& other) noexcept {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  UniqueTask& operator=(std::nullptr_t) noexcept {
+    reset();
+    return *this;
+  }
+
+  ~UniqueTask() {
+    reset();
+  }
+
+  void operator()() {
+    assert(ops_ != nullptr);
+    ops_->invoke(&storage_);
+  }
+
+  explicit operator bool() const noexcept {
+    return ops_ != nullptr;
+  }
+
+  // True if a callable of type F is stored without touching the heap.
+  template <typename F>
+  static constexpr bool is_inline() {
+    return sizeof(F) <= TASK_INLINE_SIZE &&
+           alignof(F) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible<F>::value;
+  }
+
+ private:
+  using Storage = typename std::aligned_storage<TASK_INLINE_SIZE, alignof(std::max_align_t)>::type;
+
+  struct Ops {
+    void (*invoke)(void*);
+    void (*relocate)(void* dst, void* src);  // move to dst and destroy src
+    void (*destroy)(void*);
+  };
+
+  template <typename Fn>
+  struct InlineOps {
+    static void invoke(void* storage) {
+      (*static_cast<Fn*>(storage))();
+    }
+    static void relocate(void* dst, void* src) noexcept {
+      new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+      static_cast<Fn*>(src)->~Fn();
+    }
+    static void destroy(void* storage) noexcept {
+      static_cast<Fn*>(storage)->~Fn();
+    }
+    static const Ops* get() {
+      static const Ops ops = {&invoke, &relocate, &destroy};
+      return &ops;
+    }
+  };
+
+  template <typename Fn>
+  struct HeapOps {
+    static Fn*& ptr(void* storage) {
+      return *static_cast<Fn**>(storage);
+    }
+    static void invoke(void* storage) {
+      (*ptr(storage))();
+    }
+    static void relocate(void* dst, void* src) noexcept {
+      *static_cast<Fn**>(dst) = ptr(src);
+    }
+    static void destroy(void* storage) noexcept {
+      delete ptr(storage);
+    }
+    static const Ops* get() {
+      static const Ops ops = {&invoke, &relocate, &destroy};
+      return &ops;
+    }
+  };
+
+  // The callable and the allocator it came from. An empty allocator takes
+  // no room.
+  template <typename Fn, typename Alloc>
+  struct Boxed : Alloc {
+    template <typename F>
+    Boxed(const Alloc& alloc, F&& f) : Alloc(alloc), func(std::forward<F>(f)) { }
+    Fn func;
+  };
+
+  template <typename Fn, typename Alloc>
+  struct AllocOps {
+    using Box = Boxed<Fn, typename std::allocator_traits<Alloc>::template rebind_alloc<char>>;
+    using BoxAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Box>;
+    static Box*& ptr(void* storage) {
+      return *static_cast<Box**>(storage);
+    }
+    static void invoke(void* storage) {
+      ptr(storage)->func();
+    }
+    static void relocate(void* dst, void* src) noexcept {
+      *static_cast<Box**>(dst) = ptr(src);
+    }
+    static void destroy(void* storage) noexcept {
+      Box* box = ptr(storage);
+      BoxAlloc alloc(*box);
+      box->~Box();
+      std::allocator_traits<BoxAlloc>::deallocate(alloc, box, 1);
+    }
+    static const Ops* get() {
+      static const Ops ops = {&invoke, &relocate, &destroy};
+      return &ops;
+    }
+  };
+
+  template <typename Fn, typename F>
+  void construct(F&& func, std::true_type /* inline */) {
+    new (&storage_) Fn(std::forward<F>(func));
+    ops_ = InlineOps<Fn>::get();
+  }
+
+  template <typename Fn, typename F, typename Alloc>
+  void construct(F&& func, std::true_type /* inline */, const Alloc&) {
+    construct<Fn>(std::forward<F>(func), std::true_type());
+  }
+
+  template <typename Fn, typename F, typename Alloc>
+  void construct(F&& func, std::false_type /* inline */, const Alloc& alloc) {
+    using Op = AllocOps<Fn, Alloc>;
+    typename Op::BoxAlloc box_alloc(alloc);
+    typename Op::Box* box = std::allocator_traits<typename Op::BoxAlloc>::allocate(box_alloc, 1);
+    try {
+      new (box) typename Op::Box(box_alloc, std::forward<F>(func));
+    } catch (...) {
+      std::allocator_traits<typename Op::BoxAlloc>::deallocate(box_alloc, box, 1);
+      throw;
+    }
+    *reinterpret_cast<typename Op::Box**>(&storage_) = box;
+    ops_ = Op::get();
+  }
+
+  template <typename Fn, typename F>
+  void construct(F&& func, std::false_type /* inline */) {
+    *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(func));
+    ops_ = HeapOps<Fn>::get();
+  }
+
+  void move_from(UniqueTask& other) noexcept {
+    if (other.ops_ != nullptr) {
+      other.ops_->relocate(&storage_, &other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void reset() noexcept {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  Storage storage_;
+  const Ops* ops_ = nullptr;
+};
+
+} // namespace base
+} // namespace cos
+
+#endif // BASE_UNIQUE_TASK_H_
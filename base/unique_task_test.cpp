@@ -0,0 +1,147 @@
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include "gtest/gtest.h"
+#include "unique_task.h"
+
+using cos::base::UniqueTask;
+
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size) {
+  allocations ++;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+struct Counted {
+  explicit Counted(int* alive) : alive_(alive) { ++ *alive_; }
+  Counted(Counted&& other) noexcept : alive_(other.alive_) { ++ *alive_; }
+  ~Counted() { -- *alive_; }
+  void operator()() { }
+  int* alive_;
+};
+
+TEST(UniqueTaskTest, InlineLambdaDoesNotAllocate) {
+  int x = 0, y = 0, z = 0;
+  std::size_t before = allocations.load();
+  UniqueTask task([&x, &y, &z] { x = 1; y = 2; z = 3; });
+  UniqueTask moved(std::move(task));
+  moved();
+  EXPECT_EQ(allocations.load(), before);
+  EXPECT_FALSE(task);
+  EXPECT_TRUE(moved);
+  EXPECT_EQ(x + y + z, 6);
+}
+
+TEST(UniqueTaskTest, LargeCallableGoesToHeap) {
+  struct Large {
+    char buffer[256];
+    int* out;
+    void operator()() { *out = buffer[0]; }
+  };
+  EXPECT_FALSE(UniqueTask::is_inline<Large>());
+
+  int out = 0;
+  Large large;
+  large.buffer[0] = 7;
+  large.out = &out;
+  std::size_t before = allocations.load();
+  UniqueTask task(large);
+  EXPECT_EQ(allocations.load(), before + 1);
+  UniqueTask moved;
+  moved = std::move(task);
+  EXPECT_EQ(allocations.load(), before + 1);
+  moved();
+  EXPECT_EQ(out, 7);
+}
+
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+  explicit CountingAllocator(int* n) : count(n) { }
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>& other) : count(other.count) { }
+  T* allocate(std::size_t n) {
+    ++ *count;
+    return static_cast<T*>(std::malloc(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, std::size_t) {
+    -- *count;
+    std::free(ptr);
+  }
+  int* count;
+};
+
+TEST(UniqueTaskTest, LargeCallableGoesToAllocator) {
+  struct Large {
+    char buffer[256];
+    int* out;
+    void operator()() { *out = buffer[0]; }
+  };
+  int out = 0, live = 0;
+  Large large;
+  large.buffer[0] = 7;
+  large.out = &out;
+  std::size_t before = allocations.load();
+  {
+    UniqueTask task(std::allocator_arg, CountingAllocator<char>(&live), large);
+    UniqueTask moved(std::move(task));
+    EXPECT_EQ(live, 1);
+    moved();
+    EXPECT_EQ(out, 7);
+
+    // Inline callables ignore the allocator.
+    UniqueTask small(std::allocator_arg, CountingAllocator<char>(&live), [&out] { out = 8; });
+    EXPECT_EQ(live, 1);
+  }
+  EXPECT_EQ(live, 0);
+  EXPECT_EQ(allocations.load(), before);
+}
+
+TEST(UniqueTaskTest, MoveOnlyCallable) {
+  struct Owner {
+    std::unique_ptr<int> value;
+    int* out;
+    void operator()() { *out = *value; }
+  };
+  int out = 0;
+  Owner owner{std::unique_ptr<int>(new int(42)), &out};
+  UniqueTask task(std::move(owner));
+  UniqueTask moved(std::move(task));
+  moved();
+  EXPECT_EQ(out, 42);
+}
+
+TEST(UniqueTaskTest, DestroysCallable) {
+  int alive = 0;
+  {
+    UniqueTask task{Counted(&alive)};
+    EXPECT_EQ(alive, 1);
+    UniqueTask moved(std::move(task));
+    EXPECT_EQ(alive, 1);
+    moved = nullptr;
+    EXPECT_EQ(alive, 0);
+    moved = UniqueTask(Counted(&alive));
+    EXPECT_EQ(alive, 1);
+  }
+  EXPECT_EQ(alive, 0);
+}
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
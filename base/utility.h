@@ -1,14 +1,32 @@
 #ifndef BASE_UTILITY_H_
 #define BASE_UTILITY_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
 namespace cos {
 namespace base {
 
 
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
 struct normal {};
 struct urgent {};
 struct sequence {};
 
+// Priority lane N of a branch with lanes, lane 0 first.
+template <std::size_t N>
+struct lane {
+  static constexpr std::size_t index = N;
+};
+
+template <typename T>
+struct is_lane : std::false_type {};
+
+template <std::size_t N>
+struct is_lane<lane<N>> : std::true_type {};
+
 #if __cplusplus >= 201703L
 template <typename F, typename... Args>
 using result_of_t = std::invoke_result_t<F, Args...>;
@@ -17,6 +35,39 @@ template <typename F, typename...Args>
 using result_of_t = typename std::result_of<F(Args...)>::type;
 #endif
 
+// std::index_sequence for C++11
+template <std::size_t... Is>
+struct index_sequence {};
+
+template <std::size_t N, std::size_t... Is>
+struct make_index_sequence : make_index_sequence<N - 1, N - 1, Is...> {};
+
+template <std::size_t... Is>
+struct make_index_sequence<0, Is...> {
+  using type = index_sequence<Is...>;
+};
+
+// Hint to the CPU that the caller is busy-waiting.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Cheap per-thread pseudo random numbers (xorshift), e.g. to pick victims.
+inline std::uint32_t fast_rand() {
+  static thread_local std::uint32_t state = 0;
+  if (state == 0) {
+    state = (std::uint32_t)(reinterpret_cast<std::uintptr_t>(&state) >> 4) | 1u;
+  }
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
 
 }  // namespace base
 }  // namespace cos
@@ -0,0 +1,145 @@
+/*
+ * A Chase-Lev work-stealing deque. The owner thread pushes and pops at
+ * the bottom without contention, any other thread steals from the top.
+ * T should be trivially copyable (typically a pointer).
+ */
+
+#ifndef BASE_WORK_STEALING_DEQUE_H_
+#define BASE_WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "base/utility.h"
+
+namespace cos {
+namespace base {
+
+constexpr std::size_t DEFAULT_DEQUE_CAPACITY = 64;
+
+template <typename T>
+class WorkStealingDeque {
+ public:
+  using size_type = std::size_t;
+
+  explicit WorkStealingDeque(size_type capacity = DEFAULT_DEQUE_CAPACITY) {
+    size_type cap = 2;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    arrays_.emplace_back(new Array(cap));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    top_.store(0, std::memory_order_relaxed);
+    bottom_.store(0, std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+  ~WorkStealingDeque() { }
+
+  // Owner only.
+  void push(T element) {
+    std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (b - t > (std::int64_t)array->capacity - 1) {
+      array = grow(array, b, t);
+    }
+    array->put(b, element);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only, LIFO.
+  bool pop(T& element) {
+    std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {                      // empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    element = array->get(b);
+    if (t == b) {                     // last element, race against thieves
+      bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Any thread, FIFO.
+  bool steal(T& element) {
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    Array* array = array_.load(std::memory_order_acquire);
+    T value = array->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return false;                   // lost the race, the caller may retry
+    }
+    element = value;
+    return true;
+  }
+
+  // Approximate under concurrent access.
+  size_type size() const {
+    std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? (size_type)(b - t) : 0;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+ private:
+  struct Array {
+    explicit Array(size_type cap)
+        : capacity(cap), mask(cap - 1), buffer(new std::atomic<T>[cap]) { }
+
+    T get(std::int64_t i) const {
+      return buffer[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(std::int64_t i, T element) {
+      buffer[i & mask].store(element, std::memory_order_relaxed);
+    }
+
+    const size_type capacity;
+    const size_type mask;
+    std::unique_ptr<std::atomic<T>[]> buffer;
+  };
+
+  // Thieves may still read the old array, so it is retired, not freed.
+  Array* grow(Array* array, std::int64_t b, std::int64_t t) {
+    Array* bigger = new Array(array->capacity * 2);
+    for (std::int64_t i = t; i < b; i ++) {
+      bigger->put(i, array->get(i));
+    }
+    arrays_.emplace_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  std::atomic<std::int64_t> top_;
+  char pad0_[CACHE_LINE_SIZE - sizeof(std::atomic<std::int64_t>)];
+  std::atomic<std::int64_t> bottom_;
+  char pad1_[CACHE_LINE_SIZE - sizeof(std::atomic<std::int64_t>)];
+  std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> arrays_;   // owner only
+};
+
+} // namespace base
+} // namespace cos
+
+#endif // BASE_WORK_STEALING_DEQUE_H_
@@ -0,0 +1,79 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "autothread.h"
+#include "work_stealing_deque.h"
+
+using cos::base::AutoThread;
+using cos::base::WorkStealingDeque;
+using cos::base::join;
+
+TEST(WorkStealingDequeTest, OwnerLifoThiefFifo) {
+  WorkStealingDeque<int> deque(2);
+  for (int i = 0; i < 100; i ++) {
+    deque.push(i);      // grows past the initial capacity
+  }
+  EXPECT_EQ(deque.size(), 100);
+
+  int value = -1;
+  EXPECT_TRUE(deque.pop(value));
+  EXPECT_EQ(value, 99);
+  EXPECT_TRUE(deque.steal(value));
+  EXPECT_EQ(value, 0);
+  while (deque.pop(value)) { }
+  EXPECT_TRUE(deque.empty());
+  EXPECT_FALSE(deque.steal(value));
+}
+
+TEST(WorkStealingDequeTest, ConcurrentSteal) {
+  WorkStealingDeque<int> deque;
+  const int total = 1000000;
+  std::vector<std::atomic<int>> seen(total);
+  for (auto& each : seen) {
+    each.store(0);
+  }
+  std::atomic<int> taken(0);
+  {
+    std::vector<AutoThread<join>> threads;
+    threads.emplace_back(std::thread([&] {
+      int value = 0;
+      for (int i = 0; i < total; i ++) {
+        deque.push(i);
+        if (i % 4 == 0 && deque.pop(value)) {
+          seen[value] ++;
+          taken ++;
+        }
+      }
+      while (taken.load() < total) {
+        if (deque.pop(value)) {
+          seen[value] ++;
+          taken ++;
+        }
+      }
+    }));
+    for (int i = 0; i < 3; i ++) {
+      threads.emplace_back(std::thread([&] {
+        int value = 0;
+        while (taken.load() < total) {
+          if (deque.steal(value)) {
+            seen[value] ++;
+            taken ++;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+      }));
+    }
+  }
+  EXPECT_EQ(taken.load(), total);
+  for (int i = 0; i < total; i ++) {
+    ASSERT_EQ(seen[i].load(), 1) << "value " << i;
+  }
+}
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
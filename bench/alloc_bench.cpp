@@ -0,0 +1,137 @@
+/*
+ * base::Slab against glibc malloc and the default allocator (operator
+ * new): blocks freed by the allocating thread, blocks handed to another
+ * thread to free as tasks are, and a WorkBranch queueing closures too big
+ * to be inline with LockedQueue and SlabQueue. Progress goes to stderr,
+ * results to stdout as JSON, or to the file given as argument.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/slab.h"
+#include "base/thread_safe_queue.h"
+#include "bench/bench.h"
+#include "workspace/workbranch.h"
+
+using cos::base::Slab;
+using cos::base::SlabStats;
+using cos::base::ThreadSafeQueue;
+using cos::bench::Reporter;
+using cos::bench::TimeNs;
+using cos::workspace::BasicWorkBranch;
+using cos::workspace::LockedQueue;
+using cos::workspace::SlabQueue;
+
+struct Malloc {
+  static void* Allocate(std::size_t size) { return std::malloc(size); }
+  static void Deallocate(void* ptr) { std::free(ptr); }
+};
+
+struct New {
+  static void* Allocate(std::size_t size) { return ::operator new(size); }
+  static void Deallocate(void* ptr) { ::operator delete(ptr); }
+};
+
+// Sizes of task nodes and closures, batches as deep as a busy queue.
+static const std::size_t SIZES[] = {48, 96, 200, 440};
+static const std::size_t BATCH = 256;
+
+template <typename A>
+static void SameThread(Reporter& rep, const char* alloc) {
+  const std::size_t rounds = 4000;
+  std::vector<void*> blocks(BATCH);
+  double ns = TimeNs([&] {
+    for (std::size_t r = 0; r < rounds; r ++) {
+      for (std::size_t i = 0; i < BATCH; i ++) {
+        blocks[i] = A::Allocate(SIZES[i % 4]);
+      }
+      for (std::size_t i = 0; i < BATCH; i ++) {
+        A::Deallocate(blocks[i]);
+      }
+    }
+  });
+  rep.Add("alloc_free", {{"alloc", alloc}, {"threads", "1"}}, ns / (rounds * BATCH), "ns/pair");
+}
+
+// One thread allocates, another frees, like a submitter and a worker.
+template <typename A>
+static void CrossThread(Reporter& rep, const char* alloc) {
+  const std::size_t rounds = 4000;
+  ThreadSafeQueue<std::vector<void*>> batches;
+  std::atomic<bool> done(false);
+  double ns = TimeNs([&] {
+    std::thread worker([&] {
+      std::vector<void*> batch;
+      while (true) {
+        if (batches.try_pop(batch)) {
+          for (void* block : batch) {
+            A::Deallocate(block);
+          }
+        } else if (done.load()) {
+          break;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+    for (std::size_t r = 0; r < rounds; r ++) {
+      std::vector<void*> batch(BATCH);
+      for (std::size_t i = 0; i < BATCH; i ++) {
+        batch[i] = A::Allocate(SIZES[i % 4]);
+      }
+      batches.push_back(std::move(batch));
+    }
+    done = true;
+    worker.join();
+  });
+  rep.Add("alloc_free", {{"alloc", alloc}, {"threads", "2"}}, ns / (rounds * BATCH), "ns/pair");
+}
+
+// Closures of 200 bytes, too big to be inline in a Task.
+template <typename Queue>
+static void BigClosures(Reporter& rep, const char* queue) {
+  const std::size_t num = 200000;
+  for (int workers : {1, 4}) {
+    BasicWorkBranch<Queue> branch(workers);
+    std::atomic<std::size_t> sum(0);
+    char payload[192] = {1};
+    double ns = TimeNs([&] {
+      for (std::size_t i = 0; i < num; i ++) {
+        branch.Submit([&sum, payload] { sum.fetch_add(payload[0], std::memory_order_relaxed); });
+      }
+      branch.WaitIdle();
+    });
+    rep.Add("big_closure_throughput", {{"queue", queue}, {"workers", std::to_string(workers)}},
+            num * 1e9 / ns, "tasks/s");
+  }
+}
+
+int main(int argc, char** argv) {
+  Reporter rep;
+  SameThread<Malloc>(rep, "malloc");
+  SameThread<New>(rep, "new");
+  SameThread<Slab>(rep, "slab");
+  CrossThread<Malloc>(rep, "malloc");
+  CrossThread<New>(rep, "new");
+  CrossThread<Slab>(rep, "slab");
+  BigClosures<LockedQueue>(rep, "locked");
+  BigClosures<SlabQueue>(rep, "slab");
+
+  SlabStats stats = Slab::Stats();
+  rep.Add("slab_bytes", {{"stat", "live"}}, (double)stats.live_bytes, "bytes");
+  rep.Add("slab_bytes", {{"stat", "peak"}}, (double)stats.peak_bytes, "bytes");
+  rep.Add("slab_bytes", {{"stat", "reserved"}}, (double)stats.reserved_bytes, "bytes");
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    rep.Print(out);
+  } else {
+    rep.Print(std::cout);
+  }
+  return 0;
+}
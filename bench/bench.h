@@ -0,0 +1,80 @@
+/*
+ * Helpers shared by the benchmarks: timing, percentiles and a JSON
+ * reporter whose output can be diffed between versions.
+ */
+
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cos {
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+inline std::uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch()).count();
+}
+
+template <typename F>
+double TimeNs(F f) {
+  std::uint64_t begin = NowNs();
+  f();
+  return (double)(NowNs() - begin);
+}
+
+inline double Percentile(std::vector<double> values, double q) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[(std::size_t)(q * (double)(values.size() - 1))];
+}
+
+// Collects results and prints them as
+//   {"benchmarks": [{"name": ..., "params": {...}, "value": ..., "unit": ...}]}
+// with one result per line, so that two runs diff cleanly.
+class Reporter {
+ public:
+  using Params = std::vector<std::pair<std::string, std::string>>;
+
+  void Add(const std::string& name, const Params& params, double value, const std::string& unit) {
+    std::ostringstream os;
+    os << "{\"name\": \"" << name << "\", \"params\": {";
+    for (std::size_t i = 0; i < params.size(); i ++) {
+      os << (i == 0 ? "" : ", ") << "\"" << params[i].first << "\": \"" << params[i].second << "\"";
+    }
+    os << "}, \"value\": " << value << ", \"unit\": \"" << unit << "\"}";
+    results_.push_back(os.str());
+    std::cerr << name;
+    for (auto& param : params) {
+      std::cerr << " " << param.first << "=" << param.second;
+    }
+    std::cerr << ": " << value << " " << unit << std::endl;
+  }
+
+  void Print(std::ostream& os) const {
+    os << "{\"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results_.size(); i ++) {
+      os << "  " << results_[i] << (i + 1 < results_.size() ? ",\n" : "\n");
+    }
+    os << "]}\n";
+  }
+
+ private:
+  std::vector<std::string> results_;
+};
+
+}  // namespace bench
+}  // namespace cos
+
+#endif  // BENCH_BENCH_H_
@@ -0,0 +1,93 @@
+/*
+ * Contention on the queue and branch mutexes, always built with
+ * COS_PROFILE_LOCKS: threads submitting small tasks to a WorkBranch, with
+ * and without threads polling TasksNum() and WorkersNum() meanwhile, as a
+ * monitor or a Supervisor does. For each lock: acquisitions, the share
+ * that waited, wait and hold percentiles. Progress and the full lock
+ * profile with call sites go to stderr, results to stdout as JSON, or to
+ * the file given as argument.
+ */
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/profiled_mutex.h"
+#include "bench/bench.h"
+#include "workspace/workbranch.h"
+
+using cos::base::LockProfiler;
+using cos::base::LockStats;
+using cos::bench::Reporter;
+using cos::bench::TimeNs;
+using cos::workspace::WorkBranch;
+
+static void Submitters(Reporter& rep, int pollers) {
+  const std::size_t submitters = 4;
+  const std::size_t per_thread = 50000;
+  LockProfiler::Reset();
+  std::atomic<std::size_t> sum(0);
+  std::atomic<bool> done(false);
+  {
+    WorkBranch br(4);
+    double ns = TimeNs([&] {
+      std::vector<std::thread> threads;
+      for (int p = 0; p < pollers; p ++) {
+        threads.emplace_back([&br, &done, &sum] {
+          while (!done.load(std::memory_order_relaxed)) {
+            sum.fetch_add(br.TasksNum() + br.WorkersNum(), std::memory_order_relaxed);
+          }
+        });
+      }
+      std::vector<std::thread> subs;
+      for (std::size_t s = 0; s < submitters; s ++) {
+        subs.emplace_back([&br, &sum] {
+          for (std::size_t i = 0; i < per_thread; i ++) {
+            br.Submit([&sum] { sum.fetch_add(1, std::memory_order_relaxed); });
+          }
+        });
+      }
+      for (auto& thread : subs) {
+        thread.join();
+      }
+      br.WaitIdle();
+      done = true;
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    });
+    rep.Add("submit_throughput", {{"pollers", std::to_string(pollers)}},
+            submitters * per_thread * 1e9 / ns, "tasks/s");
+  }
+  // The branch and its queues are gone, their profile is kept by name.
+  for (const LockStats& stats : LockProfiler::Report()) {
+    if (stats.acquisitions == 0) {
+      continue;
+    }
+    Reporter::Params params = {{"lock", stats.name}, {"pollers", std::to_string(pollers)}};
+    rep.Add("lock_acquisitions", params, (double)stats.acquisitions, "count");
+    rep.Add("lock_contended", params, 100.0 * stats.contended / stats.acquisitions, "%");
+    rep.Add("lock_wait_p99", params, (double)stats.wait_ns.Percentile(0.99), "ns");
+    rep.Add("lock_wait_total", params, (double)stats.wait_ns.Sum(), "ns");
+    rep.Add("lock_hold_p99", params, (double)stats.hold_ns.Percentile(0.99), "ns");
+  }
+  LockProfiler::Print(std::cerr);
+}
+
+int main(int argc, char** argv) {
+  LockProfiler::SetExitReport(false);
+  Reporter rep;
+  Submitters(rep, 0);
+  Submitters(rep, 2);
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    rep.Print(out);
+  } else {
+    rep.Print(std::cout);
+  }
+  return 0;
+}
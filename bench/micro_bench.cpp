@@ -0,0 +1,284 @@
+/*
+ * Microbenchmarks of WorkBranch, Workspace and the queues. Progress goes
+ * to stderr, results to stdout as JSON, or to the file given as argument.
+ */
+
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/ring_queue.h"
+#include "base/thread_safe_queue.h"
+#include "bench/bench.h"
+#include "workspace/workspace.h"
+
+using cos::base::RingQueue;
+using cos::base::ThreadSafeQueue;
+using cos::bench::NowNs;
+using cos::bench::Percentile;
+using cos::bench::Reporter;
+using cos::bench::TimeNs;
+using cos::workspace::BasicWorkBranch;
+using cos::workspace::Dispatch;
+using cos::workspace::LockFreeQueue;
+using cos::workspace::LockedQueue;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+
+static void WaitFor(const std::atomic<std::size_t>& counter, std::size_t value) {
+  while (counter.load(std::memory_order_acquire) < value) {
+    std::this_thread::yield();
+  }
+}
+
+static std::vector<std::size_t> WorkerCounts() {
+  std::vector<std::size_t> counts;
+  std::size_t max_workers = std::max(4u, std::thread::hardware_concurrency());
+  for (std::size_t n = 1; n <= max_workers; n *= 2) {
+    counts.push_back(n);
+  }
+  return counts;
+}
+
+// Empty tasks per second, submitted from one thread.
+template <typename Queue>
+static void EmptyTaskThroughput(Reporter& rep, const char* queue) {
+  const std::size_t num = 200000;
+  for (std::size_t workers : WorkerCounts()) {
+    BasicWorkBranch<Queue> branch((int)workers);
+    std::atomic<std::size_t> done(0);
+    double ns = TimeNs([&] {
+      for (std::size_t i = 0; i < num; i ++) {
+        branch.Submit([&done] { done.fetch_add(1, std::memory_order_release); });
+      }
+      WaitFor(done, num);
+    });
+    rep.Add("empty_task_throughput", {{"queue", queue}, {"workers", std::to_string(workers)}},
+            num * 1e9 / ns, "tasks/s");
+  }
+}
+
+// From Submit() to the first instruction of the task, one task at a time,
+// so workers are often parked.
+static void SubmitToStart(Reporter& rep) {
+  const std::size_t num = 2000;
+  WorkBranch branch(2);
+  std::vector<double> latency(num);
+  for (std::size_t i = 0; i < num; i ++) {
+    std::atomic<std::uint64_t> started(0);
+    std::uint64_t submitted = NowNs();
+    branch.Submit([&started] { started.store(NowNs(), std::memory_order_release); });
+    while (started.load(std::memory_order_acquire) == 0) {
+      std::this_thread::yield();
+    }
+    latency[i] = (double)(started - submitted);
+    if (i % 16 == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));    // let it park
+    }
+  }
+  rep.Add("submit_to_start", {{"stat", "p50"}}, Percentile(latency, 0.5), "ns");
+  rep.Add("submit_to_start", {{"stat", "p99"}}, Percentile(latency, 0.99), "ns");
+}
+
+// Start latency of urgent and normal probes behind a backlog of small tasks.
+static void UrgentVsNormal(Reporter& rep) {
+  const std::size_t probes = 200, backlog = 200;
+  WorkBranch branch(1);
+  std::vector<double> normal, urgent;
+  for (std::size_t i = 0; i < probes; i ++) {
+    std::atomic<std::size_t> done(0);
+    for (std::size_t j = 0; j < backlog; j ++) {
+      branch.Submit([&done] {
+        std::uint64_t end = NowNs() + 1000;
+        while (NowNs() < end) { }
+        done ++;
+      });
+    }
+    std::atomic<std::uint64_t> started(0);
+    std::uint64_t submitted = NowNs();
+    if (i % 2 == 0) {
+      branch.Submit<cos::base::urgent>([&started] { started = NowNs(); });
+    } else {
+      branch.Submit([&started] { started = NowNs(); });
+    }
+    WaitFor(done, backlog);
+    while (started == 0) {
+      std::this_thread::yield();
+    }
+    (i % 2 == 0 ? urgent : normal).push_back((double)(started - submitted));
+  }
+  rep.Add("start_latency_behind_backlog", {{"priority", "urgent"}, {"stat", "p50"}},
+          Percentile(urgent, 0.5), "ns");
+  rep.Add("start_latency_behind_backlog", {{"priority", "normal"}, {"stat", "p50"}},
+          Percentile(normal, 0.5), "ns");
+}
+
+// Per-lane wait of an overloaded branch with lanes weighted 8:4:1, from
+// its snapshot.
+static void LaneWaits(Reporter& rep) {
+  const std::size_t per_lane = 2000;
+  cos::workspace::BranchOptions options;
+  options.lane_weights = {8, 4, 1};
+  WorkBranch branch(1, options);
+  std::atomic<std::size_t> done(0);
+  auto spin = [&done] {
+    std::uint64_t end = NowNs() + 1000;
+    while (NowNs() < end) { }
+    done ++;
+  };
+  for (std::size_t i = 0; i < per_lane; i ++) {
+    branch.Submit<cos::base::lane<0>>(spin);
+    branch.Submit<cos::base::lane<1>>(spin);
+    branch.Submit<cos::base::lane<2>>(spin);
+  }
+  WaitFor(done, 3 * per_lane);
+  cos::workspace::BranchSnapshot snap = branch.Snapshot();
+  for (std::size_t lane = 0; lane < snap.lane_wait_ns.size(); lane ++) {
+    rep.Add("lane_wait", {{"lane", std::to_string(lane)}, {"stat", "p50"}},
+            (double)snap.lane_wait_ns[lane].Percentile(0.5), "ns");
+    rep.Add("lane_wait", {{"lane", std::to_string(lane)}, {"stat", "p99"}},
+            (double)snap.lane_wait_ns[lane].Percentile(0.99), "ns");
+  }
+}
+
+// Keyed tasks of 1us per second on all workers, by number of hot keys.
+static void KeyedThroughput(Reporter& rep) {
+  const std::size_t num = 100000;
+  std::size_t workers = std::max(2u, std::thread::hardware_concurrency());
+  for (std::size_t keys : {1, 4, 64}) {
+    WorkBranch branch((int)workers);
+    std::atomic<std::size_t> done(0);
+    double ns = TimeNs([&] {
+      for (std::size_t i = 0; i < num; i ++) {
+        branch.SubmitKeyed(i % keys, [&done] {
+          std::uint64_t end = NowNs() + 1000;
+          while (NowNs() < end) { }
+          done.fetch_add(1, std::memory_order_release);
+        });
+      }
+      WaitFor(done, num);
+    });
+    rep.Add("keyed_throughput", {{"keys", std::to_string(keys)}, {"workers", std::to_string(workers)}},
+            num * 1e9 / ns, "tasks/s");
+  }
+}
+
+// Empty tasks per second on one worker, with tracing off and on.
+static void TracingOverhead(Reporter& rep) {
+  const std::size_t num = 200000;
+  for (bool tracing : {false, true}) {
+    WorkBranch branch(1);
+    branch.SetTracing(tracing);
+    std::atomic<std::size_t> done(0);
+    double ns = TimeNs([&] {
+      for (std::size_t i = 0; i < num; i ++) {
+        branch.Submit([&done] { done.fetch_add(1, std::memory_order_release); });
+      }
+      WaitFor(done, num);
+    });
+    rep.Add("tracing_throughput", {{"tracing", tracing ? "on" : "off"}}, num * 1e9 / ns, "tasks/s");
+  }
+}
+
+// Submit a value-returning task and wait for its result.
+static void FutureRoundTrip(Reporter& rep) {
+  const std::size_t num = 20000;
+  WorkBranch branch(1);
+  double ns = TimeNs([&] {
+    for (std::size_t i = 0; i < num; i ++) {
+      branch.Submit([i] { return i; }).get();
+    }
+  });
+  rep.Add("future_round_trip", {{"future", "std::future"}}, ns / num, "ns");
+  ns = TimeNs([&] {
+    for (std::size_t i = 0; i < num; i ++) {
+      branch.SubmitFast([i] { return i; }).get();
+    }
+  });
+  rep.Add("future_round_trip", {{"future", "FastFuture"}}, ns / num, "ns");
+}
+
+// Push/pop pairs per second with 'threads' producers and as many consumers.
+template <typename Queue>
+static void QueueContention(Reporter& rep, const char* queue) {
+  const std::size_t per_thread = 200000;
+  for (std::size_t threads : {1, 2, 4}) {
+    Queue que;
+    std::atomic<std::size_t> popped(0);
+    double ns = TimeNs([&] {
+      std::vector<std::thread> pool;
+      for (std::size_t t = 0; t < threads; t ++) {
+        pool.emplace_back([&que] {
+          for (std::size_t i = 0; i < per_thread; i ++) {
+            que.push_back(int(i));
+          }
+        });
+        pool.emplace_back([&que, &popped, threads] {
+          int value = 0;
+          while (popped.load(std::memory_order_relaxed) < threads * per_thread) {
+            if (que.try_pop(value)) {
+              popped ++;
+            } else {
+              std::this_thread::yield();
+            }
+          }
+        });
+      }
+      for (auto& thrd : pool) {
+        thrd.join();
+      }
+    });
+    rep.Add("queue_push_pop", {{"queue", queue}, {"threads", std::to_string(threads)}},
+            threads * per_thread * 1e9 / ns, "ops/s");
+  }
+}
+
+// Cost of Workspace::Submit itself, per dispatch policy.
+static void DispatchOverhead(Reporter& rep) {
+  const std::size_t num = 100000;
+  const std::pair<const char*, Dispatch> policies[] = {
+    {"round_robin", Dispatch::round_robin}, {"power_of_two", Dispatch::power_of_two},
+    {"least_loaded", Dispatch::least_loaded}, {"shortest_wait", Dispatch::shortest_wait},
+  };
+  for (auto& policy : policies) {
+    Workspace space;
+    for (int i = 0; i < 4; i ++) {
+      space.Attach(new WorkBranch(1));
+    }
+    space.SetDispatch(policy.second);
+    std::atomic<std::size_t> done(0);
+    double ns = TimeNs([&] {
+      for (std::size_t i = 0; i < num; i ++) {
+        space.Submit([&done] { done.fetch_add(1, std::memory_order_release); });
+      }
+    });
+    WaitFor(done, num);
+    rep.Add("workspace_submit", {{"dispatch", policy.first}}, ns / num, "ns");
+  }
+}
+
+int main(int argc, char** argv) {
+  Reporter rep;
+  EmptyTaskThroughput<LockedQueue>(rep, "locked");
+  EmptyTaskThroughput<LockFreeQueue>(rep, "lockfree");
+  SubmitToStart(rep);
+  UrgentVsNormal(rep);
+  LaneWaits(rep);
+  KeyedThroughput(rep);
+  TracingOverhead(rep);
+  FutureRoundTrip(rep);
+  QueueContention<ThreadSafeQueue<int>>(rep, "ThreadSafeQueue");
+  QueueContention<RingQueue<int>>(rep, "RingQueue");
+  DispatchOverhead(rep);
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    rep.Print(out);
+  } else {
+    rep.Print(std::cout);
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Scaling of the parallel algorithms from 1 to N workers against a
+ * serial baseline. Progress goes to stderr, results to stdout as JSON, or
+ * to the file given as argument.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "workspace/parallel.h"
+
+using cos::bench::Reporter;
+using cos::bench::TimeNs;
+using cos::workspace::WorkBranch;
+using cos::workspace::ParallelFor;
+using cos::workspace::ParallelReduce;
+using cos::workspace::ParallelSort;
+
+// Something worth parallelizing per element.
+static std::uint64_t Score(std::uint64_t x) {
+  for (int i = 0; i < 200; i ++) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    x ^= x >> 29;
+  }
+  return x;
+}
+
+static std::vector<int> RandomInts(std::size_t num) {
+  std::vector<int> values(num);
+  std::uint32_t seed = 7;
+  for (auto& v : values) {
+    seed = seed * 1664525u + 1013904223u;
+    v = (int)(seed >> 1);
+  }
+  return values;
+}
+
+int main(int argc, char** argv) {
+  const std::size_t num = 1 << 20;
+  std::vector<std::uint64_t> scores(num);
+  std::vector<int> unsorted = RandomInts(num * 2);
+  Reporter rep;
+
+  double serial_for = TimeNs([&] {
+    for (std::size_t i = 0; i < num; i ++) {
+      scores[i] = Score(i);
+    }
+  });
+  double serial_sort = TimeNs([&] {
+    std::vector<int> values = unsorted;
+    std::sort(values.begin(), values.end());
+  });
+  rep.Add("parallel_for", {{"threads", "serial"}}, serial_for / 1e6, "ms");
+  rep.Add("parallel_sort", {{"threads", "serial"}}, serial_sort / 1e6, "ms");
+
+  std::size_t max_workers = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t workers = 1; workers <= max_workers; workers *= 2) {
+    // The caller takes part in every call, so N - 1 workers give N threads.
+    WorkBranch branch((int)std::max<std::size_t>(1, workers - 1));
+    double par_for = TimeNs([&] {
+      ParallelFor(branch, std::size_t(0), num, 0, [&](std::size_t i) { scores[i] = Score(i); });
+    });
+    double par_reduce = TimeNs([&] {
+      ParallelReduce(branch, scores.begin(), scores.end(), 0, std::uint64_t(0),
+                     [](std::uint64_t a, std::uint64_t b) { return a ^ b; });
+    });
+    double par_sort = TimeNs([&] {
+      std::vector<int> values = unsorted;
+      ParallelSort(branch, values.begin(), values.end());
+    });
+    Reporter::Params params = {{"threads", std::to_string(workers)}};
+    rep.Add("parallel_for", params, par_for / 1e6, "ms");
+    rep.Add("parallel_for_speedup", params, serial_for / par_for, "x");
+    rep.Add("parallel_reduce", params, par_reduce / 1e6, "ms");
+    rep.Add("parallel_sort", params, par_sort / 1e6, "ms");
+    rep.Add("parallel_sort_speedup", params, serial_sort / par_sort, "x");
+  }
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    rep.Print(out);
+  } else {
+    rep.Print(std::cout);
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Scale-up latency of a WorkBranch with and without a worker reserve,
+ * after the same workers were removed: the cost of an AddWorker() call,
+ * and the time from the first call until every added worker runs a task.
+ * Progress goes to stderr, results to stdout as JSON, or to the file given
+ * as argument.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "workspace/workbranch.h"
+
+using cos::bench::NowNs;
+using cos::bench::Percentile;
+using cos::bench::Reporter;
+using cos::workspace::BranchOptions;
+using cos::workspace::WorkBranch;
+
+// Returns once 'num' tasks run at the same time, so 'num' workers are up.
+static void Rendezvous(WorkBranch& br, std::size_t num) {
+  std::atomic<std::size_t> arrived(0), left(0);
+  for (std::size_t i = 0; i < num; i ++) {
+    br.Submit([&arrived, &left, num] {
+      arrived ++;
+      while (arrived < num) {
+        std::this_thread::yield();
+      }
+      left ++;
+    });
+  }
+  while (left < num) {
+    std::this_thread::yield();
+  }
+}
+
+static void ScaleUp(Reporter& rep, std::size_t reserve) {
+  const std::size_t rounds = 200, burst = 8;
+  BranchOptions options;
+  options.reserve_workers = reserve;
+  WorkBranch br(1, options);
+  std::vector<double> latency, add;
+  for (std::size_t i = 0; i < rounds; i ++) {
+    std::uint64_t begin = NowNs();
+    for (std::size_t j = 0; j < burst; j ++) {
+      br.AddWorker();
+    }
+    add.push_back((double)(NowNs() - begin) / burst);
+    Rendezvous(br, burst + 1);
+    latency.push_back((double)(NowNs() - begin));
+    for (std::size_t j = 0; j < burst; j ++) {
+      br.RemoveWorker();
+    }
+    // Let the removed workers park or exit before the next burst.
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  std::string mode = std::to_string(reserve);
+  rep.Add("add_worker", {{"reserve", mode}, {"stat", "p50"}}, Percentile(add, 0.5), "ns");
+  rep.Add("add_worker", {{"reserve", mode}, {"stat", "p99"}}, Percentile(add, 0.99), "ns");
+  rep.Add("scale_up", {{"reserve", mode}, {"stat", "p50"}}, Percentile(latency, 0.5), "ns");
+  rep.Add("scale_up", {{"reserve", mode}, {"stat", "p99"}}, Percentile(latency, 0.99), "ns");
+}
+
+int main(int argc, char** argv) {
+  Reporter rep;
+  ScaleUp(rep, 0);
+  ScaleUp(rep, 8);
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    rep.Print(out);
+  } else {
+    rep.Print(std::cout);
+  }
+  return 0;
+}
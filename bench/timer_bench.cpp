@@ -0,0 +1,145 @@
+/*
+ * Timers: cost of insert and cancel with a million pending timers, and
+ * how late delayed tasks start on an idle and on a busy branch. Progress
+ * goes to stderr, results to stdout as JSON, or to the file given as
+ * argument.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/timer_wheel.h"
+#include "bench/bench.h"
+#include "workspace/timer.h"
+#include "workspace/workbranch.h"
+
+using cos::base::TimerWheel;
+using cos::bench::NowNs;
+using cos::bench::Percentile;
+using cos::bench::Reporter;
+using cos::bench::TimeNs;
+using cos::workspace::Timer;
+using cos::workspace::TimerHandle;
+using cos::workspace::WorkBranch;
+
+static std::uint64_t Next(std::uint64_t& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+// Add and Cancel on a wheel that holds 'pending' timers spread over an hour
+// of millisecond ticks.
+static void WheelOps(Reporter& rep) {
+  const std::size_t pending = 1000000, ops = 1000000;
+  std::uint64_t state = 88172645463325252ULL;
+  TimerWheel<int> wheel;
+  for (std::size_t i = 0; i < pending; i ++) {
+    wheel.Add(Next(state) % 3600000, 0);
+  }
+  std::vector<TimerWheel<int>::Id> ids(ops);
+  double add_ns = TimeNs([&] {
+    for (std::size_t i = 0; i < ops; i ++) {
+      ids[i] = wheel.Add(Next(state) % 3600000, 0);
+    }
+  });
+  double cancel_ns = TimeNs([&] {
+    for (std::size_t i = 0; i < ops; i ++) {
+      wheel.Cancel(ids[i]);
+    }
+  });
+  rep.Add("timer_wheel", {{"op", "add"}, {"pending", std::to_string(pending)}}, add_ns / ops, "ns");
+  rep.Add("timer_wheel", {{"op", "cancel"}, {"pending", std::to_string(pending)}}, cancel_ns / ops, "ns");
+}
+
+// The same through Timer, with its lock and the thread running.
+static void TimerOps(Reporter& rep) {
+  const std::size_t pending = 1000000, ops = 200000;
+  WorkBranch br(1);
+  Timer timer;
+  for (std::size_t i = 0; i < pending; i ++) {
+    timer.SubmitAfter(br, std::chrono::seconds(3600), [] { });
+  }
+  std::vector<TimerHandle> handles(ops);
+  double add_ns = TimeNs([&] {
+    for (std::size_t i = 0; i < ops; i ++) {
+      handles[i] = timer.SubmitAfter(br, std::chrono::seconds(60), [] { });
+    }
+  });
+  double cancel_ns = TimeNs([&] {
+    for (std::size_t i = 0; i < ops; i ++) {
+      handles[i].Cancel();
+    }
+  });
+  rep.Add("timer", {{"op", "submit_after"}, {"pending", std::to_string(pending)}}, add_ns / ops, "ns");
+  rep.Add("timer", {{"op", "cancel"}, {"pending", std::to_string(pending)}}, cancel_ns / ops, "ns");
+}
+
+// Start time minus due time of delayed tasks of 1 to 50ms. Under load the
+// branch's workers, at most one per cpu, also run a steady stream of 200us
+// tasks at about 80% utilization, so timer tasks queue behind them.
+static void Skew(Reporter& rep, bool loaded) {
+  const std::size_t num = 2000;
+  const std::size_t workers = std::max(1u, std::min(2u, std::thread::hardware_concurrency()));
+  WorkBranch br((int)workers);
+  Timer timer;
+  std::atomic<bool> stop(false);
+  std::thread load([&] {
+    while (loaded && !stop) {
+      for (std::size_t i = 0; i < workers * 4; i ++) {
+        br.Submit([] {
+          std::uint64_t end = NowNs() + 200000;
+          while (NowNs() < end) { }
+        });
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(1000));
+    }
+  });
+
+  std::vector<double> skew(num);
+  std::atomic<std::size_t> done(0);
+  std::uint64_t state = 88172645463325252ULL;
+  for (std::size_t i = 0; i < num; i ++) {
+    std::uint64_t delay_us = 1000 + Next(state) % 49000;
+    std::uint64_t due = NowNs() + delay_us * 1000;
+    timer.SubmitAfter(br, std::chrono::microseconds(delay_us), [&skew, &done, i, due] {
+      skew[i] = (double)(NowNs() - due);
+      done ++;
+    });
+    if (i % 40 == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  while (done < num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  stop = true;
+  load.join();
+  const char* mode = loaded ? "busy" : "idle";
+  rep.Add("timer_skew", {{"branch", mode}, {"stat", "p50"}}, Percentile(skew, 0.5), "ns");
+  rep.Add("timer_skew", {{"branch", mode}, {"stat", "p99"}}, Percentile(skew, 0.99), "ns");
+  rep.Add("timer_skew", {{"branch", mode}, {"stat", "max"}}, Percentile(skew, 1.0), "ns");
+}
+
+int main(int argc, char** argv) {
+  Reporter rep;
+  WheelOps(rep);
+  TimerOps(rep);
+  Skew(rep, false);
+  Skew(rep, true);
+
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    rep.Print(out);
+  } else {
+    rep.Print(std::cout);
+  }
+  return 0;
+}
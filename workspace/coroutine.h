@@ -0,0 +1,457 @@
+/*
+ * Optional C++20 coroutine layer on top of WorkBranch and Workspace.
+ *
+ *   coro::Task<int> Handle(WorkBranch& br) {
+ *     co_await br.Schedule();                        // hop onto a worker
+ *     int v = co_await coro::Async(io, [] { return Read(); });
+ *     co_return v + 1;
+ *   }
+ *
+ * A suspended coroutine holds no thread: it is resumed by the task that
+ * completes what it waits for, on whatever worker ran that task.
+ */
+
+#ifndef WORKSPACE_COROUTINE_H_
+#define WORKSPACE_COROUTINE_H_
+
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "workspace/coroutine.h needs C++20 coroutines"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "workbranch.h"
+#include "workspace.h"
+
+namespace cos {
+namespace workspace {
+namespace coro {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+      return handle.promise().continuation;
+    }
+    void await_resume() noexcept { }
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr error;
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  Task<T> get_return_object();
+  void return_value(T v) { value.emplace(std::move(v)); }
+  T take() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return std::move(*value);
+  }
+  std::optional<T> value;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  void return_void() { }
+  void take() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+// Starts at once and frees itself at the end.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() { }
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Resumes a coroutine from a worker.
+struct Resume {
+  void operator()() { handle.resume(); }
+  std::coroutine_handle<> handle;
+};
+
+}  // namespace detail
+
+// A lazy coroutine: it starts when awaited, and resumes its awaiter when it
+// finishes, without going through any queue.
+//
+// GCC 12 destroys the temporaries of a co_await expression twice, so Task
+// and every awaiter below survive a second destruction: they hold nothing,
+// or only pointers that the first destruction clears. For the same reason,
+// a function given to Async() that owns resources should be a named
+// variable there, not a temporary lambda.
+template <typename T>
+class Task {
+ public:
+  using promise_type = detail::Promise<T>;
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) { }
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) { }
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      reset();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() {
+    reset();
+  }
+
+  bool valid() const { return handle_ != nullptr; }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return !handle || handle.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+      T await_resume() { return handle.promise().take(); }
+      std::coroutine_handle<promise_type> handle;
+    };
+    return Awaiter{handle_};
+  }
+
+  auto operator co_await() & noexcept {
+    return std::move(*this).operator co_await();
+  }
+
+ private:
+  void reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+// What WorkBranch::Schedule() and Workspace::Schedule() return.
+template <typename Executor>
+class ScheduleAwaiter {
+ public:
+  explicit ScheduleAwaiter(Executor& exec) : exec_(exec) { }
+  bool await_ready() noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    exec_.Submit(detail::Resume{handle});
+  }
+  void await_resume() noexcept { }
+
+ private:
+  Executor& exec_;
+};
+
+// co_await Async(exec, func) runs 'func' on 'exec' and resumes with its
+// result, or its exception, on the worker that ran it.
+template <typename Executor, typename F, typename R = std::invoke_result_t<F&>>
+class AsyncAwaiter {
+ public:
+  AsyncAwaiter(Executor& exec, F func) : state_(new State(exec, std::move(func))) { }
+
+  bool await_ready() noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    state_->handle = handle;
+    state_->exec.Submit(Runner{state_.get()});
+  }
+
+  R await_resume() {
+    if (state_->error) {
+      std::rethrow_exception(state_->error);
+    }
+    if constexpr (!std::is_void_v<R>) {
+      return std::move(*state_->value);
+    }
+  }
+
+ private:
+  using Value = std::conditional_t<std::is_void_v<R>, char, R>;
+
+  struct State {
+    State(Executor& ex, F fn) : exec(ex), func(std::move(fn)) { }
+    Executor& exec;
+    F func;
+    std::coroutine_handle<> handle;
+    std::optional<Value> value;
+    std::exception_ptr error;
+  };
+
+  struct Runner {
+    void operator()() {
+      try {
+        if constexpr (std::is_void_v<R>) {
+          state->func();
+        } else {
+          state->value.emplace(state->func());
+        }
+      } catch (...) {
+        state->error = std::current_exception();
+      }
+      state->handle.resume();
+    }
+    State* state;
+  };
+
+  std::unique_ptr<State> state_;    // reset by the first destruction
+};
+
+template <typename Executor, typename F>
+AsyncAwaiter<Executor, std::decay_t<F>> Async(Executor& exec, F&& func) {
+  return AsyncAwaiter<Executor, std::decay_t<F>>(exec, std::forward<F>(func));
+}
+
+namespace detail {
+
+template <typename T>
+using Slot = std::optional<std::conditional_t<std::is_void_v<T>, char, T>>;
+
+struct AllState {
+  explicit AllState(std::size_t num) : count(num + 1) { }
+  std::atomic<std::size_t> count;
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+  std::mutex mtx;
+
+  void fail(std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!error) {
+      error = e;
+    }
+  }
+  // The last of the children and the launcher resumes the awaiter.
+  bool arrive() {
+    return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+};
+
+template <typename T>
+Detached RunForAll(Task<T>& task, AllState* state, Slot<T>* slot) {
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await task;
+      slot->emplace();
+    } else {
+      slot->emplace(co_await task);
+    }
+  } catch (...) {
+    state->fail(std::current_exception());
+  }
+  if (state->arrive()) {
+    state->continuation.resume();
+  }
+}
+
+template <typename T>
+struct AllAwaiter {
+  bool await_ready() noexcept { return tasks.empty(); }
+  bool await_suspend(std::coroutine_handle<> handle) {
+    state->continuation = handle;
+    for (std::size_t i = 0; i < tasks.size(); i ++) {
+      RunForAll(tasks[i], state, &slots[i]);
+    }
+    return !state->arrive();
+  }
+  void await_resume() noexcept { }
+  std::vector<Task<T>>& tasks;
+  AllState* state;
+  std::vector<Slot<T>>& slots;
+};
+
+template <typename T>
+struct AnyState {
+  std::vector<Task<T>> tasks;           // kept alive until every child ends
+  std::atomic<bool> decided{false};
+  std::atomic<int> resumers{2};          // the winner and the launcher
+  std::size_t index = 0;
+  Slot<T> value;
+  std::exception_ptr error;
+  std::coroutine_handle<> continuation;
+
+  bool arrive() {
+    return resumers.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+};
+
+template <typename T>
+Detached RunForAny(std::shared_ptr<AnyState<T>> state, std::size_t i) {
+  Slot<T> value;
+  std::exception_ptr error;
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await state->tasks[i];
+      value.emplace();
+    } else {
+      value.emplace(co_await state->tasks[i]);
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  if (!state->decided.exchange(true, std::memory_order_acq_rel)) {
+    state->index = i;
+    state->value = std::move(value);
+    state->error = error;
+    if (state->arrive()) {
+      state->continuation.resume();
+    }
+  }
+}
+
+template <typename T>
+struct AnyAwaiter {
+  bool await_ready() noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> handle) {
+    state->continuation = handle;
+    for (std::size_t i = 0; i < state->tasks.size(); i ++) {
+      RunForAny(state, i);
+    }
+    return !state->arrive();
+  }
+  void await_resume() noexcept { }
+  std::shared_ptr<AnyState<T>>& state;    // owned by the WhenAny frame
+};
+
+}  // namespace detail
+
+// Runs all tasks concurrently and completes when the last one does. Each
+// task runs inline until its first suspension. The first exception, if
+// any, is rethrown once all are done.
+template <typename T>
+auto WhenAll(std::vector<Task<T>> tasks)
+    -> Task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> {
+  detail::AllState state(tasks.size());
+  std::vector<detail::Slot<T>> slots(tasks.size());
+  co_await detail::AllAwaiter<T>{tasks, &state, slots};
+  if (state.error) {
+    std::rethrow_exception(state.error);
+  }
+  if constexpr (!std::is_void_v<T>) {
+    std::vector<T> results;
+    results.reserve(slots.size());
+    for (auto& slot : slots) {
+      results.push_back(std::move(*slot));
+    }
+    co_return results;
+  }
+}
+
+// Completes with the first task to finish, as its index (and value). The
+// others keep running to their end in the background.
+template <typename T>
+auto WhenAny(std::vector<Task<T>> tasks)
+    -> Task<std::conditional_t<std::is_void_v<T>, std::size_t, std::pair<std::size_t, T>>> {
+  if (tasks.empty()) {
+    throw std::invalid_argument("WhenAny of no tasks");
+  }
+  auto state = std::make_shared<detail::AnyState<T>>();
+  state->tasks = std::move(tasks);
+  co_await detail::AnyAwaiter<T>{state};
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+  if constexpr (std::is_void_v<T>) {
+    co_return state->index;
+  } else {
+    co_return std::make_pair(state->index, std::move(*state->value));
+  }
+}
+
+namespace detail {
+
+template <typename T>
+struct SyncState {
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool done = false;
+  Slot<T> value;
+  std::exception_ptr error;
+};
+
+template <typename T>
+Detached RunSync(Task<T>& task, SyncState<T>* state) {
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await task;
+    } else {
+      state->value.emplace(co_await task);
+    }
+  } catch (...) {
+    state->error = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(state->mtx);
+  state->done = true;
+  state->cv.notify_one();
+}
+
+}  // namespace detail
+
+// Blocks the calling thread, which should not be a worker, until 'task'
+// is done.
+template <typename T>
+T SyncWait(Task<T> task) {
+  detail::SyncState<T> state;
+  detail::RunSync(task, &state);
+  std::unique_lock<std::mutex> ulk(state.mtx);
+  state.cv.wait(ulk, [&state] { return state.done; });
+  if (state.error) {
+    std::rethrow_exception(state.error);
+  }
+  if constexpr (!std::is_void_v<T>) {
+    return std::move(*state.value);
+  }
+}
+
+}  // namespace coro
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_COROUTINE_H_
@@ -0,0 +1,149 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "coroutine.h"
+
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+namespace coro = cos::workspace::coro;
+
+static coro::Task<int> Square(WorkBranch& br, int x) {
+  co_await br.Schedule();
+  co_return x * x;
+}
+
+static coro::Task<int> SumOfSquares(WorkBranch& br, int n) {
+  int sum = 0;
+  for (int i = 1; i <= n; i ++) {
+    sum += co_await Square(br, i);
+  }
+  co_return sum;
+}
+
+TEST(Coroutine, schedule_and_await) {
+  WorkBranch br(2);
+  EXPECT_EQ(coro::SyncWait(SumOfSquares(br, 10)), 385);
+}
+
+TEST(Coroutine, async_results) {
+  WorkBranch br(1);
+  Workspace space;
+  space.Attach(new WorkBranch(2));
+  auto task = [&]() -> coro::Task<int> {
+    co_await space.Schedule();
+    int a = co_await coro::Async(br, [] { return 20; });
+    int b = co_await coro::Async(space, [] { return 22; });
+    co_await coro::Async(br, [] {});
+    co_return a + b;
+  };
+  EXPECT_EQ(coro::SyncWait(task()), 42);
+
+  auto failing = [&]() -> coro::Task<void> {
+    co_await coro::Async(br, []() -> int { throw std::runtime_error("boom"); });
+  };
+  EXPECT_THROW(coro::SyncWait(failing()), std::runtime_error);
+}
+
+TEST(Coroutine, suspended_coroutine_holds_no_worker) {
+  WorkBranch br(1);
+  WorkBranch io(1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  std::atomic<bool> resumed(false);
+
+  auto handler = [&]() -> coro::Task<void> {
+    co_await br.Schedule();
+    auto wait_gate = [opened] { opened.wait(); };
+    co_await coro::Async(io, wait_gate);
+    resumed = true;
+  };
+  std::thread waiter([&] { coro::SyncWait(handler()); });
+
+  // The only worker of 'br' is free while the handler waits.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(br.Submit([] { return 7; }).get(), 7);
+  EXPECT_FALSE(resumed);
+  gate.set_value();
+  waiter.join();
+  EXPECT_TRUE(resumed);
+}
+
+TEST(Coroutine, thousands_in_flight) {
+  WorkBranch br(2);
+  WorkBranch io(1);
+  const int num = 2000;
+  std::atomic<int> in_flight(0), peak(0);
+  auto handler = [&](int i) -> coro::Task<int> {
+    co_await br.Schedule();
+    int now = ++ in_flight;
+    int seen = peak.load();
+    while (now > seen && !peak.compare_exchange_weak(seen, now)) { }
+    int v = co_await coro::Async(io, [i] { return i; });
+    in_flight --;
+    co_return v;
+  };
+  std::vector<coro::Task<int>> tasks;
+  for (int i = 0; i < num; i ++) {
+    tasks.push_back(handler(i));
+  }
+  std::vector<int> results = coro::SyncWait(coro::WhenAll(std::move(tasks)));
+  ASSERT_EQ(results.size(), (std::size_t)num);
+  for (int i = 0; i < num; i ++) {
+    EXPECT_EQ(results[i], i);
+  }
+  EXPECT_GT(peak, 3);    // more handlers in flight than threads
+}
+
+TEST(Coroutine, when_all_and_when_any) {
+  WorkBranch br(2);
+  std::atomic<int> count(0);
+  auto bump = [&]() -> coro::Task<void> {
+    co_await br.Schedule();
+    count ++;
+  };
+  std::vector<coro::Task<void>> voids;
+  for (int i = 0; i < 10; i ++) {
+    voids.push_back(bump());
+  }
+  coro::SyncWait(coro::WhenAll(std::move(voids)));
+  EXPECT_EQ(count, 10);
+  coro::SyncWait(coro::WhenAll(std::vector<coro::Task<void>>()));
+
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  auto slow = [&]() -> coro::Task<int> {
+    auto wait_gate = [opened] { opened.wait(); };
+    co_await coro::Async(br, wait_gate);
+    co_return 1;
+  };
+  auto fast = [&]() -> coro::Task<int> {
+    co_await br.Schedule();
+    co_return 2;
+  };
+  std::vector<coro::Task<int>> race;
+  race.push_back(slow());
+  race.push_back(fast());
+  auto winner = coro::SyncWait(coro::WhenAny(std::move(race)));
+  EXPECT_EQ(winner.first, 1);
+  EXPECT_EQ(winner.second, 2);
+  gate.set_value();
+
+  auto throws = [&]() -> coro::Task<int> {
+    co_await br.Schedule();
+    throw std::runtime_error("boom");
+  };
+  std::vector<coro::Task<int>> failing;
+  failing.push_back(throws());
+  failing.push_back(fast());
+  EXPECT_THROW(coro::SyncWait(coro::WhenAll(std::move(failing))), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
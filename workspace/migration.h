@@ -0,0 +1,135 @@
+#ifndef WORKSPACE_MIGRATION_H_
+#define WORKSPACE_MIGRATION_H_
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace cos {
+namespace workspace {
+
+constexpr std::size_t DEFAULT_MIGRATE_BATCH = 32;
+
+// Sibling branches handing queued tasks to each other. A worker about to
+// park takes a batch from the member with the most queued tasks beyond one
+// per worker: half of them, at most DEFAULT_MIGRATE_BATCH. A member whose
+// backlog grows while none of its workers is parked wakes a parked worker
+// of an idle sibling to come and take some. Rebalance() does the same for
+// every idle member at once, e.g. from a Supervisor tick.
+//
+// Only tasks not started yet move, and not those in the deques of work
+// stealing. They keep their lane but not their deadline. Members are
+// removed before they are destroyed.
+template <typename Branch>
+class MigrationGroup {
+ public:
+  MigrationGroup() = default;
+
+  MigrationGroup(const MigrationGroup&) = delete;
+  MigrationGroup& operator=(const MigrationGroup&) = delete;
+
+  ~MigrationGroup() {
+    Clear();
+  }
+
+  // False if the branch opted out.
+  bool Add(Branch* branch) {
+    if (!branch->options_.migratable) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (std::find(members_.begin(), members_.end(), branch) == members_.end()) {
+      members_.push_back(branch);
+      branch->migration_.store(this, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // Once it returns no member takes from or gives to 'branch' any more.
+  void Remove(Branch* branch) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = std::find(members_.begin(), members_.end(), branch);
+    if (it != members_.end()) {
+      branch->migration_.store(nullptr, std::memory_order_release);
+      members_.erase(it);
+    }
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (Branch* branch : members_) {
+      branch->migration_.store(nullptr, std::memory_order_release);
+    }
+    members_.clear();
+  }
+
+  std::size_t Size() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return members_.size();
+  }
+
+  // Moves a batch from the most loaded member to 'thief', returns how many
+  // tasks moved.
+  std::size_t Steal(Branch& thief) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return steal_locked(thief);
+  }
+
+  // Every member with workers and no queued task steals once. Returns how
+  // many tasks moved.
+  std::size_t Rebalance() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::size_t moved = 0;
+    for (Branch* member : members_) {
+      auto hint = member->Hint();
+      if (hint.queued == 0 && hint.workers > 0) {
+        moved += steal_locked(*member);
+      }
+    }
+    return moved;
+  }
+
+  // Called by 'source' with a backlog and no parked worker. Skipped while
+  // another thread holds the group, it is busy moving tasks anyway.
+  void Nudge(Branch& source) {
+    std::unique_lock<std::mutex> ulk(mtx_, std::try_to_lock);
+    if (!ulk.owns_lock()) {
+      return;
+    }
+    for (Branch* member : members_) {
+      if (member != &source && member->parked_ > 0 && member->Hint().queued == 0) {
+        member->nudge();
+        return;
+      }
+    }
+  }
+
+ private:
+  std::size_t steal_locked(Branch& thief) {
+    if (std::find(members_.begin(), members_.end(), &thief) == members_.end()) {
+      return 0;
+    }
+    Branch* victim = nullptr;
+    std::size_t most = 0;
+    for (Branch* member : members_) {
+      auto hint = member->Hint();
+      std::size_t surplus = hint.queued > hint.workers ? hint.queued - hint.workers : 0;
+      if (member != &thief && surplus > most) {
+        victim = member;
+        most = surplus;
+      }
+    }
+    if (victim == nullptr) {
+      return 0;
+    }
+    return victim->MigrateTo(thief, std::min(DEFAULT_MIGRATE_BATCH, (most + 1) / 2));
+  }
+
+  std::mutex mtx_;
+  std::vector<Branch*> members_;
+};
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_MIGRATION_H_
@@ -0,0 +1,224 @@
+#ifndef WORKSPACE_PARALLEL_H_
+#define WORKSPACE_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "workbranch.h"
+#include "workspace.h"
+
+namespace cos {
+namespace workspace {
+
+constexpr std::size_t PARALLEL_CHUNKS_PER_WORKER = 4;
+
+template <typename Q>
+std::size_t Concurrency(BasicWorkBranch<Q>& branch) {
+  return branch.WorkersNum();
+}
+
+inline std::size_t Concurrency(Workspace& space) {
+  std::size_t workers = 0;
+  space.ForEach([&workers](WorkBranch& each) { workers += each.WorkersNum(); });
+  return workers;
+}
+
+// Splits 'num' elements into about PARALLEL_CHUNKS_PER_WORKER chunks per
+// thread (workers plus the caller) when no grain is given.
+inline std::size_t AdaptiveGrain(std::size_t num, std::size_t workers, std::size_t grain) {
+  if (grain > 0) {
+    return grain;
+  }
+  std::size_t chunks = (workers + 1) * PARALLEL_CHUNKS_PER_WORKER;
+  return std::max<std::size_t>(1, (num + chunks - 1) / chunks);
+}
+
+// Chunks of one parallel call are claimed from a shared counter by the
+// caller and by helper tasks, so faster threads simply take more chunks.
+// The caller only waits for its own chunks. Helpers that start after the
+// call returned find nothing left and never touch the caller's stack.
+class ChunkJob {
+ public:
+  ChunkJob(std::size_t chunks, std::function<void(std::size_t)>* body)
+      : chunks_(chunks), body_(body) { }
+
+  // Runs chunks until none is left.
+  void Work() {
+    std::size_t chunk = 0;
+    while ((chunk = next_ ++) < chunks_) {
+      try {
+        (*body_)(chunk);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+      }
+      if (++ done_ == chunks_) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        done_cv_.notify_all();
+      }
+    }
+  }
+
+  // Waits for the chunks claimed by others, then rethrows the first
+  // exception a chunk raised.
+  void Wait() {
+    std::unique_lock<std::mutex> ulk(mtx_);
+    done_cv_.wait(ulk, [this] { return done_ == chunks_; });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  const std::size_t chunks_;
+  std::function<void(std::size_t)>* const body_;
+  std::atomic<std::size_t> next_{0};
+  std::atomic<std::size_t> done_{0};
+  std::exception_ptr error_;
+  std::condition_variable done_cv_;
+  std::mutex mtx_;
+};
+
+struct ChunkHelper {
+  void operator()() { job->Work(); }
+  std::shared_ptr<ChunkJob> job;
+};
+
+// Runs body(0) ... body(chunks - 1) on 'exec' and the calling thread.
+template <typename Executor>
+void RunChunks(Executor& exec, std::size_t chunks, std::function<void(std::size_t)> body) {
+  if (chunks == 0) {
+    return;
+  }
+  std::shared_ptr<ChunkJob> job = std::make_shared<ChunkJob>(chunks, &body);
+  std::size_t helpers = std::min(chunks - 1, Concurrency(exec));
+  if (helpers > 0) {
+    exec.SubmitBulk(std::vector<ChunkHelper>(helpers, ChunkHelper{job}));
+  }
+  job->Work();
+  job->Wait();
+}
+
+// Calls f(i) for every i in [begin, end). Index is an integer or a random
+// access iterator. A grain of 0 picks the chunk size from the workers.
+template <typename Executor, typename Index, typename F>
+void ParallelFor(Executor& exec, Index begin, Index end, std::size_t grain, F f) {
+  if (!(begin < end)) {
+    return;
+  }
+  std::size_t num = end - begin;
+  grain = AdaptiveGrain(num, Concurrency(exec), grain);
+  RunChunks(exec, (num + grain - 1) / grain, [&](std::size_t chunk) {
+    std::size_t last = std::min(num, (chunk + 1) * grain);
+    for (std::size_t i = chunk * grain; i < last; i ++) {
+      f(begin + i);
+    }
+  });
+}
+
+// Folds [begin, end) with 'reduce', which must be associative. Every chunk
+// is folded on its own starting from its first element, and the partial
+// results are folded into 'init' in order.
+template <typename Executor, typename It, typename T, typename Reduce>
+T ParallelReduce(Executor& exec, It begin, It end, std::size_t grain, T init, Reduce reduce) {
+  if (!(begin < end)) {
+    return init;
+  }
+  std::size_t num = std::distance(begin, end);
+  grain = AdaptiveGrain(num, Concurrency(exec), grain);
+  std::size_t chunks = (num + grain - 1) / grain;
+  std::vector<std::unique_ptr<T>> partials(chunks);
+  RunChunks(exec, chunks, [&](std::size_t chunk) {
+    It first = begin + chunk * grain;
+    It last = begin + std::min(num, (chunk + 1) * grain);
+    T partial = *first;
+    for (++ first; first != last; ++ first) {
+      partial = reduce(partial, *first);
+    }
+    partials[chunk].reset(new T(std::move(partial)));
+  });
+  for (auto& partial : partials) {
+    init = reduce(init, *partial);
+  }
+  return init;
+}
+
+// out[i] = f(begin[i]) for every element of [begin, end).
+template <typename Executor, typename It, typename Out, typename F>
+Out ParallelTransform(Executor& exec, It begin, It end, Out out, std::size_t grain, F f) {
+  std::size_t num = std::distance(begin, end);
+  ParallelFor(exec, std::size_t(0), num, grain, [&](std::size_t i) {
+    out[i] = f(begin[i]);
+  });
+  return out + num;
+}
+
+// One round of merge sort: merges neighbouring runs of 'width' elements
+// from 'src' into 'dst', all pairs in parallel.
+template <typename Executor, typename Src, typename Dst, typename Compare>
+void MergePass(Executor& exec, Src src, Dst dst, std::size_t num, std::size_t width, Compare comp) {
+  std::size_t pairs = (num + 2 * width - 1) / (2 * width);
+  ParallelFor(exec, std::size_t(0), pairs, 1, [&](std::size_t pair) {
+    std::size_t lo = pair * 2 * width;
+    std::size_t mid = std::min(num, lo + width);
+    std::size_t hi = std::min(num, lo + 2 * width);
+    std::merge(std::make_move_iterator(src + lo), std::make_move_iterator(src + mid),
+               std::make_move_iterator(src + mid), std::make_move_iterator(src + hi),
+               dst + lo, comp);
+  });
+}
+
+// Merge sort: chunks are sorted in parallel, then merged pairwise, every
+// round of merges running in parallel. The value type must be default
+// constructible and movable.
+template <typename Executor, typename It, typename Compare>
+void ParallelSort(Executor& exec, It begin, It end, std::size_t grain, Compare comp) {
+  using Value = typename std::iterator_traits<It>::value_type;
+  std::size_t num = std::distance(begin, end);
+  if (num < 2) {
+    return;
+  }
+  grain = AdaptiveGrain(num, Concurrency(exec), grain);
+  std::size_t chunks = (num + grain - 1) / grain;
+  ParallelFor(exec, std::size_t(0), chunks, 1, [&](std::size_t chunk) {
+    std::sort(begin + chunk * grain, begin + std::min(num, (chunk + 1) * grain), comp);
+  });
+  if (chunks == 1) {
+    return;
+  }
+
+  std::vector<Value> buffer(num);
+  bool in_buffer = false;     // where the sorted runs are
+  for (std::size_t width = grain; width < num; width *= 2) {
+    if (in_buffer) {
+      MergePass(exec, buffer.begin(), begin, num, width, comp);
+    } else {
+      MergePass(exec, begin, buffer.begin(), num, width, comp);
+    }
+    in_buffer = !in_buffer;
+  }
+  if (in_buffer) {
+    ParallelFor(exec, std::size_t(0), num, grain, [&](std::size_t i) {
+      begin[i] = std::move(buffer[i]);
+    });
+  }
+}
+
+template <typename Executor, typename It>
+void ParallelSort(Executor& exec, It begin, It end, std::size_t grain = 0) {
+  ParallelSort(exec, begin, end, grain, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_PARALLEL_H_
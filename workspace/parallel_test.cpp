@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "parallel.h"
+
+using cos::workspace::BranchOptions;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+using cos::workspace::ParallelFor;
+using cos::workspace::ParallelReduce;
+using cos::workspace::ParallelSort;
+using cos::workspace::ParallelTransform;
+
+TEST(Parallel, for_each_index) {
+  WorkBranch branch(4);
+  std::vector<std::atomic<int>> hits(10007);
+  for (auto& each : hits) {
+    each.store(0);
+  }
+  ParallelFor(branch, 0, (int)hits.size(), 0, [&hits](int i) { hits[i] ++; });
+  for (auto& each : hits) {
+    ASSERT_EQ(each.load(), 1);
+  }
+
+  std::vector<int> values(1000, 1);
+  ParallelFor(branch, values.begin(), values.end(), 7, [](std::vector<int>::iterator it) { *it *= 3; });
+  EXPECT_EQ(std::accumulate(values.begin(), values.end(), 0), 3000);
+}
+
+TEST(Parallel, reduce_and_transform) {
+  WorkBranch branch(3);
+  std::vector<std::int64_t> values(100000);
+  std::iota(values.begin(), values.end(), 1);
+  std::int64_t sum = ParallelReduce(branch, values.begin(), values.end(), 0, std::int64_t(10),
+                                    [](std::int64_t a, std::int64_t b) { return a + b; });
+  EXPECT_EQ(sum, 10 + 100000LL * 100001 / 2);
+
+  std::vector<std::string> words(values.size());
+  ParallelTransform(branch, values.begin(), values.end(), words.begin(), 0,
+                    [](std::int64_t v) { return std::to_string(v); });
+  EXPECT_EQ(words.front(), "1");
+  EXPECT_EQ(words.back(), "100000");
+}
+
+TEST(Parallel, sort) {
+  WorkBranch branch(4);
+  std::uint32_t seed = 42;
+  auto gen = [&seed] { return seed = seed * 1664525u + 1013904223u; };
+  for (std::size_t num : {0, 1, 17, 1000, 100003}) {
+    std::vector<int> values(num);
+    for (auto& v : values) {
+      v = (gen() >> 8) % 1000;
+    }
+    std::vector<int> expected = values;
+    std::sort(expected.begin(), expected.end());
+    ParallelSort(branch, values.begin(), values.end());
+    ASSERT_EQ(values, expected) << num;
+  }
+
+  std::vector<int> values(5000);
+  std::iota(values.begin(), values.end(), 0);
+  ParallelSort(branch, values.begin(), values.end(), 64, std::greater<int>());
+  EXPECT_TRUE(std::is_sorted(values.begin(), values.end(), std::greater<int>()));
+}
+
+TEST(Parallel, nested_in_worker) {
+  // The caller runs chunks itself, so nesting on a single worker is fine.
+  WorkBranch branch(1);
+  auto res = branch.Submit([&branch] {
+    std::atomic<int> count(0);
+    ParallelFor(branch, 0, 1000, 10, [&count](int) { count ++; });
+    return count.load();
+  });
+  EXPECT_EQ(res.get(), 1000);
+}
+
+TEST(Parallel, exception) {
+  WorkBranch branch(2);
+  EXPECT_THROW(ParallelFor(branch, 0, 100, 1, [](int i) {
+    if (i == 50) {
+      throw std::runtime_error("chunk");
+    }
+  }), std::runtime_error);
+}
+
+TEST(Parallel, workspace) {
+  Workspace space;
+  space.Attach(new WorkBranch(2));
+  space.Attach(new WorkBranch(2));
+  std::vector<int> values(50000);
+  std::iota(values.rbegin(), values.rend(), 0);
+  ParallelSort(space, values.begin(), values.end());
+  EXPECT_TRUE(std::is_sorted(values.begin(), values.end()));
+  int max = ParallelReduce(space, values.begin(), values.end(), 0, 0,
+                           [](int a, int b) { return std::max(a, b); });
+  EXPECT_EQ(max, 49999);
+}
+
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
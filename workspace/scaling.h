@@ -0,0 +1,184 @@
+#ifndef WORKSPACE_SCALING_H_
+#define WORKSPACE_SCALING_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace cos {
+namespace workspace {
+
+// What a scaling policy sees of one branch at each tick.
+struct BranchLoad {
+  std::size_t id = 0;           // stable index of the branch in its supervisor
+  std::size_t workers = 0;
+  std::size_t queued = 0;       // tasks waiting to start
+  std::uint64_t run_ns = 0;     // average task run time, 0 if unknown
+  std::uint64_t wait_p99_ns = 0;  // p99 queue wait since the last tick, 0 if unknown
+};
+
+// Decides how many workers a branch wants. The result is clamped to
+// [min_workers, max_workers] and filtered by ScalingGate afterwards, so a
+// policy does not need to care about cooldowns.
+class ScalingPolicy {
+ public:
+  virtual ~ScalingPolicy() = default;
+  virtual std::size_t Target(const BranchLoad& load, std::size_t min_workers,
+                             std::size_t max_workers) = 0;
+};
+
+// The original policy: any queued task brings the branch to the maximum,
+// an empty queue lets it shrink.
+class StepPolicy : public ScalingPolicy {
+ public:
+  std::size_t Target(const BranchLoad& load, std::size_t min_workers,
+                     std::size_t max_workers) override {
+    if (load.queued > 0) {
+      return max_workers;
+    }
+    return load.workers > min_workers ? load.workers - 1 : min_workers;
+  }
+};
+
+// PID controller on the backlog per worker. The error is how far the
+// queued tasks per worker are from 'setpoint'; the output is added to the
+// current number of workers.
+class PidPolicy : public ScalingPolicy {
+ public:
+  explicit PidPolicy(double setpoint = 1.0, double kp = 0.5, double ki = 0.1, double kd = 0.1)
+      : setpoint_(setpoint), kp_(kp), ki_(ki), kd_(kd) { }
+
+  std::size_t Target(const BranchLoad& load, std::size_t min_workers,
+                     std::size_t max_workers) override {
+    if (states_.size() <= load.id) {
+      states_.resize(load.id + 1);
+    }
+    State& state = states_[load.id];
+    double workers = (double)std::max<std::size_t>(1, load.workers);
+    double error = (double)load.queued / workers - setpoint_;
+    double integral = state.integral + error;
+    double output = kp_ * error + ki_ * integral + kd_ * (error - state.error);
+    state.error = error;
+    double target = (double)load.workers + output;
+    // Anti-windup: the integral stops growing while the output saturates.
+    if (target <= (double)min_workers) {
+      state.integral = std::max(state.integral, integral);
+      return min_workers;
+    }
+    if (target >= (double)max_workers) {
+      state.integral = std::min(state.integral, integral);
+      return max_workers;
+    }
+    state.integral = integral;
+    return (std::size_t)(target + 0.5);
+  }
+
+ private:
+  struct State {
+    double integral = 0;
+    double error = 0;
+  };
+
+  double setpoint_, kp_, ki_, kd_;
+  std::vector<State> states_;
+};
+
+// Keeps the queue wait under 'target_ns'. The wait is the larger of the
+// measured p99 and the wait of the last queued task, estimated by Little's
+// law as queued * run time / workers. Above the target the branch grows to
+// what the backlog needs; below half of it the branch shrinks, at most by
+// half; in between it holds.
+class WaitTargetPolicy : public ScalingPolicy {
+ public:
+  explicit WaitTargetPolicy(std::uint64_t target_ns) : target_ns_(target_ns) { }
+
+  std::size_t Target(const BranchLoad& load, std::size_t min_workers,
+                     std::size_t max_workers) override {
+    std::size_t workers = std::max<std::size_t>(1, load.workers);
+    if (load.queued > 0 && load.run_ns == 0) {
+      return std::min(max_workers, load.workers + 1);    // nothing measured yet
+    }
+    double work_ns = (double)load.queued * (double)load.run_ns;
+    double wait_ns = std::max(work_ns / (double)workers, (double)load.wait_p99_ns);
+    std::size_t needed = (std::size_t)(work_ns / (double)target_ns_) + 1;
+    if (wait_ns > (double)target_ns_) {
+      return std::min(max_workers, std::max(needed, load.workers + 1));
+    }
+    if (wait_ns * 2 < (double)target_ns_ && load.workers > min_workers) {
+      return std::max(min_workers, std::max(needed, load.workers / 2));
+    }
+    return std::max(min_workers, load.workers);
+  }
+
+ private:
+  std::uint64_t target_ns_;
+};
+
+// Cooldowns and hysteresis applied on top of every policy, in ticks.
+//  up_cooldown:   ticks to wait after a change before growing again
+//  down_cooldown: ticks to wait after a change before shrinking again
+//  hysteresis:    a shrink must be asked for this many ticks in a row
+// The defaults keep the original behaviour of the supervisor.
+struct ScalingLimits {
+  std::size_t up_cooldown = 0;
+  std::size_t down_cooldown = 0;
+  std::size_t hysteresis = 1;
+};
+
+// Turns policy targets into worker counts, tick by tick, per branch.
+class ScalingGate {
+ public:
+  ScalingGate(std::size_t min_workers, std::size_t max_workers,
+              const ScalingLimits& limits = ScalingLimits())
+      : min_workers_(min_workers), max_workers_(max_workers), limits_(limits) { }
+
+  void SetLimits(const ScalingLimits& limits) {
+    limits_ = limits;
+  }
+
+  // Returns how many workers the branch should have from now on.
+  std::size_t Next(std::size_t id, std::size_t workers, std::size_t target) {
+    if (states_.size() <= id) {
+      states_.resize(id + 1);
+    }
+    State& state = states_[id];
+    state.since_change ++;
+    target = std::max(min_workers_, std::min(max_workers_, target));
+
+    std::size_t next = workers;
+    if (target > workers) {
+      state.shrink_asks = 0;
+      if (state.since_change > limits_.up_cooldown) {
+        next = target;
+      }
+    } else if (target < workers) {
+      state.shrink_asks ++;
+      if (state.shrink_asks >= limits_.hysteresis && state.since_change > limits_.down_cooldown) {
+        next = target;
+      }
+    } else {
+      state.shrink_asks = 0;
+    }
+    if (next != workers) {
+      state.since_change = 0;
+      state.shrink_asks = 0;
+    }
+    return next;
+  }
+
+ private:
+  struct State {
+    std::size_t since_change = SIZE_MAX / 2;
+    std::size_t shrink_asks = 0;
+  };
+
+  std::size_t min_workers_;
+  std::size_t max_workers_;
+  ScalingLimits limits_;
+  std::vector<State> states_;
+};
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_SCALING_H_
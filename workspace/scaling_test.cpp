@@ -0,0 +1,145 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "scaling.h"
+
+using cos::workspace::BranchLoad;
+using cos::workspace::PidPolicy;
+using cos::workspace::ScalingGate;
+using cos::workspace::ScalingLimits;
+using cos::workspace::ScalingPolicy;
+using cos::workspace::StepPolicy;
+using cos::workspace::WaitTargetPolicy;
+
+// Tasks arriving per 100ms tick, recorded from a bursty service: a steady
+// trickle with short spikes and one sustained surge.
+static const std::size_t kTrace[] = {
+  12, 15, 11, 14, 90, 160, 40, 13, 12, 10, 14, 16, 12, 11, 13, 150, 20, 12,
+  15, 14, 11, 12, 60, 70, 80, 90, 95, 90, 85, 70, 50, 30, 15, 12, 13, 14,
+  11, 10, 200, 12, 13, 15, 12, 11, 14, 13, 120, 110, 14, 12, 11, 13, 15, 12,
+  10, 11, 12, 140, 16, 13, 12, 11, 10, 12, 14, 13, 12, 11, 15, 14, 12, 13,
+};
+
+struct SimResult {
+  double thread_seconds = 0;
+  std::size_t violations = 0;    // ticks whose backlog waits over the SLO
+  std::size_t changes = 0;       // ticks that added or removed workers
+};
+
+// A branch whose workers run 10 tasks per tick each. The supervisor looks
+// at the backlog after every tick, as the real one does.
+static SimResult Replay(ScalingPolicy& policy, const ScalingLimits& limits) {
+  const std::size_t min_workers = 1, max_workers = 16;
+  const std::size_t per_worker = 10;
+  const double tick_s = 0.1;
+  const double slo_ticks = 1.0;
+
+  ScalingGate gate(min_workers, max_workers, limits);
+  SimResult result;
+  std::size_t workers = min_workers, queued = 0;
+  for (std::size_t arrivals : kTrace) {
+    queued += arrivals;
+    queued -= std::min(queued, workers * per_worker);
+    result.thread_seconds += workers * tick_s;
+    if ((double)queued / (double)(workers * per_worker) > slo_ticks) {
+      result.violations ++;
+    }
+
+    BranchLoad load;
+    load.workers = workers;
+    load.queued = queued;
+    load.run_ns = 10000000;    // 100ms / 10 tasks
+    std::size_t next = gate.Next(0, workers, policy.Target(load, min_workers, max_workers));
+    result.changes += next != workers ? 1 : 0;
+    workers = next;
+  }
+  return result;
+}
+
+TEST(Scaling, gate_cooldown_and_hysteresis) {
+  ScalingLimits limits;
+  limits.up_cooldown = 2;
+  limits.down_cooldown = 3;
+  limits.hysteresis = 2;
+  ScalingGate gate(1, 8, limits);
+
+  EXPECT_EQ(gate.Next(0, 1, 4), 4);     // first change is free
+  EXPECT_EQ(gate.Next(0, 4, 6), 4);     // up cooldown
+  EXPECT_EQ(gate.Next(0, 4, 6), 4);
+  EXPECT_EQ(gate.Next(0, 4, 6), 6);
+  EXPECT_EQ(gate.Next(0, 6, 2), 6);     // down cooldown and hysteresis
+  EXPECT_EQ(gate.Next(0, 6, 2), 6);
+  EXPECT_EQ(gate.Next(0, 6, 6), 6);     // a steady tick resets the count
+  EXPECT_EQ(gate.Next(0, 6, 2), 6);
+  EXPECT_EQ(gate.Next(0, 6, 2), 2);
+  EXPECT_EQ(gate.Next(0, 2, 100), 2);   // clamped, and still cooling down
+  EXPECT_EQ(gate.Next(1, 2, 100), 8);   // branches are independent
+}
+
+TEST(Scaling, policies) {
+  StepPolicy step;
+  BranchLoad load;
+  load.workers = 3;
+  load.queued = 1;
+  EXPECT_EQ(step.Target(load, 1, 8), 8);
+  load.queued = 0;
+  EXPECT_EQ(step.Target(load, 1, 8), 2);
+
+  // 40 tasks of 10ms on 2 workers wait 200ms.
+  WaitTargetPolicy wait(100000000);
+  load.workers = 2;
+  load.queued = 40;
+  load.run_ns = 10000000;
+  EXPECT_EQ(wait.Target(load, 1, 8), 5);
+  load.queued = 12;                            // 60ms: hold
+  EXPECT_EQ(wait.Target(load, 1, 8), 2);
+  load.queued = 4;                             // 20ms: shrink
+  EXPECT_EQ(wait.Target(load, 1, 8), 1);
+  load.wait_p99_ns = 150000000;                // but measured waits are long
+  EXPECT_EQ(wait.Target(load, 1, 8), 3);
+
+  PidPolicy pid;
+  load.workers = 2;
+  load.queued = 20;
+  EXPECT_GT(pid.Target(load, 1, 8), 2);
+  load.id = 1;
+  load.queued = 0;
+  EXPECT_EQ(pid.Target(load, 1, 8), 1);
+}
+
+TEST(Scaling, replay_trace) {
+  ScalingLimits original;
+  ScalingLimits damped;
+  damped.up_cooldown = 0;
+  damped.down_cooldown = 3;
+  damped.hysteresis = 2;
+
+  StepPolicy step;
+  PidPolicy pid;
+  WaitTargetPolicy wait(50000000);
+  SimResult step_res = Replay(step, original);
+  SimResult pid_res = Replay(pid, damped);
+  SimResult wait_res = Replay(wait, damped);
+
+  auto report = [](const char* name, const SimResult& res) {
+    std::cout << name << " thread-seconds " << res.thread_seconds
+              << ", SLO violations " << res.violations
+              << ", scaling changes " << res.changes << std::endl;
+  };
+  report("step       ", step_res);
+  report("pid        ", pid_res);
+  report("wait target", wait_res);
+
+  EXPECT_LT(pid_res.thread_seconds, step_res.thread_seconds);
+  EXPECT_LT(wait_res.thread_seconds, step_res.thread_seconds);
+  EXPECT_LT(pid_res.changes, step_res.changes);
+  EXPECT_LT(wait_res.changes, step_res.changes);
+  EXPECT_LE(wait_res.violations, step_res.violations + 2);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,195 @@
+#ifndef WORKSPACE_STRAND_H_
+#define WORKSPACE_STRAND_H_
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/unique_task.h"
+
+namespace cos {
+namespace workspace {
+
+constexpr std::size_t STRAND_SHARDS = 64;
+constexpr std::size_t STRAND_BATCH = 32;    // tasks a strand runs per turn
+
+// Runs the tasks of one key in submission order, one at a time, and the
+// tasks of different keys in parallel on an executor, a WorkBranch or a
+// Workspace. A key with queued tasks has a strand, which is scheduled on
+// the executor as one task and runs up to STRAND_BATCH of them per turn;
+// a key without is forgotten. Keys are spread over sharded locks.
+//
+// If the executor rejects the first turn of a key, e.g. a full bounded
+// branch, Submit() returns false and destroys the task; tasks queued behind
+// it meanwhile run on the caller. A rejected later turn keeps running on
+// its thread. A turn dropped once queued, e.g. by drop_oldest or with its
+// branch, destroys the tasks of its key unrun.
+template <typename Executor>
+class StrandTable {
+ public:
+  using Task = cos::base::UniqueTask;
+
+  explicit StrandTable(Executor& exec) : exec_(exec) { }
+
+  StrandTable(const StrandTable&) = delete;
+  StrandTable& operator=(const StrandTable&) = delete;
+
+  ~StrandTable() {
+    for (Shard& shard : shards_) {
+      for (auto& each : shard.strands) {
+        delete each.second;
+      }
+    }
+  }
+
+  // False if the executor rejected the task.
+  bool Submit(std::uint64_t key, Task&& task) {
+    Shard& shard = shard_of(key);
+    Strand* fresh = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(shard.mtx);
+      Strand*& strand = shard.strands[key];
+      if (strand == nullptr) {
+        strand = fresh = new Strand();
+      }
+      strand->tasks.push_back(std::move(task));
+    }
+    if (fresh == nullptr || offer(key, fresh)) {
+      return true;
+    }
+    // Nothing of the fresh strand ran, its first task is ours.
+    {
+      Task rejected;
+      std::lock_guard<std::mutex> lock(shard.mtx);
+      rejected = std::move(fresh->tasks[fresh->head ++]);
+    }
+    run(key, fresh);
+    return false;
+  }
+
+  // Keys with queued or running tasks.
+  std::size_t Active() {
+    std::size_t num = 0;
+    for (Shard& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mtx);
+      num += shard.strands.size();
+    }
+    return num;
+  }
+
+ private:
+  // Tasks of one key, popped from 'head'.
+  struct Strand {
+    std::vector<Task> tasks;
+    std::size_t head = 0;
+  };
+
+  struct Shard {
+    std::mutex mtx;
+    std::unordered_map<std::uint64_t, Strand*> strands;
+  };
+
+  // One turn of a strand on the executor. Destroyed unrun, it drops the
+  // strand, unless it is being offered: then the offerer keeps it.
+  struct Turn {
+    Turn(StrandTable* t, std::uint64_t k, Strand* s) : table(t), key(k), strand(s) { }
+    Turn(Turn&& other) noexcept : table(other.table), key(other.key), strand(other.strand) {
+      other.strand = nullptr;
+    }
+    ~Turn() {
+      if (strand != nullptr && strand != offering()) {
+        table->drop(key, strand);
+      }
+    }
+    void operator()() {
+      Strand* own = strand;
+      strand = nullptr;
+      table->run(key, own);
+    }
+    StrandTable* table;
+    std::uint64_t key;
+    Strand* strand;
+  };
+  static_assert(Task::is_inline<Turn>(), "a turn must not allocate");
+
+  // Keys are mixed, so that sequential ids spread over the shards.
+  Shard& shard_of(std::uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return shards_[key % STRAND_SHARDS];
+  }
+
+  // The strand whose turn this thread is submitting.
+  static Strand*& offering() {
+    static thread_local Strand* strand = nullptr;
+    return strand;
+  }
+
+  // Takes the executor's Admission without depending on its header.
+  template <typename Admission>
+  static bool accepted(Admission admission) {
+    return admission == Admission::accepted;
+  }
+
+  // Submits a turn of 'strand'. If rejected, the caller still owns it.
+  // A yield goes through TrySubmitNow, so that a full branch never runs
+  // the turn on the caller, one stack frame deeper each time.
+  bool offer(std::uint64_t key, Strand* strand, bool yield = false) {
+    Strand* outer = offering();
+    offering() = strand;
+    bool ok = yield ? accepted(exec_.TrySubmitNow(Turn(this, key, strand)))
+                    : accepted(exec_.TrySubmit(Turn(this, key, strand)));
+    offering() = outer;
+    return ok;
+  }
+
+  void run(std::uint64_t key, Strand* strand) {
+    Shard& shard = shard_of(key);
+    do {
+      if (!run_batch(shard, key, strand)) {
+        return;
+      }
+      // Yield to the other keys, or go on here if the executor is full.
+    } while (!offer(key, strand, true));
+  }
+
+  // Runs up to STRAND_BATCH tasks, false once the strand is done.
+  bool run_batch(Shard& shard, std::uint64_t key, Strand* strand) {
+    for (std::size_t i = 0; i < STRAND_BATCH; i ++) {
+      Task task;
+      {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (strand->head == strand->tasks.size()) {
+          shard.strands.erase(key);
+          delete strand;
+          return false;
+        }
+        task = std::move(strand->tasks[strand->head ++]);
+        if (strand->head == strand->tasks.size()) {
+          strand->tasks.clear();
+          strand->head = 0;
+        }
+      }
+      task();
+    }
+    return true;
+  }
+
+  void drop(std::uint64_t key, Strand* strand) {
+    Shard& shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.strands.erase(key);
+    delete strand;
+  }
+
+  Executor& exec_;
+  Shard shards_[STRAND_SHARDS];
+};
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_STRAND_H_
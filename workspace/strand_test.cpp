@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "strand.h"
+#include "workspace.h"
+
+using cos::workspace::BranchOptions;
+using cos::workspace::StrandTable;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+
+// Per key: the next index expected and whether a task of it is running.
+struct KeyCheck {
+  int next = 0;
+  std::atomic<bool> running{false};
+  std::atomic<int> errors{0};
+
+  void Run(int index) {
+    if (running.exchange(true)) {
+      errors ++;
+    }
+    if (index != next) {
+      errors ++;
+    }
+    next ++;
+    std::this_thread::yield();
+    running = false;
+  }
+};
+
+TEST(Strand, order_per_key) {
+  const int keys = 16, per_key = 500;
+  WorkBranch br(4);
+  StrandTable<WorkBranch> table(br);
+  std::vector<KeyCheck> checks(keys);
+  for (int i = 0; i < per_key; i ++) {
+    for (int k = 0; k < keys; k ++) {
+      KeyCheck* check = &checks[k];
+      table.Submit(k, [check, i] { check->Run(i); });
+    }
+  }
+  br.WaitIdle();
+  for (auto& check : checks) {
+    EXPECT_EQ(check.next, per_key);
+    EXPECT_EQ(check.errors, 0);
+  }
+  EXPECT_EQ(table.Active(), 0);     // idle keys are forgotten
+}
+
+TEST(Strand, keys_run_in_parallel) {
+  WorkBranch br(2);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.SubmitKeyed(1, [opened] { opened.wait(); });
+  auto after = br.SubmitKeyed(1, [] { return 1; });
+  auto other = br.SubmitKeyed(2, [] { return 2; });
+  EXPECT_EQ(other.get(), 2);
+  EXPECT_EQ(after.wait_for(std::chrono::milliseconds(10)), std::future_status::timeout);
+  gate.set_value();
+  EXPECT_EQ(after.get(), 1);
+  EXPECT_EQ(br.SubmitKeyed(std::string("account"), [] { return 3; }).get(), 3);
+}
+
+TEST(Strand, workspace) {
+  const int keys = 8, per_key = 200;
+  Workspace space;
+  space.Attach(new WorkBranch(2));
+  space.Attach(new WorkBranch(2));
+  std::vector<KeyCheck> checks(keys);
+  std::vector<std::future<int>> lasts;
+  for (int i = 0; i < per_key; i ++) {
+    for (int k = 0; k < keys; k ++) {
+      KeyCheck* check = &checks[k];
+      space.SubmitKeyed(k, [check, i] { check->Run(i); });
+    }
+  }
+  for (int k = 0; k < keys; k ++) {
+    lasts.push_back(space.SubmitKeyed(k, [] { return 0; }));
+  }
+  for (auto& last : lasts) {
+    last.get();
+  }
+  for (auto& check : checks) {
+    EXPECT_EQ(check.next, per_key);
+    EXPECT_EQ(check.errors, 0);
+  }
+}
+
+TEST(Strand, rejected_strand) {
+  BranchOptions options;
+  options.capacity = 1;
+  options.overflow = cos::workspace::Overflow::reject;
+  WorkBranch br(1, options);
+  std::promise<void> gate, started;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened, &started] {
+    started.set_value();
+    opened.wait();
+  });
+  started.get_future().wait();
+  br.Submit([] {});
+  StrandTable<WorkBranch> table(br);
+  bool ran = false;
+  EXPECT_FALSE(table.Submit(7, [&ran] { ran = true; }));
+  EXPECT_FALSE(ran);
+  EXPECT_EQ(table.Active(), 0);
+  EXPECT_FALSE(br.SubmitKeyed(7, [] {}));
+  auto lost = br.SubmitKeyed(7, [] { return 1; });
+  EXPECT_THROW(lost.get(), std::future_error);
+  gate.set_value();
+  br.WaitIdle();
+
+  // With room again the key is accepted.
+  std::atomic<bool> later(false);
+  EXPECT_TRUE(table.Submit(7, [&later] { later = true; }));
+  br.WaitIdle();
+  EXPECT_TRUE(later);
+  EXPECT_EQ(table.Active(), 0);
+}
+
+// A key run on the caller of a full caller_runs branch keeps going in a
+// loop there, its yields do not nest.
+TEST(Strand, caller_runs_hot_key) {
+  BranchOptions options;
+  options.capacity = 1;
+  options.overflow = cos::workspace::Overflow::caller_runs;
+  WorkBranch br(1, options);
+  std::promise<void> gate, started;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened, &started] {
+    started.set_value();
+    opened.wait();
+  });
+  started.get_future().wait();
+  br.Submit([] {});         // fills the queue
+
+  const int num = 20000;
+  StrandTable<WorkBranch> table(br);
+  KeyCheck check;
+  std::uintptr_t low = UINTPTR_MAX, high = 0;
+  auto probe = [&low, &high] {
+    char here = 0;
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(&here);
+    low = std::min(low, addr);
+    high = std::max(high, addr);
+  };
+  EXPECT_TRUE(table.Submit(1, [&table, &check, &probe, num] {
+    check.Run(0);
+    for (int i = 1; i < num; i ++) {
+      table.Submit(1, [&check, &probe, i] {
+        probe();
+        check.Run(i);
+      });
+    }
+  }));
+  EXPECT_EQ(check.next, num);       // all ran on this thread
+  EXPECT_EQ(check.errors, 0);
+  EXPECT_LT(high - low, 64u * 1024);
+  gate.set_value();
+  br.WaitIdle();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -4,9 +4,11 @@
 #include <assert.h>
 #include <condition_variable>
 #include <chrono>
+#include <memory>
 #include <vector>
 #include <mutex>
 
+#include "scaling.h"
 #include "workbranch.h"
 #include "base/autothread.h"
 
@@ -28,6 +30,8 @@ class Supervisor {
         max_workers_num_(max_workers),
         time_inervals_(intervals),
         kTimeInervals(intervals),
+        policy_(new StepPolicy()),
+        gate_(min_workers, max_workers),
         worker_(std::thread(&Supervisor::Process, this)){
     // The validity of the input is guaranteed by the user
     assert(0 < min_workers_num_ && min_workers_num_ <= max_workers_num_);
@@ -63,6 +67,18 @@ class Supervisor {
     tick_callback_ = func;
   }
 
+  // Replaces the policy for every supervised branch; StepPolicy by default.
+  void SetScalingPolicy(std::unique_ptr<ScalingPolicy> policy) {
+    assert(policy != nullptr);
+    std::lock_guard<std::mutex> lock(mtx_);
+    policy_ = std::move(policy);
+  }
+
+  void SetScalingLimits(const ScalingLimits& limits) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    gate_.SetLimits(limits);
+  }
+
  private:
   void Process() {
     while (!is_stop_) {
@@ -70,19 +86,20 @@ class Supervisor {
         std::unique_lock<std::mutex> ulk(mtx_);
         for (std::size_t i = 0; i < branches_vec_.size(); i ++) {
           WorkBranch* branch = branches_vec_[i];
-          std::size_t works_num = branch->WorkersNum();
-          std::size_t tasks_num = branch->TasksNum();
-          if (tasks_num > 0) {
-            if (works_num < max_workers_num_) {
-              // TODO(leisy): Modify the policy of Add operation.
-              for (std::size_t i = 0; i < max_workers_num_ - works_num; i ++) {
-                branch->AddWorker();   // quikly - add
-              }
-            }
-          } else {
-            if (min_workers_num_ < works_num) {
-              branch->RemoveWorker();  // slowly - remove
-            }
+          LoadHint hint = branch->Hint();
+          BranchLoad load;
+          load.id = i;
+          load.workers = branch->WorkersNum();
+          load.queued = hint.queued;
+          load.run_ns = hint.run_ns;
+          load.wait_p99_ns = recent_wait_p99(i, branch->Snapshot());
+          std::size_t target = policy_->Target(load, min_workers_num_, max_workers_num_);
+          std::size_t next = gate_.Next(i, load.workers, target);
+          for (std::size_t n = load.workers; n < next; n ++) {
+            branch->AddWorker();
+          }
+          for (std::size_t n = next; n < load.workers; n ++) {
+            branch->RemoveWorker();
           }
         }
        
@@ -94,9 +111,20 @@ class Supervisor {
     }
   }
   
+  // p99 of the queue waits since the previous tick.
+  std::uint64_t recent_wait_p99(std::size_t i, const BranchSnapshot& snap) {
+    if (last_waits_.size() <= i) {
+      last_waits_.resize(i + 1);
+    }
+    std::uint64_t p99 = snap.wait_ns.Since(last_waits_[i]).Percentile(0.99);
+    last_waits_[i] = snap.wait_ns;
+    return p99;
+  }
+
   // It should be ensured that the WorkBranch is destroyed 
   // before the Supervisor
   std::vector<WorkBranch*> branches_vec_;
+  std::vector<cos::base::Histogram> last_waits_;
 
   CallbackFunc tick_callback_ = ([]{});
   bool is_stop_ = false;
@@ -105,10 +133,12 @@ class Supervisor {
   std::size_t max_workers_num_;
   std::size_t time_inervals_;
   const std::size_t kTimeInervals;
-  AutoThread<cos::base::join> worker_; 
-  
+  std::unique_ptr<ScalingPolicy> policy_;
+  ScalingGate gate_;
+
   std::condition_variable tick_cv_;
   std::mutex mtx_;
+  AutoThread<cos::base::join> worker_;    // Last, it uses the members above
 };
 
 }  // namespace workspace
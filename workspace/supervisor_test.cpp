@@ -1,4 +1,6 @@
 
+#include <atomic>
+#include <memory>
 #include <thread>
 
 #include "gtest/gtest.h"
@@ -7,6 +9,9 @@
 
 using cos::workspace::WorkBranch;
 using cos::workspace::Supervisor;
+using cos::workspace::BranchLoad;
+using cos::workspace::ScalingLimits;
+using cos::workspace::ScalingPolicy;
 
 TEST(Supervisor, supervise) {
     WorkBranch br1(2);
@@ -38,6 +43,30 @@ TEST(Supervisor, supervise) {
     br2.WaitTasks();
 }
 
+// Wants 3 workers, and counts its ticks.
+struct FixedPolicy : ScalingPolicy {
+  explicit FixedPolicy(std::atomic<int>* ticks) : ticks(ticks) { }
+  std::size_t Target(const BranchLoad&, std::size_t, std::size_t) override {
+    (*ticks) ++;
+    return 3;
+  }
+  std::atomic<int>* ticks;
+};
+
+TEST(Supervisor, scaling_policy) {
+    WorkBranch br(1);
+    std::atomic<int> ticks(0);
+    Supervisor sp(1, 8, 10);
+    sp.SetScalingPolicy(std::unique_ptr<ScalingPolicy>(new FixedPolicy(&ticks)));
+    ScalingLimits limits;
+    limits.up_cooldown = 2;
+    sp.SetScalingLimits(limits);
+    sp.Supervise(br);
+    while (ticks < 5) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(br.WorkersNum(), 3);
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,233 @@
+#ifndef WORKSPACE_TASK_GRAPH_H_
+#define WORKSPACE_TASK_GRAPH_H_
+
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "base/unique_task.h"
+
+namespace cos {
+namespace workspace {
+
+// A reusable DAG of tasks. Nodes are added with Emplace() and ordered with
+// Precede(); Run() submits every node whose predecessors are done to a
+// WorkBranch or a Workspace, and Wait() blocks until the whole graph is done.
+//
+// Each node counts its unfinished predecessors. The worker finishing the
+// last predecessor of a node submits it, or runs it itself if it is the
+// first node it released, so no worker ever blocks on another. After the
+// first run, running the graph again allocates nothing.
+//
+// Nodes may be move-only callables. If a node throws, or is rejected by a
+// bounded branch, the nodes after it are skipped and Wait() rethrows.
+class TaskGraph {
+ public:
+  using NodeId = std::size_t;
+
+  TaskGraph() = default;
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  ~TaskGraph() {
+    std::unique_lock<std::mutex> ulk(mtx_);
+    done_cv_.wait(ulk, [this] { return !running_; });
+  }
+
+  template <typename F>
+  NodeId Emplace(F&& func) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    assert(!running_);
+    nodes_.emplace_back(new Node(std::forward<F>(func)));
+    checked_ = false;
+    return nodes_.size() - 1;
+  }
+
+  // 'after' starts once 'before' has finished.
+  void Precede(NodeId before, NodeId after) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    assert(!running_ && before < nodes_.size() && after < nodes_.size());
+    nodes_[before]->successors.push_back(after);
+    nodes_[after]->predecessors ++;
+    checked_ = false;
+  }
+
+  std::size_t Size() const {
+    return nodes_.size();
+  }
+
+  // Waits for the previous run if any. Throws std::invalid_argument if the
+  // graph has a cycle.
+  template <typename Executor>
+  void Run(Executor& exec) {
+    std::unique_lock<std::mutex> ulk(mtx_);
+    done_cv_.wait(ulk, [this] { return !running_; });
+    if (!checked_) {
+      check();
+    }
+    if (nodes_.empty()) {
+      return;
+    }
+    for (auto& node : nodes_) {
+      node->pending.store(node->predecessors, std::memory_order_relaxed);
+    }
+    remaining_.store(nodes_.size(), std::memory_order_relaxed);
+    failed_.store(false, std::memory_order_relaxed);
+    error_ = nullptr;
+    exec_ = &exec;
+    submit_ = &submit_to<Executor>;
+    running_ = true;
+    ulk.unlock();
+
+    for (NodeId id : sources_) {
+      submit_(exec_, this, id);
+    }
+  }
+
+  // Rethrows the first exception of the last run.
+  void Wait() {
+    std::unique_lock<std::mutex> ulk(mtx_);
+    done_cv_.wait(ulk, [this] { return !running_; });
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+ private:
+  static constexpr NodeId NONE = static_cast<NodeId>(-1);
+
+  struct Node {
+    template <typename F>
+    explicit Node(F&& fn) : func(std::forward<F>(fn)) { }
+    cos::base::UniqueTask func;       // move-only, may run once per Run()
+    std::vector<NodeId> successors;
+    std::size_t predecessors = 0;
+    std::atomic<std::size_t> pending{0};
+  };
+
+  // What runs on the executor, small enough to be stored inline. A node
+  // destroyed unrun, e.g. rejected by a bounded branch, fails the run and
+  // is finished like one that threw, so Wait() does not hang.
+  struct NodeTask {
+    NodeTask(TaskGraph* g, NodeId i) : graph(g), id(i) { }
+    NodeTask(NodeTask&& other) noexcept : graph(other.graph), id(other.id) {
+      other.graph = nullptr;
+    }
+    NodeTask(const NodeTask&) = delete;
+    ~NodeTask() {
+      if (graph != nullptr) {
+        graph->fail(std::make_exception_ptr(std::runtime_error("node rejected")));
+        graph->execute(id);
+      }
+    }
+    void operator()() {
+      TaskGraph* g = graph;
+      graph = nullptr;
+      g->execute(id);
+    }
+    TaskGraph* graph;
+    NodeId id;
+  };
+
+  template <typename Executor>
+  static void submit_to(void* exec, TaskGraph* graph, NodeId id) {
+    static_cast<Executor*>(exec)->Submit(NodeTask(graph, id));
+  }
+
+  // Kahn's algorithm, called with 'mtx_' held.
+  void check() {
+    sources_.clear();
+    std::vector<std::size_t> degrees(nodes_.size());
+    std::vector<NodeId> ready;
+    for (NodeId id = 0; id < nodes_.size(); id ++) {
+      degrees[id] = nodes_[id]->predecessors;
+      if (degrees[id] == 0) {
+        sources_.push_back(id);
+        ready.push_back(id);
+      }
+    }
+    std::size_t visited = 0;
+    while (!ready.empty()) {
+      NodeId id = ready.back();
+      ready.pop_back();
+      visited ++;
+      for (NodeId next : nodes_[id]->successors) {
+        if (-- degrees[next] == 0) {
+          ready.push_back(next);
+        }
+      }
+    }
+    if (visited != nodes_.size()) {
+      throw std::invalid_argument("TaskGraph has a cycle");
+    }
+    checked_ = true;
+  }
+
+  void execute(NodeId id) {
+    while (id != NONE) {
+      Node& node = *nodes_[id];
+      if (!failed_.load(std::memory_order_relaxed)) {
+        try {
+          node.func();
+        } catch (...) {
+          fail(std::current_exception());
+        }
+      }
+      NodeId next = NONE;
+      for (NodeId succ : node.successors) {
+        if (nodes_[succ]->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          if (next == NONE) {
+            next = succ;     // run here, saves a trip through the queue
+          } else {
+            submit_(exec_, this, succ);
+          }
+        }
+      }
+      finish_one();
+      id = next;
+    }
+  }
+
+  void fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!error_) {
+      error_ = error;
+    }
+    failed_.store(true, std::memory_order_relaxed);
+  }
+
+  // The graph may be destroyed as soon as the last node is counted.
+  void finish_one() {
+    if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      running_ = false;
+      done_cv_.notify_all();
+    }
+  }
+
+  std::vector<std::unique_ptr<Node>> nodes_;
+  std::vector<NodeId> sources_;
+  bool checked_ = false;
+
+  bool running_ = false;
+  std::atomic<std::size_t> remaining_{0};
+  std::atomic<bool> failed_{false};
+  std::exception_ptr error_;
+  void* exec_ = nullptr;
+  void (*submit_)(void*, TaskGraph*, NodeId) = nullptr;
+
+  std::condition_variable done_cv_;
+  std::mutex mtx_;
+};
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_TASK_GRAPH_H_
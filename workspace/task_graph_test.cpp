@@ -0,0 +1,239 @@
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "task_graph.h"
+#include "workbranch.h"
+#include "workspace.h"
+
+using cos::workspace::BasicWorkBranch;
+using cos::workspace::LockFreeQueue;
+using cos::workspace::TaskGraph;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size) {
+  allocations ++;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+// Records the order in which nodes ran.
+struct Trace {
+  void Add(int id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    order.push_back(id);
+  }
+  std::size_t Position(int id) {
+    for (std::size_t i = 0; i < order.size(); i ++) {
+      if (order[i] == id) {
+        return i;
+      }
+    }
+    return order.size();
+  }
+  std::vector<int> order;
+  std::mutex mtx;
+};
+
+TEST(TaskGraph, diamond) {
+  WorkBranch br(2);
+  Trace trace;
+  TaskGraph graph;
+  auto a = graph.Emplace([&trace] { trace.Add(0); });
+  auto b = graph.Emplace([&trace] { trace.Add(1); });
+  auto c = graph.Emplace([&trace] { trace.Add(2); });
+  auto d = graph.Emplace([&trace] { trace.Add(3); });
+  graph.Precede(a, b);
+  graph.Precede(a, c);
+  graph.Precede(b, d);
+  graph.Precede(c, d);
+  graph.Run(br);
+  graph.Wait();
+
+  ASSERT_EQ(trace.order.size(), 4);
+  EXPECT_EQ(trace.Position(0), 0);
+  EXPECT_EQ(trace.Position(3), 3);
+}
+
+// Nodes own move-only state, and run it again on every Run().
+TEST(TaskGraph, move_only_node) {
+  struct Counter {
+    std::unique_ptr<int> count;
+    void operator()() const { (*count) ++; }
+  };
+  WorkBranch br(1);
+  std::unique_ptr<int> count(new int(0));
+  int* seen = count.get();
+  TaskGraph graph;
+  auto a = graph.Emplace(Counter{std::move(count)});
+  auto b = graph.Emplace([seen] { (*seen) *= 10; });
+  graph.Precede(a, b);
+  for (int i = 0; i < 2; i ++) {
+    graph.Run(br);
+    graph.Wait();
+  }
+  EXPECT_EQ(*seen, 110);
+}
+
+TEST(TaskGraph, fan_in_tree_on_one_worker) {
+  // Blocking on futures would deadlock a single worker, the graph does not.
+  WorkBranch br(1);
+  std::atomic<int> leaves(0);
+  std::atomic<int> root_saw(-1);
+  TaskGraph graph;
+  auto root = graph.Emplace([&leaves, &root_saw] { root_saw = leaves.load(); });
+  for (int i = 0; i < 4; i ++) {
+    auto mid = graph.Emplace([] {});
+    graph.Precede(mid, root);
+    for (int j = 0; j < 8; j ++) {
+      graph.Precede(graph.Emplace([&leaves] { leaves ++; }), mid);
+    }
+  }
+  graph.Run(br);
+  graph.Wait();
+  EXPECT_EQ(root_saw, 32);
+}
+
+TEST(TaskGraph, reuse_without_allocation) {
+  BasicWorkBranch<LockFreeQueue> br(2);
+  std::atomic<int> count(0);
+  TaskGraph graph;
+  std::vector<TaskGraph::NodeId> layer;
+  for (int i = 0; i < 8; i ++) {
+    layer.push_back(graph.Emplace([&count] { count ++; }));
+  }
+  auto join = graph.Emplace([&count] { count ++; });
+  for (auto id : layer) {
+    graph.Precede(id, join);
+  }
+  graph.Run(br);
+  graph.Wait();
+  EXPECT_EQ(count, 9);
+
+  // Both workers must have started, a late one allocates its own slot.
+  std::atomic<int> started(0);
+  std::vector<std::future<int>> rendezvous;
+  for (int i = 0; i < 2; i ++) {
+    rendezvous.push_back(br.Submit([&started] {
+      started ++;
+      while (started < 2) {
+        std::this_thread::yield();
+      }
+      return 0;
+    }));
+  }
+  for (auto& future : rendezvous) {
+    future.get();
+  }
+
+  std::size_t before = allocations.load();
+  for (int i = 0; i < 100; i ++) {
+    graph.Run(br);
+    graph.Wait();
+  }
+  std::size_t used = allocations.load() - before;
+  EXPECT_EQ(used, 0);
+  EXPECT_EQ(count, 909);
+}
+
+TEST(TaskGraph, workspace) {
+  Workspace space;
+  space.Attach(new WorkBranch(1));
+  space.Attach(new WorkBranch(2));
+  std::atomic<int> sum(0);
+  TaskGraph graph;
+  auto prev = graph.Emplace([&sum] { sum ++; });
+  for (int i = 0; i < 50; i ++) {
+    auto left = graph.Emplace([&sum] { sum ++; });
+    auto right = graph.Emplace([&sum] { sum ++; });
+    auto next = graph.Emplace([&sum] { sum ++; });
+    graph.Precede(prev, left);
+    graph.Precede(prev, right);
+    graph.Precede(left, next);
+    graph.Precede(right, next);
+    prev = next;
+  }
+  graph.Run(space);
+  graph.Wait();
+  EXPECT_EQ(sum, 151);
+}
+
+TEST(TaskGraph, errors) {
+  WorkBranch br(2);
+  std::atomic<bool> skipped(true);
+  TaskGraph graph;
+  auto a = graph.Emplace([] { throw std::runtime_error("boom"); });
+  auto b = graph.Emplace([&skipped] { skipped = false; });
+  graph.Precede(a, b);
+  graph.Run(br);
+  EXPECT_THROW(graph.Wait(), std::runtime_error);
+  EXPECT_TRUE(skipped);
+
+  TaskGraph cycle;
+  auto x = cycle.Emplace([] {});
+  auto y = cycle.Emplace([] {});
+  cycle.Precede(x, y);
+  cycle.Precede(y, x);
+  EXPECT_THROW(cycle.Run(br), std::invalid_argument);
+
+  TaskGraph empty;
+  empty.Run(br);
+  empty.Wait();
+}
+
+TEST(TaskGraph, rejected_node) {
+  cos::workspace::BranchOptions options;
+  options.capacity = 1;
+  options.overflow = cos::workspace::Overflow::reject;
+  WorkBranch br(1, options);
+  std::promise<void> gate, started;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened, &started] {
+    started.set_value();
+    opened.wait();
+  });
+  started.get_future().wait();
+  br.Submit([] {});         // fills the queue
+
+  std::atomic<bool> skipped(true);
+  TaskGraph graph;
+  auto a = graph.Emplace([] {});
+  auto b = graph.Emplace([&skipped] { skipped = false; });
+  graph.Precede(a, b);
+  graph.Run(br);
+  EXPECT_THROW(graph.Wait(), std::runtime_error);
+  EXPECT_TRUE(skipped);
+  gate.set_value();
+
+  // The graph can run again once there is room.
+  br.WaitIdle();
+  graph.Run(br);
+  graph.Wait();
+  EXPECT_FALSE(skipped);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
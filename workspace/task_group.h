@@ -0,0 +1,110 @@
+#ifndef WORKSPACE_TASK_GROUP_H_
+#define WORKSPACE_TASK_GROUP_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "base/utility.h"
+
+namespace cos {
+namespace workspace {
+
+// Waits for a set of tasks only, whatever else their executor runs. Tasks
+// submitted through the group count until they return or throw; Add() and
+// Done() count other work, like a latch. The destructor waits for the
+// group.
+class TaskGroup {
+  template <typename F>
+  struct Member;
+
+ public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  ~TaskGroup() {
+    Wait();
+  }
+
+  // Submits 'task' to a WorkBranch or a Workspace, with the tag 'T'.
+  // Returns what the executor's Submit() does.
+  template <typename T = cos::base::normal, typename Executor, typename F>
+  auto Submit(Executor& exec, F&& task)
+      -> decltype(exec.template Submit<T>(std::declval<Member<typename std::decay<F>::type>>())) {
+    Add(1);
+    return exec.template Submit<T>(Member<typename std::decay<F>::type>(this, std::forward<F>(task)));
+  }
+
+  void Add(std::size_t num) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    pending_ += num;
+  }
+
+  void Done() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (-- pending_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> ulk(mtx_);
+    done_cv_.wait(ulk, [this] { return pending_ == 0; });
+  }
+
+  // False on timeout.
+  template <typename Rep, typename Period>
+  bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) {
+    std::unique_lock<std::mutex> ulk(mtx_);
+    return done_cv_.wait_for(ulk, timeout, [this] { return pending_ == 0; });
+  }
+
+  std::size_t Pending() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return pending_;
+  }
+
+ private:
+  // Calls Done() however the task ends.
+  struct Leave {
+    ~Leave() { group->Done(); }
+    TaskGroup* group;
+  };
+
+  // A member destroyed unrun, e.g. rejected by a bounded branch, is done
+  // too.
+  template <typename F>
+  struct Member {
+    template <typename Fn>
+    Member(TaskGroup* g, Fn&& fn) : group(g), func(std::forward<Fn>(fn)) { }
+    Member(Member&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+        : group(other.group), func(std::move(other.func)) {
+      other.group = nullptr;
+    }
+    ~Member() {
+      if (group != nullptr) {
+        group->Done();
+      }
+    }
+    auto operator()() -> decltype(std::declval<F&>()()) {
+      Leave leave{group};
+      group = nullptr;
+      return func();
+    }
+    TaskGroup* group;
+    F func;
+  };
+
+  std::size_t pending_ = 0;
+  std::condition_variable done_cv_;
+  std::mutex mtx_;
+};
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_TASK_GROUP_H_
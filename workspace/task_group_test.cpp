@@ -0,0 +1,79 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "workspace.h"
+
+using cos::workspace::TaskGroup;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+using std::chrono::milliseconds;
+
+TEST(TaskGroup, waits_for_its_tasks_only) {
+  WorkBranch br(2);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened] { opened.wait(); });     // not in the group
+
+  TaskGroup group;
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; i ++) {
+    group.Submit(br, [&count] {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      count ++;
+    });
+  }
+  group.Wait();
+  EXPECT_EQ(count, 10);
+  EXPECT_EQ(group.Pending(), 0);
+  EXPECT_FALSE(br.WaitIdle(milliseconds(1)));
+  gate.set_value();
+  EXPECT_TRUE(br.WaitIdle(milliseconds(1000)));
+}
+
+TEST(TaskGroup, returns_what_submit_does) {
+  Workspace space;
+  space.Attach(new WorkBranch(1));
+  TaskGroup group;
+  std::future<int> value = group.Submit(space, [] { return 7; });
+  std::future<int> urgent = group.Submit<cos::base::urgent>(space, [] { return 8; });
+  std::future<int> failed = group.Submit(space, []() -> int { throw std::runtime_error("failed"); });
+  EXPECT_TRUE(group.WaitFor(milliseconds(1000)));
+  EXPECT_EQ(value.get(), 7);
+  EXPECT_EQ(urgent.get(), 8);
+  EXPECT_THROW(failed.get(), std::runtime_error);
+}
+
+TEST(TaskGroup, rejected_tasks_are_done) {
+  cos::workspace::BranchOptions options;
+  options.capacity = 1;
+  options.overflow = cos::workspace::Overflow::reject;
+  WorkBranch br(1, options);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  TaskGroup group;
+  group.Submit(br, [opened] { opened.wait(); });
+  group.Submit(br, [] {});
+  group.Submit(br, [] {});
+  EXPECT_LE(group.Pending(), 2);
+  gate.set_value();
+  EXPECT_TRUE(group.WaitFor(milliseconds(1000)));
+}
+
+TEST(TaskGroup, latch) {
+  TaskGroup group;
+  group.Add(2);
+  EXPECT_FALSE(group.WaitFor(milliseconds(10)));
+  std::thread other([&group] { group.Done(); });
+  group.Done();
+  other.join();
+  EXPECT_TRUE(group.WaitFor(milliseconds(0)));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,241 @@
+#ifndef WORKSPACE_TIMER_H_
+#define WORKSPACE_TIMER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "base/autothread.h"
+#include "base/timer_wheel.h"
+#include "base/unique_task.h"
+
+namespace cos {
+namespace workspace {
+
+constexpr std::size_t DEFAULT_TIMER_TICK = 1000; // us
+
+class Timer;
+
+// Returned by the Submit* calls of Timer and Workspace.
+class TimerHandle {
+ public:
+  TimerHandle() = default;
+
+  bool valid() const {
+    return timer_ != nullptr;
+  }
+
+  // Stops the timer. False if it already ran once and was not periodic,
+  // or was cancelled. A periodic run already due may still start.
+  bool Cancel();
+
+ private:
+  friend class Timer;
+  TimerHandle(Timer* timer, std::uint64_t id) : timer_(timer), id_(id) { }
+
+  Timer* timer_ = nullptr;
+  std::uint64_t id_ = 0;
+};
+
+// One thread driving a TimerWheel. Due tasks are submitted to their
+// executor, a WorkBranch or a Workspace, and never run on the timer
+// thread. Tasks are not started early; they may start up to one tick late
+// plus the time the executor takes to pick them up.
+//
+// The timer thread never waits for a bounded executor either: a due task
+// its executor does not admit at once is dropped unrun and counted by
+// Dropped(), a periodic one only skips that run.
+class Timer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Timer(std::chrono::microseconds tick = std::chrono::microseconds(DEFAULT_TIMER_TICK))
+      : tick_ns_(std::max<std::uint64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(tick).count())),
+        epoch_(Clock::now()),
+        thread_(std::thread(&Timer::process, this)) { }
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+  // Pending timers are dropped.
+  ~Timer() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    is_stop_ = true;
+    cv_.notify_one();
+  }
+
+  template <typename Executor, typename F>
+  TimerHandle SubmitAt(Executor& exec, Clock::time_point when, F&& task) {
+    Entry entry;
+    entry.once = Task(Once<Executor, typename std::decay<F>::type>(exec, &dropped_, std::forward<F>(task)));
+    return add(ticks(when, true), 0, std::move(entry));
+  }
+
+  template <typename Executor, typename Rep, typename Period, typename F>
+  TimerHandle SubmitAfter(Executor& exec, std::chrono::duration<Rep, Period> delay, F&& task) {
+    return SubmitAt(exec, Clock::now() + delay, std::forward<F>(task));
+  }
+
+  // First run one period from now. Runs may overlap if one takes longer
+  // than the period; periods missed by the timer thread are skipped.
+  template <typename Executor, typename Rep, typename Period, typename F>
+  TimerHandle SubmitEvery(Executor& exec, std::chrono::duration<Rep, Period> period, F&& task) {
+    std::uint64_t period_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+    std::uint64_t period_ticks = std::max<std::uint64_t>(1, (period_ns + tick_ns_ - 1) / tick_ns_);
+    using Fn = typename std::decay<F>::type;
+    Entry entry;
+    entry.every = std::make_shared<Task>(
+        Every<Executor, Fn>(exec, &dropped_, std::make_shared<Fn>(std::forward<F>(task))));
+    return add(ticks(Clock::now() + period, true), period_ticks, std::move(entry));
+  }
+
+  bool Cancel(TimerHandle handle) {
+    if (handle.timer_ != this) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    return wheel_.Cancel(handle.id_);
+  }
+
+  std::size_t Pending() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return wheel_.Size();
+  }
+
+  // Due runs their executor rejected or shed so far.
+  std::uint64_t Dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  using Task = cos::base::UniqueTask;
+
+  // What the wheel holds. A one-shot entry gives its task away when due,
+  // a periodic one stays and shares its task with every run.
+  struct Entry {
+    Task once;
+    std::shared_ptr<Task> every;
+  };
+
+  // Takes the executor's Admission without depending on its header.
+  template <typename Admission>
+  static bool accepted(Admission admission) {
+    return admission == Admission::accepted;
+  }
+
+  template <typename Executor, typename F>
+  struct Once {
+    template <typename Fn>
+    Once(Executor& ex, std::atomic<std::uint64_t>* d, Fn&& fn) : exec(&ex), dropped(d), func(std::forward<Fn>(fn)) { }
+    void operator()() {
+      if (!accepted(exec->TrySubmitNow(std::move(func)))) {
+        dropped->fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    Executor* exec;
+    std::atomic<std::uint64_t>* dropped;
+    F func;
+  };
+
+  template <typename F>
+  struct Run {
+    void operator()() { (*func)(); }
+    std::shared_ptr<F> func;
+  };
+
+  template <typename Executor, typename F>
+  struct Every {
+    Every(Executor& ex, std::atomic<std::uint64_t>* d, std::shared_ptr<F> fn)
+        : exec(&ex), dropped(d), func(std::move(fn)) { }
+    void operator()() {
+      if (!accepted(exec->TrySubmitNow(Run<F>{func}))) {
+        dropped->fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    Executor* exec;
+    std::atomic<std::uint64_t>* dropped;
+    std::shared_ptr<F> func;
+  };
+
+  struct Shared {
+    void operator()() { (*task)(); }
+    std::shared_ptr<Task> task;
+  };
+
+  std::uint64_t ticks(Clock::time_point when, bool round_up) const {
+    if (when <= epoch_) {
+      return 0;
+    }
+    std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when - epoch_).count();
+    return round_up ? (ns + tick_ns_ - 1) / tick_ns_ : ns / tick_ns_;
+  }
+
+  TimerHandle add(std::uint64_t tick, std::uint64_t period, Entry&& entry) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::uint64_t id = wheel_.Add(tick, std::move(entry), period);
+    if (tick < wake_tick_) {
+      cv_.notify_one();
+    }
+    return TimerHandle(this, id);
+  }
+
+  // Due tasks are submitted without holding the lock, so Submit* and
+  // Cancel never wait for an executor.
+  void process() {
+    std::vector<Task> due;
+    std::unique_lock<std::mutex> ulk(mtx_);
+    while (!is_stop_) {
+      wheel_.Advance(ticks(Clock::now(), false), [&due](Entry& entry) {
+        if (entry.every) {
+          due.emplace_back(Shared{entry.every});
+        } else {
+          due.push_back(std::move(entry.once));
+        }
+      });
+      if (!due.empty()) {
+        ulk.unlock();
+        for (Task& task : due) {
+          task();
+        }
+        due.clear();
+        ulk.lock();
+        continue;
+      }
+      wake_tick_ = wheel_.NextTick();
+      if (wake_tick_ == UINT64_MAX) {
+        cv_.wait(ulk);
+      } else {
+        cv_.wait_until(ulk, epoch_ + std::chrono::nanoseconds(wake_tick_ * tick_ns_));
+      }
+      wake_tick_ = 0;
+    }
+  }
+
+  const std::uint64_t tick_ns_;
+  const Clock::time_point epoch_;
+  base::TimerWheel<Entry> wheel_;
+  std::uint64_t wake_tick_ = 0;     // while the thread sleeps
+  bool is_stop_ = false;
+  std::atomic<std::uint64_t> dropped_{0};
+
+  std::condition_variable cv_;
+  std::mutex mtx_;
+  base::AutoThread<base::join> thread_;    // Last, it uses the members above
+};
+
+inline bool TimerHandle::Cancel() {
+  return timer_ != nullptr && timer_->Cancel(*this);
+}
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_TIMER_H_
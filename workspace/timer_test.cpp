@@ -0,0 +1,140 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "timer.h"
+#include "workspace.h"
+
+using cos::workspace::Timer;
+using cos::workspace::TimerHandle;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+using Clock = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+TEST(Timer, submit_after) {
+  WorkBranch br(1);
+  Timer timer;
+  std::promise<Clock::time_point> ran;
+  std::promise<std::thread::id> where;
+  Clock::time_point begin = Clock::now();
+  timer.SubmitAfter(br, milliseconds(20), [&ran, &where] {
+    ran.set_value(Clock::now());
+    where.set_value(std::this_thread::get_id());
+  });
+  EXPECT_GE(ran.get_future().get() - begin, milliseconds(20));
+  std::thread::id worker = br.Submit([] { return std::this_thread::get_id(); }).get();
+  EXPECT_EQ(where.get_future().get(), worker);
+  EXPECT_EQ(timer.Pending(), 0);
+}
+
+TEST(Timer, submit_at_and_order) {
+  WorkBranch br(1);
+  Timer timer;
+  std::vector<int> order;
+  std::promise<void> done;
+  Clock::time_point now = Clock::now();
+  timer.SubmitAt(br, now + milliseconds(30), [&order, &done] {
+    order.push_back(3);
+    done.set_value();
+  });
+  timer.SubmitAt(br, now + milliseconds(10), [&order] { order.push_back(1); });
+  timer.SubmitAt(br, now + milliseconds(20), [&order] { order.push_back(2); });
+  timer.SubmitAt(br, now - milliseconds(10), [&order] { order.push_back(0); });
+  done.get_future().wait();
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3}));
+}
+
+TEST(Timer, cancel) {
+  WorkBranch br(1);
+  Timer timer;
+  std::atomic<int> runs(0);
+  TimerHandle handle = timer.SubmitAfter(br, milliseconds(30), [&runs] { runs ++; });
+  EXPECT_TRUE(handle.valid());
+  EXPECT_EQ(timer.Pending(), 1);
+  EXPECT_TRUE(handle.Cancel());
+  EXPECT_FALSE(handle.Cancel());
+  EXPECT_FALSE(TimerHandle().Cancel());
+  std::this_thread::sleep_for(milliseconds(60));
+  EXPECT_EQ(runs, 0);
+
+  std::promise<void> done;
+  handle = timer.SubmitAfter(br, milliseconds(1), [&done] { done.set_value(); });
+  done.get_future().wait();
+  EXPECT_FALSE(timer.Cancel(handle));
+}
+
+TEST(Timer, submit_every) {
+  WorkBranch br(1);
+  Timer timer;
+  std::atomic<int> runs(0);
+  TimerHandle handle = timer.SubmitEvery(br, milliseconds(10), [&runs] { runs ++; });
+  std::this_thread::sleep_for(milliseconds(105));
+  EXPECT_TRUE(handle.Cancel());
+  int seen = br.Submit([&runs] { return runs.load(); }).get();
+  EXPECT_GE(seen, 3);
+  EXPECT_LE(seen, 11);
+  std::this_thread::sleep_for(milliseconds(30));
+  EXPECT_LE(runs, seen + 1);      // at most one run was already due
+  EXPECT_EQ(timer.Pending(), 0);
+}
+
+TEST(Timer, workspace) {
+  Workspace space;
+  space.Attach(new WorkBranch(1));
+  space.Attach(new WorkBranch(1));
+  std::atomic<int> runs(0);
+  std::promise<void> done;
+  for (int i = 0; i < 10; i ++) {
+    space.SubmitAfter(milliseconds(i), [&runs, &done] {
+      if (++ runs == 10) {
+        done.set_value();
+      }
+    });
+  }
+  TimerHandle every = space.SubmitEvery(milliseconds(5), [] { });
+  TimerHandle never = space.SubmitAt(Clock::now() + std::chrono::hours(1), [] { });
+  done.get_future().wait();
+  EXPECT_TRUE(never.Cancel());
+  EXPECT_TRUE(every.Cancel());
+  EXPECT_EQ(space.GetTimer().Pending(), 0);
+}
+
+// A full bounded branch neither stalls the timer thread nor has it run
+// the task: the run is dropped and the other timers stay on time.
+TEST(Timer, full_bounded_branch) {
+  for (auto overflow : {cos::workspace::Overflow::block, cos::workspace::Overflow::caller_runs}) {
+    cos::workspace::BranchOptions options;
+    options.capacity = 1;
+    options.overflow = overflow;
+    WorkBranch full(1, options);
+    WorkBranch other(1);
+    std::promise<void> gate, started;
+    std::shared_future<void> opened = gate.get_future().share();
+    full.Submit([opened, &started] {
+      started.set_value();
+      opened.wait();
+    });
+    started.get_future().wait();
+    full.Submit([] {});
+
+    Timer timer;
+    std::atomic<bool> ran(false);
+    std::promise<void> done;
+    timer.SubmitAfter(full, milliseconds(1), [&ran] { ran = true; });
+    timer.SubmitAfter(other, milliseconds(5), [&done] { done.set_value(); });
+    EXPECT_EQ(done.get_future().wait_for(milliseconds(1000)), std::future_status::ready);
+    EXPECT_EQ(timer.Dropped(), 1);
+    gate.set_value();
+    full.WaitIdle();
+    EXPECT_FALSE(ran);
+    EXPECT_EQ(full.Snapshot().rejected, 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,279 @@
+#ifndef WORKSPACE_TRACE_H_
+#define WORKSPACE_TRACE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cos {
+namespace workspace {
+
+constexpr std::size_t TRACE_RING_SIZE = 1 << 14;   // events kept per thread
+
+enum class TraceKind : std::uint8_t {
+  submit,           // on the submitter
+  dequeue,          // a worker took the task
+  start,
+  end,
+  add_worker,       // by AddWorker(), e.g. from a Supervisor
+  remove_worker,
+  wait_begin,       // the WaitTasks() barrier
+  wait_end,
+};
+
+// 'branch' is the address a Bid prints, 'task' links the events of one
+// task, 0 for the others. 'label' must outlive the dump.
+struct TraceEvent {
+  std::uint64_t time_ns = 0;      // steady clock
+  const void* branch = nullptr;
+  const char* label = nullptr;
+  std::uint32_t task = 0;
+  std::uint32_t tid = 0;          // threads are numbered from 1 on first record
+  TraceKind kind = TraceKind::submit;
+};
+
+// Names the tasks submitted by this thread while it lives.
+class TraceLabel {
+ public:
+  explicit TraceLabel(const char* label) : prev_(current()) {
+    current() = label;
+  }
+
+  TraceLabel(const TraceLabel&) = delete;
+  TraceLabel& operator=(const TraceLabel&) = delete;
+
+  ~TraceLabel() {
+    current() = prev_;
+  }
+
+  static const char*& current() {
+    static thread_local const char* label = nullptr;
+    return label;
+  }
+
+ private:
+  const char* prev_;
+};
+
+// Per-thread rings of the last TRACE_RING_SIZE events, written without
+// locking by branches with tracing on. The ring of an exited thread goes
+// to the next new one, its events stay until overwritten. Collecting
+// while threads record is best effort: events written meanwhile may be
+// skipped.
+class Tracer {
+ public:
+  static void Record(TraceKind kind, const void* branch, std::uint32_t task,
+                     const char* label = nullptr) {
+    Ring* ring = local_ring();
+    std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent& event = ring->events[head % TRACE_RING_SIZE];
+    event.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    event.branch = branch;
+    event.label = label;
+    event.task = task;
+    event.tid = ring->tid;
+    event.kind = kind;
+    ring->head.store(head + 1, std::memory_order_release);
+  }
+
+  // Never 0.
+  static std::uint32_t NextTask() {
+    static std::atomic<std::uint32_t> next{0};
+    std::uint32_t task = ++ next;
+    return task != 0 ? task : ++ next;
+  }
+
+  // Events of every thread since the last Clear(), in time order.
+  static std::vector<TraceEvent> Collect() {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    std::vector<TraceEvent> events;
+    for (Ring* ring : registry.rings) {
+      std::uint64_t head = ring->head.load(std::memory_order_acquire);
+      std::uint64_t first = std::max(ring->cleared.load(std::memory_order_relaxed),
+                                     head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0);
+      std::size_t begin = events.size();
+      for (std::uint64_t i = first; i < head; i ++) {
+        events.push_back(ring->events[i % TRACE_RING_SIZE]);
+      }
+      // Drop what the owner overwrote while we copied.
+      std::uint64_t now = ring->head.load(std::memory_order_acquire);
+      if (now > first + TRACE_RING_SIZE) {
+        std::size_t lost = std::min<std::uint64_t>(head - first, now - first - TRACE_RING_SIZE);
+        events.erase(events.begin() + begin, events.begin() + begin + lost);
+      }
+    }
+    std::stable_sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+      return a.time_ns < b.time_ns;
+    });
+    return events;
+  }
+
+  // Forgets the events recorded so far.
+  static void Clear() {
+    Registry& registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    for (Ring* ring : registry.rings) {
+      ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+  }
+
+  // Chrome trace_event JSON, for chrome://tracing or Perfetto. Tasks are
+  // slices on their worker, named after their label and linked by a flow
+  // arrow to their submission; worker threads are named after their
+  // branch.
+  static void Dump(std::ostream& os) {
+    std::vector<TraceEvent> events = Collect();
+    std::unordered_map<std::uint32_t, const char*> labels;
+    std::unordered_map<std::uint32_t, const void*> workers;
+    for (const TraceEvent& event : events) {
+      if (event.kind == TraceKind::submit && event.label != nullptr) {
+        labels[event.task] = event.label;
+      } else if (event.kind == TraceKind::start) {
+        workers[event.tid] = event.branch;
+      }
+    }
+    os << "{\"traceEvents\": [\n";
+    bool first = true;
+    auto line = [&os, &first](const std::string& json) {
+      os << (first ? "  " : ",\n  ") << json;
+      first = false;
+    };
+    for (auto& worker : workers) {
+      line("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " + std::to_string(worker.first) +
+           ", \"args\": {\"name\": \"branch " + id_of(worker.second) + " worker\"}}");
+    }
+    for (const TraceEvent& event : events) {
+      auto it = labels.find(event.task);
+      std::string name = quote(event.label != nullptr ? event.label :
+                               it != labels.end() ? it->second : "task");
+      std::string common = ", \"ts\": " + micros(event.time_ns) + ", \"pid\": 1, \"tid\": " +
+                           std::to_string(event.tid);
+      std::string args = ", \"args\": {\"branch\": \"" + id_of(event.branch) + "\"" +
+                         (event.task != 0 ? ", \"task\": " + std::to_string(event.task) : "") + "}";
+      std::string flow = ", \"cat\": \"flow\", \"id\": " + std::to_string(event.task);
+      switch (event.kind) {
+        case TraceKind::submit:
+          line("{\"name\": " + name + ", \"cat\": \"submit\", \"ph\": \"i\", \"s\": \"t\"" + common + args + "}");
+          line("{\"name\": " + name + flow + ", \"ph\": \"s\"" + common + "}");
+          break;
+        case TraceKind::dequeue:
+          line("{\"name\": " + name + ", \"cat\": \"dequeue\", \"ph\": \"i\", \"s\": \"t\"" + common + args + "}");
+          break;
+        case TraceKind::start:
+          line("{\"name\": " + name + ", \"cat\": \"task\", \"ph\": \"B\"" + common + args + "}");
+          line("{\"name\": " + name + flow + ", \"ph\": \"f\", \"bp\": \"e\"" + common + "}");
+          break;
+        case TraceKind::end:
+          line("{\"name\": " + name + ", \"cat\": \"task\", \"ph\": \"E\"" + common + "}");
+          break;
+        case TraceKind::add_worker:
+        case TraceKind::remove_worker:
+          line("{\"name\": \"" + std::string(event.kind == TraceKind::add_worker ? "AddWorker" : "RemoveWorker") +
+               "\", \"cat\": \"scaling\", \"ph\": \"i\", \"s\": \"p\"" + common + args + "}");
+          break;
+        case TraceKind::wait_begin:
+          line("{\"name\": \"WaitTasks\", \"cat\": \"barrier\", \"ph\": \"B\"" + common + args + "}");
+          break;
+        case TraceKind::wait_end:
+          line("{\"name\": \"WaitTasks\", \"cat\": \"barrier\", \"ph\": \"E\"" + common + "}");
+          break;
+      }
+    }
+    os << "\n], \"displayTimeUnit\": \"ns\"}\n";
+  }
+
+  // False if the file cannot be written.
+  static bool Dump(const std::string& path) {
+    std::ofstream out(path);
+    Dump(out);
+    return out.good();
+  }
+
+ private:
+  struct Ring {
+    std::unique_ptr<TraceEvent[]> events{new TraceEvent[TRACE_RING_SIZE]};
+    std::atomic<std::uint64_t> head{0};
+    std::atomic<std::uint64_t> cleared{0};
+    std::uint32_t tid = 0;
+  };
+
+  // Never destroyed: detached workers may still record at exit.
+  struct Registry {
+    static Registry& Get() {
+      static Registry* registry = new Registry();
+      return *registry;
+    }
+    std::mutex mtx;
+    std::vector<Ring*> rings;
+    std::vector<Ring*> orphans;
+    std::uint32_t threads = 0;
+  };
+
+  struct Owner {
+    ~Owner() {
+      if (ring != nullptr) {
+        Registry& registry = Registry::Get();
+        std::lock_guard<std::mutex> lock(registry.mtx);
+        registry.orphans.push_back(ring);
+      }
+    }
+    Ring* ring = nullptr;
+  };
+
+  static Ring* local_ring() {
+    static thread_local Owner owner;
+    if (owner.ring == nullptr) {
+      Registry& registry = Registry::Get();
+      std::lock_guard<std::mutex> lock(registry.mtx);
+      if (!registry.orphans.empty()) {
+        owner.ring = registry.orphans.back();
+        registry.orphans.pop_back();
+      } else {
+        owner.ring = new Ring();
+        registry.rings.push_back(owner.ring);
+      }
+      owner.ring->tid = ++ registry.threads;
+    }
+    return owner.ring;
+  }
+
+  static std::string id_of(const void* branch) {
+    return std::to_string((std::uint64_t)(std::uintptr_t)branch);
+  }
+
+  static std::string micros(std::uint64_t ns) {
+    std::string us = std::to_string(ns / 1000) + ".";
+    std::string frac = std::to_string(ns % 1000);
+    return us + std::string(3 - frac.size(), '0') + frac;
+  }
+
+  static std::string quote(const char* text) {
+    std::string out = "\"";
+    for (const char* c = text; *c != '\0'; c ++) {
+      if (*c == '"' || *c == '\\') {
+        out += '\\';
+        out += *c;
+      } else if ((unsigned char)*c < 0x20) {
+        out += ' ';
+      } else {
+        out += *c;
+      }
+    }
+    return out + "\"";
+  }
+};
+
+}  // namespace workspace
+}  // namespace cos
+
+#endif  // WORKSPACE_TRACE_H_
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "workspace.h"
+
+using cos::workspace::TraceEvent;
+using cos::workspace::TraceKind;
+using cos::workspace::TraceLabel;
+using cos::workspace::Tracer;
+using cos::workspace::WorkBranch;
+using cos::workspace::Workspace;
+
+static std::vector<TraceEvent> Of(const std::vector<TraceEvent>& events, TraceKind kind) {
+  std::vector<TraceEvent> out;
+  std::copy_if(events.begin(), events.end(), std::back_inserter(out), [kind](const TraceEvent& event) {
+    return event.kind == kind;
+  });
+  return out;
+}
+
+static std::size_t Count(const std::string& text, const std::string& what) {
+  std::size_t num = 0;
+  for (std::size_t pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1)) {
+    num ++;
+  }
+  return num;
+}
+
+TEST(Trace, task_lifecycle) {
+  Tracer::Clear();
+  WorkBranch br(2);
+  br.SetTracing(true);
+  {
+    TraceLabel label("labeled");
+    for (int i = 0; i < 10; i ++) {
+      br.Submit([] {});
+    }
+  }
+  br.Submit([] {});
+  br.WaitIdle();
+  br.SetTracing(false);
+  br.Submit([] {});
+  br.WaitIdle();
+
+  std::vector<TraceEvent> events = Tracer::Collect();
+  std::vector<TraceEvent> submits = Of(events, TraceKind::submit);
+  ASSERT_EQ(submits.size(), 11);
+  EXPECT_EQ(Of(events, TraceKind::dequeue).size(), 11);
+  EXPECT_EQ(Of(events, TraceKind::start).size(), 11);
+  EXPECT_EQ(Of(events, TraceKind::end).size(), 11);
+  EXPECT_EQ(std::string(submits[0].label), "labeled");
+  EXPECT_EQ(submits[10].label, nullptr);
+  for (const TraceEvent& event : events) {
+    EXPECT_EQ(event.branch, &br);
+    EXPECT_NE(event.task, 0);
+  }
+
+  // Every task starts after its submission, and ends on the same thread.
+  for (const TraceEvent& submit : submits) {
+    auto start = std::find_if(events.begin(), events.end(), [&submit](const TraceEvent& event) {
+      return event.kind == TraceKind::start && event.task == submit.task;
+    });
+    auto end = std::find_if(events.begin(), events.end(), [&submit](const TraceEvent& event) {
+      return event.kind == TraceKind::end && event.task == submit.task;
+    });
+    ASSERT_NE(start, events.end());
+    ASSERT_NE(end, events.end());
+    EXPECT_LE(submit.time_ns, start->time_ns);
+    EXPECT_LE(start->time_ns, end->time_ns);
+    EXPECT_EQ(start->tid, end->tid);
+  }
+}
+
+TEST(Trace, workers_and_barriers) {
+  Tracer::Clear();
+  WorkBranch br(1);
+  br.SetTracing(true);
+  br.AddWorker();
+  br.RemoveWorker();
+  br.WaitTasks();
+  std::vector<TraceEvent> events = Tracer::Collect();
+  EXPECT_EQ(Of(events, TraceKind::add_worker).size(), 1);
+  EXPECT_EQ(Of(events, TraceKind::remove_worker).size(), 1);
+  ASSERT_EQ(Of(events, TraceKind::wait_begin).size(), 1);
+  ASSERT_EQ(Of(events, TraceKind::wait_end).size(), 1);
+  EXPECT_LE(Of(events, TraceKind::wait_begin)[0].time_ns, Of(events, TraceKind::wait_end)[0].time_ns);
+}
+
+TEST(Trace, workspace_and_dump) {
+  Tracer::Clear();
+  Workspace space;
+  space.SetTracing(true);
+  auto first = space.Attach(new WorkBranch(1));
+  auto second = space.Attach(new WorkBranch(1));
+  {
+    TraceLabel label("say \"hi\"");
+    for (int i = 0; i < 4; i ++) {
+      space.Submit([] {});
+    }
+  }
+  space.WaitIdle();
+  std::vector<TraceEvent> events = Tracer::Collect();
+  std::vector<TraceEvent> starts = Of(events, TraceKind::start);
+  EXPECT_EQ(starts.size(), 4);
+  EXPECT_TRUE(std::any_of(starts.begin(), starts.end(), [&](const TraceEvent& event) {
+    return event.branch == first.branch();
+  }));
+  EXPECT_TRUE(std::any_of(starts.begin(), starts.end(), [&](const TraceEvent& event) {
+    return event.branch == second.branch();
+  }));
+
+  std::ostringstream os;
+  Tracer::Dump(os);
+  std::string json = os.str();
+  EXPECT_EQ(json.find("{\"traceEvents\": ["), 0);
+  EXPECT_EQ(Count(json, "\"ph\": \"B\""), 4);
+  EXPECT_EQ(Count(json, "\"ph\": \"E\""), 4);
+  EXPECT_EQ(Count(json, "\"ph\": \"s\""), 4);
+  EXPECT_EQ(Count(json, "\"ph\": \"f\""), 4);
+  EXPECT_EQ(Count(json, "\"thread_name\""), 2);
+  EXPECT_EQ(Count(json, "\"name\": \"say \\\"hi\\\"\""), 4 * 6);    // six events per task
+  std::ostringstream bid;
+  bid << first;
+  EXPECT_NE(json.find("\"branch\": \"" + bid.str() + "\""), std::string::npos);
+}
+
+TEST(Trace, ring_keeps_the_last_events) {
+  Tracer::Clear();
+  WorkBranch br(1);
+  br.SetTracing(true);
+  std::size_t num = cos::workspace::TRACE_RING_SIZE + 100;
+  for (std::size_t i = 0; i < num; i ++) {
+    br.Submit([] {});
+  }
+  br.WaitIdle();
+  std::vector<TraceEvent> submits = Of(Tracer::Collect(), TraceKind::submit);
+  ASSERT_EQ(submits.size(), cos::workspace::TRACE_RING_SIZE);
+  EXPECT_LT(submits.front().task, submits.back().task);
+  EXPECT_EQ(submits.back().task - submits.front().task, cos::workspace::TRACE_RING_SIZE - 1);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,59 +2,333 @@
 #define WORKSPACE_WORKBRANCH_H_
 
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <condition_variable>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <tuple>
 #include <unordered_map>
 #include <functional>
+#include <iterator>
+#include <vector>
 
+#include "base/affinity.h"
 #include "base/autothread.h"
+#include "base/fast_future.h"
+#include "base/histogram.h"
+#include "base/lane_queue.h"
+#include "base/profiled_mutex.h"
+#include "base/ring_queue.h"
+#include "base/slab.h"
 #include "base/thread_safe_queue.h"
+#include "base/unique_task.h"
 #include "base/utility.h"
+#include "base/work_stealing_deque.h"
+#include "migration.h"
+#include "strand.h"
+#include "trace.h"
 
 namespace cos {
 namespace workspace {
 
 using cos::base::AutoThread;
+using cos::base::CondVar;
+using cos::base::Mutex;
+using cos::base::RingQueue;
 using cos::base::ThreadSafeQueue;
+using cos::base::WorkStealingDeque;
 
 using id = std::thread::id;
-using Task = std::function<void()>;
+using Task = cos::base::UniqueTask;
 using worker = AutoThread<cos::base::detach>;
 
 namespace base = cos::base;
 
-class WorkBranch {
+constexpr std::size_t DEFAULT_IDLE_SPINS = 64;
+constexpr std::size_t DEFAULT_IDLE_YIELDS = 16;
+constexpr std::size_t DEFAULT_SHED_INTERVAL = 100;  // ms
+constexpr std::size_t DEFAULT_RESERVE_TIMEOUT = 10000;  // ms
+
+// What a bounded branch does with a task that finds its queue full.
+//  block:       the submitter waits for room, at most 'block_timeout' if
+//               not 0, then the task is rejected
+//  reject:      the task is rejected
+//  caller_runs: the submitter runs the task itself
+//  drop_oldest: the task next in line is dropped to make room
+enum class Overflow {
+  block,
+  reject,
+  caller_runs,
+  drop_oldest,
+};
+
+// What TrySubmit returns. 'accepted' also covers a task run by the caller.
+enum class Admission {
+  accepted,
+  rejected,     // by the overflow policy
+  shed,         // while the queue wait is over 'shed_target'
+};
+
+// What a worker does when it finds the queue empty: spin for 'idle_spins'
+// rounds, then yield for 'idle_yields' rounds, and finally park until a
+// submission wakes it up.
+//
+// With 'work_stealing' set, every worker owns a Chase-Lev deque: tasks
+// submitted from inside a worker go to its own deque, external submissions
+// go to the shared queue, and idle workers steal from random victims.
+//
+// Placement is Linux only and best effort. 'cpus' restricts the workers to
+// a cpuset, 'numa_node' (if not negative) to the cpus of that node, and
+// with 'pin_workers' each worker gets one cpu of the set, in turn. Workers
+// place themselves before allocating their own data, so that it lands on
+// their node.
+//
+// With 'lane_weights' set the branch has one priority lane per weight, and
+// every task goes through them instead of the queue and deques above:
+// 'urgent' is lane 0, 'normal' the last lane, base::lane<N> lane N. Inside
+// a lane tasks run by deadline, those without one being due on submission.
+// Busy lanes share the workers in proportion to their weights.
+//
+// A 'capacity' bounds the queued tasks, the 'overflow' policy applies
+// beyond it. With a 'shed_target', once every task started during a whole
+// 'shed_interval' waited longer than the target, new submissions are shed
+// until a wait falls below it or the queue empties. Rejected, shed and
+// dropped tasks are destroyed unrun: their futures report broken_promise,
+// and coroutines or graphs waiting for them never resume. Submissions from
+// the branch's own workers are always queued, blocking them could
+// deadlock.
+//
+// Up to 'reserve_workers' workers taken away by RemoveWorker() park in a
+// reserve instead of exiting, and AddWorker() revives them before creating
+// threads. A worker left in the reserve for 'reserve_timeout' exits.
+//
+// A branch that is not 'migratable' never joins a MigrationGroup, e.g. a
+// pinned one whose tasks must stay on its cpus.
+struct BranchOptions {
+  std::size_t idle_spins = DEFAULT_IDLE_SPINS;
+  std::size_t idle_yields = DEFAULT_IDLE_YIELDS;
+  bool work_stealing = false;
+  std::vector<int> cpus;
+  int numa_node = -1;
+  bool pin_workers = false;
+  std::vector<std::size_t> lane_weights;
+  std::size_t capacity = 0;                       // 0: unbounded
+  Overflow overflow = Overflow::block;
+  std::chrono::milliseconds block_timeout{0};     // 0: no timeout
+  std::chrono::microseconds shed_target{0};       // 0: no shedding
+  std::chrono::milliseconds shed_interval{DEFAULT_SHED_INTERVAL};
+  std::size_t reserve_workers = 0;
+  std::chrono::milliseconds reserve_timeout{DEFAULT_RESERVE_TIMEOUT};
+  bool migratable = true;
+};
+
+// What SubmitBulk returns for tasks returning R
+template <typename R>
+struct bulk_result {
+  using type = std::vector<std::future<R>>;
+};
+
+template <>
+struct bulk_result<void> {
+  using type = void;
+};
+
+// Lock-free snapshot of a branch's load, used by dispatchers. The fields
+// are read independently and may be slightly stale.
+struct LoadHint {
+  std::size_t queued = 0;       // tasks submitted but not yet started
+  std::size_t workers = 0;      // workers not about to leave
+  std::uint64_t run_ns = 0;     // EWMA of task run time, 0 until measured
+};
+
+// Metrics of a branch at one point in time, read without pausing the
+// workers. Counters run from the creation of the branch; compare two
+// snapshots for rates.
+struct BranchSnapshot {
+  std::uint64_t time_ns = 0;        // steady clock
+  std::size_t workers = 0;
+  std::size_t queued = 0;
+  std::uint64_t submitted = 0;
+  std::uint64_t completed = 0;
+  std::uint64_t urgent = 0;         // urgent submissions
+  std::uint64_t rejected = 0;       // by the overflow policy, see Admission
+  std::uint64_t shed = 0;
+  std::uint64_t dropped = 0;        // by drop_oldest
+  std::uint64_t caller_ran = 0;     // by caller_runs
+  std::uint64_t migrated_in = 0;    // taken from sibling branches
+  std::uint64_t migrated_out = 0;   // given to them
+  std::uint64_t steals = 0;
+  std::uint64_t busy_ns = 0;        // summed over workers
+  std::uint64_t idle_ns = 0;
+  base::Histogram wait_ns;          // enqueue to start
+  base::Histogram run_ns;
+  std::vector<base::Histogram> lane_wait_ns;    // per lane, if any
+
+  double Utilization() const {
+    std::uint64_t total = busy_ns + idle_ns;
+    return total == 0 ? 0.0 : (double)busy_ns / (double)total;
+  }
+
+  // Tasks completed per second since 'earlier'.
+  double Throughput(const BranchSnapshot& earlier) const {
+    if (time_ns <= earlier.time_ns) {
+      return 0.0;
+    }
+    return (double)(completed - earlier.completed) * 1e9 / (double)(time_ns - earlier.time_ns);
+  }
+
+  void Merge(const BranchSnapshot& other) {
+    time_ns = std::max(time_ns, other.time_ns);
+    workers += other.workers;
+    queued += other.queued;
+    submitted += other.submitted;
+    completed += other.completed;
+    urgent += other.urgent;
+    rejected += other.rejected;
+    shed += other.shed;
+    dropped += other.dropped;
+    caller_ran += other.caller_ran;
+    migrated_in += other.migrated_in;
+    migrated_out += other.migrated_out;
+    steals += other.steals;
+    busy_ns += other.busy_ns;
+    idle_ns += other.idle_ns;
+    wait_ns.Merge(other.wait_ns);
+    run_ns.Merge(other.run_ns);
+    if (lane_wait_ns.size() < other.lane_wait_ns.size()) {
+      lane_wait_ns.resize(other.lane_wait_ns.size());
+    }
+    for (std::size_t i = 0; i < other.lane_wait_ns.size(); i ++) {
+      lane_wait_ns[i].Merge(other.lane_wait_ns[i]);
+    }
+  }
+};
+
+template <typename T>
+struct is_priority_tag : std::integral_constant<bool,
+    std::is_same<T, base::normal>::value || std::is_same<T, base::urgent>::value> {};
+
+// Tags accepted by SubmitDeadline
+template <typename T>
+struct is_lane_tag : std::integral_constant<bool,
+    is_priority_tag<T>::value || base::is_lane<T>::value> {};
+
+namespace coro {
+template <typename Executor>
+class ScheduleAwaiter;      // In "workspace/coroutine.h", needs C++20
+}  // namespace coro
+
+// Owns the callable and its promise, C++11 lambdas cannot move-capture.
+// Also used by Workspace.
+template <typename F, typename R>
+struct PromiseTask {
+  template <typename Fn>
+  explicit PromiseTask(Fn&& fn) : func(std::forward<Fn>(fn)) { }
+  void operator()() {
+    try {
+      promise.set_value(func());
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+  }
+  F func;
+  std::promise<R> promise;
+};
+
+// Queue policies of BasicWorkBranch
+struct LockedQueue {      // std::deque guarded by a mutex, unbounded
+  template <typename T>
+  using type = ThreadSafeQueue<T>;
+};
+
+// Bounded lock-free ring. Submitters yield while it is full, workers run a
+// queued task instead, so a task may submit to its own branch past the
+// capacity.
+struct LockFreeQueue {
+  template <typename T>
+  using type = RingQueue<T>;
+};
+
+struct SlabQueue {        // LockedQueue whose blocks and big closures come from base::Slab
+  template <typename T>
+  using type = ThreadSafeQueue<T, base::SlabAllocator<T>>;
+  using allocator = base::SlabAllocator<char>;
+};
+
+// A policy's 'allocator' stores the closures too big for a Task, if any.
+template <typename QueuePolicy, typename = void>
+struct task_allocator {
+  using type = std::allocator<char>;
+};
+
+template <typename QueuePolicy>
+struct task_allocator<QueuePolicy, typename std::conditional<true, void, typename QueuePolicy::allocator>::type> {
+  using type = typename QueuePolicy::allocator;
+};
+
+template <typename QueuePolicy = LockedQueue>
+class BasicWorkBranch {
  public:
-  WorkBranch(int num = 1) {
+  BasicWorkBranch(int num = 1, const BranchOptions& options = BranchOptions())
+      : options_(options), cpuset_(resolve_cpuset(options)),
+        lanes_(options.lane_weights), future_pool_(base::FuturePool::Create()) {
     for (int i = 0; i < num; i ++) {
       AddWorker();
     }
   }
 
-  WorkBranch(const WorkBranch& ) = delete;
-  WorkBranch& operator= (WorkBranch&) = delete;
-  WorkBranch(WorkBranch&&) = delete;
+  BasicWorkBranch(const BasicWorkBranch& ) = delete;
+  BasicWorkBranch& operator= (BasicWorkBranch&) = delete;
+  BasicWorkBranch(BasicWorkBranch&&) = delete;
   
-  ~WorkBranch() {
-    std::unique_lock<std::mutex> ulk(mtx_);
+  ~BasicWorkBranch() {
+    std::unique_lock<Mutex> ulk(mtx_);
     is_destructing_ = true;
     declines_ = workers_map_.size();
+    wake_all();
+    reserve_cv_.notify_all();
     destructing_cv_.wait(ulk, [this] { return declines_ <= 0;});
+    future_pool_->Release();
   }
 
+  // Revives a worker of the reserve if any, or starts a thread.
   void AddWorker() {
-    std::lock_guard<std::mutex> lock(mtx_);
-    std::thread thrd(&WorkBranch::process, this);
+    std::lock_guard<Mutex> lock(mtx_);
+    if (tracing_.load(std::memory_order_relaxed)) {
+      Tracer::Record(TraceKind::add_worker, this, 0);
+    }
+    active_ ++;
+    if (reserved_ > 0) {
+      reserved_ --;
+      revivals_ ++;
+      reserve_cv_.notify_one();
+      return;
+    }
+    int cpu = -1;
+    if (options_.pin_workers && !cpuset_.empty()) {
+      cpu = cpuset_[placed_ ++ % cpuset_.size()];
+    }
+    std::thread thrd(&BasicWorkBranch::process, this, cpu);
     workers_map_.emplace(thrd.get_id(), std::move(thrd));
   }
 
+  // Ignored without an active worker: those leaving or in the reserve do
+  // not count.
   void RemoveWorker() {
-    std::lock_guard<std::mutex> lock(mtx_);
-    if (workers_map_.empty()) {
+    std::lock_guard<Mutex> lock(mtx_);
+    if (workers_num() == 0) {
       std::cout << "[INFO] Invalid remove, wokers pool is empty." << std::endl;
     } else {
+      if (tracing_.load(std::memory_order_relaxed)) {
+        Tracer::Record(TraceKind::remove_worker, this, 0);
+      }
       declines_ ++;
+      active_ --;
+      wake_one();
     }
   }
   
@@ -63,9 +337,7 @@ class WorkBranch {
             typename R = base::result_of_t<F>,
             typename DR = typename std::enable_if<std::is_void<R>::value>::type>
   auto Submit(F&& task) -> typename std::enable_if<std::is_same<T, base::normal>::value>::type {
-    tasks_que_.push_back([task] {
-      task();
-    });
+    push_back_task(make_task(std::forward<F>(task)));
   }
   
   // Submit 'urgent' task, and return void
@@ -73,9 +345,7 @@ class WorkBranch {
             typename R = base::result_of_t<F>,
             typename DR = typename std::enable_if<std::is_void<R>::value>::type>
   auto Submit(F&& task) -> typename std::enable_if<std::is_same<T, base::urgent>::value>::type {
-    tasks_que_.push_front([task] {
-      task();
-    });
+    push_front_task(make_task(std::forward<F>(task)));
   }
 
   // Submit 'normal' task, and return std::future<R>
@@ -83,12 +353,10 @@ class WorkBranch {
             typename R = base::result_of_t<F>,
             typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
   auto Submit(F&& task) -> typename std::enable_if<std::is_same<T, base::normal>::value, std::future<R>>::type {
-    std::function<R()> exec(std::forward<F>(task));
-    std::shared_ptr<std::promise<R>> task_promise = std::make_shared<std::promise<R>>();
-    tasks_que_.push_back([exec, task_promise] {
-      task_promise->set_value(exec());
-    });
-    return task_promise->get_future();
+    PromiseTask<typename std::decay<F>::type, R> exec(std::forward<F>(task));
+    std::future<R> res = exec.promise.get_future();
+    push_back_task(make_task(std::move(exec)));
+    return res;
   }
 
   // Submit 'urgent' task, and return std::future<R>
@@ -96,12 +364,108 @@ class WorkBranch {
             typename R = base::result_of_t<F>,
             typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
   auto Submit(F&& task) -> typename std::enable_if<std::is_same<T, base::urgent>::value, std::future<R>>::type {
-    std::function<R()> exec(std::forward<F>(task));
-    std::shared_ptr<std::promise<R>> task_promise = std::make_shared<std::promise<R>>();
-    tasks_que_.push_front([exec, task_promise] {
-      task_promise->set_value(exec());
-    });
-    return task_promise->get_future();
+    PromiseTask<typename std::decay<F>::type, R> exec(std::forward<F>(task));
+    std::future<R> res = exec.promise.get_future();
+    push_front_task(make_task(std::move(exec)));
+    return res;
+  }
+
+  // Submit to a priority lane, and return void. Without lanes it is a
+  // 'normal' task.
+  template <typename T, typename F,
+            typename R = base::result_of_t<F>,
+            typename DR = typename std::enable_if<std::is_void<R>::value>::type>
+  auto Submit(F&& task) -> typename std::enable_if<base::is_lane<T>::value>::type {
+    push_tagged<T>(now_ns(), make_task(std::forward<F>(task)));
+  }
+
+  // Submit to a priority lane, and return std::future<R>
+  template <typename T, typename F,
+            typename R = base::result_of_t<F>,
+            typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
+  auto Submit(F&& task) -> typename std::enable_if<base::is_lane<T>::value, std::future<R>>::type {
+    PromiseTask<typename std::decay<F>::type, R> exec(std::forward<F>(task));
+    std::future<R> res = exec.promise.get_future();
+    push_tagged<T>(now_ns(), make_task(std::move(exec)));
+    return res;
+  }
+
+  // Submit with a deadline to the lane of 'T', and return void. Inside its
+  // lane the task runs before those due later. Without lanes the deadline
+  // is ignored.
+  template <typename T = base::normal, typename F,
+            typename R = base::result_of_t<F>,
+            typename DR = typename std::enable_if<std::is_void<R>::value>::type>
+  auto SubmitDeadline(std::chrono::steady_clock::time_point deadline, F&& task)
+      -> typename std::enable_if<is_lane_tag<T>::value>::type {
+    push_tagged<T>(to_ns(deadline), make_task(std::forward<F>(task)));
+  }
+
+  // Submit with a deadline, and return std::future<R>
+  template <typename T = base::normal, typename F,
+            typename R = base::result_of_t<F>,
+            typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
+  auto SubmitDeadline(std::chrono::steady_clock::time_point deadline, F&& task)
+      -> typename std::enable_if<is_lane_tag<T>::value, std::future<R>>::type {
+    PromiseTask<typename std::decay<F>::type, R> exec(std::forward<F>(task));
+    std::future<R> res = exec.promise.get_future();
+    push_tagged<T>(to_ns(deadline), make_task(std::move(exec)));
+    return res;
+  }
+
+  // Submit with the tag 'T', and return how the branch admitted the task.
+  template <typename T = base::normal, typename F>
+  auto TrySubmit(F&& task) -> typename std::enable_if<is_lane_tag<T>::value, Admission>::type {
+    return push_tagged<T>(now_ns(), make_task(std::forward<F>(task)));
+  }
+
+  // Like TrySubmit, but never waits for room nor runs the task on the
+  // caller: with 'block' or 'caller_runs' a full branch rejects it. For
+  // threads that must not stall, e.g. a Timer's.
+  template <typename T = base::normal, typename F>
+  auto TrySubmitNow(F&& task) -> typename std::enable_if<is_lane_tag<T>::value, Admission>::type {
+    return push_tagged<T>(now_ns(), make_task(std::forward<F>(task)), false);
+  }
+
+  // Submit a task that runs after the earlier ones of the same key and
+  // never alongside them, and return false if a bounded branch rejected
+  // it. Tasks of different keys run in parallel. Keys are hashed with
+  // std::hash, colliding keys share an order.
+  template <typename K, typename F,
+            typename R = base::result_of_t<F>,
+            typename DR = typename std::enable_if<std::is_void<R>::value>::type>
+  bool SubmitKeyed(const K& key, F&& task) {
+    return strands().Submit(std::hash<K>()(key), make_task(std::forward<F>(task)));
+  }
+
+  // Submit a keyed task, and return std::future<R>, broken if rejected
+  template <typename K, typename F,
+            typename R = base::result_of_t<F>,
+            typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
+  std::future<R> SubmitKeyed(const K& key, F&& task) {
+    PromiseTask<typename std::decay<F>::type, R> exec(std::forward<F>(task));
+    std::future<R> res = exec.promise.get_future();
+    strands().Submit(std::hash<K>()(key), make_task(std::move(exec)));
+    return res;
+  }
+
+  // Submit 'normal' task, and return base::FastFuture<R> whose state comes
+  // from the branch's pool
+  template <typename T = base::normal, typename F,
+            typename R = base::result_of_t<F>>
+  auto SubmitFast(F&& task) -> typename std::enable_if<std::is_same<T, base::normal>::value, base::FastFuture<R>>::type {
+    auto packed = base::MakeFutureTask<R>(future_pool_, std::forward<F>(task));
+    push_back_task(make_task(std::move(packed.second)));
+    return std::move(packed.first);
+  }
+
+  // Submit 'urgent' task, and return base::FastFuture<R>
+  template <typename T, typename F,
+            typename R = base::result_of_t<F>>
+  auto SubmitFast(F&& task) -> typename std::enable_if<std::is_same<T, base::urgent>::value, base::FastFuture<R>>::type {
+    auto packed = base::MakeFutureTask<R>(future_pool_, std::forward<F>(task));
+    push_front_task(make_task(std::move(packed.second)));
+    return std::move(packed.first);
   }
 
   // Submit sequence of tasks, and return void.
@@ -109,40 +473,996 @@ class WorkBranch {
             typename R = base::result_of_t<F>,
             typename DR = typename std::enable_if<std::is_void<R>::value>::type>
   auto Submit(F&& task, Fs&&... tasks) -> typename std::enable_if<std::is_same<T, base::sequence>::value>::type {
-    tasks_que_.push_back([=] {
-      recursive_exec(task, tasks...);
-    });
+    using Sequence = SequenceTask<typename std::decay<F>::type, typename std::decay<Fs>::type...>;
+    push_back_task(make_task(Sequence(std::forward<F>(task), std::forward<Fs>(tasks)...)));
   }
 
+  // Submit a batch of 'normal' or 'urgent' tasks with one queue operation.
+  // Returns void, or one std::future<R> per task for value-returning tasks.
+  // An urgent batch runs ahead of the queue in its original order.
+  template <typename T = base::normal, typename It,
+            typename R = base::result_of_t<typename std::iterator_traits<It>::value_type>>
+  auto SubmitBulk(It first, It last)
+      -> typename std::enable_if<is_priority_tag<T>::value, typename bulk_result<R>::type>::type {
+    return submit_bulk<T, R>(first, last, std::is_void<R>());
+  }
+
+  template <typename T = base::normal, typename F,
+            typename R = base::result_of_t<F>>
+  auto SubmitBulk(std::vector<F>&& tasks)
+      -> typename std::enable_if<is_priority_tag<T>::value, typename bulk_result<R>::type>::type {
+    return SubmitBulk<T>(std::make_move_iterator(tasks.begin()),
+                         std::make_move_iterator(tasks.end()));
+  }
+
+  // 'co_await branch.Schedule()' resumes a coroutine on one of the workers.
+  template <typename Self = BasicWorkBranch>
+  coro::ScheduleAwaiter<Self> Schedule() {
+    return coro::ScheduleAwaiter<Self>(*this);
+  }
+
+  // Pauses every worker until all of them have checked in. Queued tasks
+  // are not waited for, see WaitIdle().
   void WaitTasks() {
-    std::unique_lock<std::mutex> ulk(mtx_);
+    bool traced = tracing_.load(std::memory_order_relaxed);
+    if (traced) {
+      Tracer::Record(TraceKind::wait_begin, this, 0);
+    }
+    std::unique_lock<Mutex> ulk(mtx_);
     is_waiting_ = true;
-    waiting_cv_.wait(ulk, [this] { return tasks_done_ >= workers_map_.size();});
-    assert(tasks_done_ >= workers_map_.size());
+    wake_all();
+    waiting_cv_.wait(ulk, [this] { return tasks_done_ >= workers_map_.size() - reserved_;});
+    assert(tasks_done_ >= workers_map_.size() - reserved_);
     
     is_waiting_ = false;
     tasks_done_ = 0;
     recover_cv_.notify_all();
+    if (traced) {
+      Tracer::Record(TraceKind::wait_end, this, 0);
+    }
   }
 
+  // Blocks until every task submitted so far, and those they submit, has
+  // finished, without pausing the workers. Must not be called from a task
+  // of this branch.
+  void WaitIdle() {
+    std::unique_lock<Mutex> ulk(mtx_);
+    idle_waiters_ ++;
+    drained_cv_.wait(ulk, [this] { return pending_ == 0; });
+    idle_waiters_ --;
+  }
+
+  // False on timeout.
+  template <typename Rep, typename Period>
+  bool WaitIdle(const std::chrono::duration<Rep, Period>& timeout) {
+    std::unique_lock<Mutex> ulk(mtx_);
+    idle_waiters_ ++;
+    bool idle = drained_cv_.wait_for(ulk, timeout, [this] { return pending_ == 0; });
+    idle_waiters_ --;
+    return idle;
+  }
+
+  // Tasks submitted and not finished yet, running ones included.
+  std::size_t PendingNum() const {
+    return pending_.load(std::memory_order_relaxed);
+  }
+
+  // Workers that are about to leave or in the reserve are not counted.
   std::size_t WorkersNum() {
-    std::lock_guard<std::mutex> lock(mtx_);
-    return workers_map_.size();
+    std::lock_guard<Mutex> lock(mtx_);
+    return workers_num();
+  }
+
+  // Workers parked in the reserve.
+  std::size_t ReservedNum() {
+    std::lock_guard<Mutex> lock(mtx_);
+    return reserved_;
+  }
+
+  // Node given in the options, -1 if none.
+  int NumaNode() const {
+    return options_.numa_node;
+  }
+
+  // Records submissions, runs, worker changes and WaitTasks() barriers to
+  // the Tracer. Off, each of them costs one test of a flag.
+  void SetTracing(bool enable) {
+    tracing_.store(enable, std::memory_order_relaxed);
+  }
+
+  bool Tracing() const {
+    return tracing_.load(std::memory_order_relaxed);
+  }
+
+  // Priority lanes, 0 if none.
+  std::size_t LanesNum() const {
+    return lanes_.lanes();
   }
 
   std::size_t TasksNum() {
-    std::lock_guard<std::mutex> lock(mtx_);
-    return tasks_que_.size();
+    std::lock_guard<Mutex> lock(mtx_);
+    return tasks_que_.size() + local_tasks_num() + lane_tasks_num();
+  }
+
+  // False while a bounded branch is full or shedding. A hint for
+  // dispatchers, read without locking.
+  bool HasRoom() const {
+    return !shedding_.load(std::memory_order_relaxed) &&
+           (options_.capacity == 0 || queued_.load(std::memory_order_relaxed) < options_.capacity);
+  }
+
+  // Approximate load without taking any lock.
+  LoadHint Hint() const {
+    LoadHint hint;
+    hint.queued = queued_.load(std::memory_order_relaxed);
+    hint.workers = active_.load(std::memory_order_relaxed);
+    hint.run_ns = run_ns_.load(std::memory_order_relaxed);
+    return hint;
+  }
+
+  // Moves up to 'max' queued tasks, oldest first, to 'target' and returns
+  // how many. Tasks in the deques of work stealing stay. Moved tasks keep
+  // their lane and enqueue time, not their deadline, and bypass the
+  // target's capacity.
+  std::size_t MigrateTo(BasicWorkBranch& target, std::size_t max) {
+    std::vector<Job> batch;
+    Job job;
+    while (batch.size() < max && (has_lanes() ? lanes_.try_pop(job) : tasks_que_.try_pop(job))) {
+      forget_urgent(job);
+      batch.push_back(std::move(job));
+    }
+    std::size_t num = batch.size();
+    if (num == 0) {
+      return 0;
+    }
+    queued_.fetch_sub(num);
+    if (blocked_ > 0) {
+      std::lock_guard<std::mutex> lock(room_mtx_);
+      room_cv_.notify_all();
+    }
+    migrated_out_.fetch_add(num, std::memory_order_relaxed);
+    target.take_migrated(batch);
+    for (std::size_t i = 0; i < num; i ++) {
+      count_finished();
+    }
+    return num;
+  }
+
+  BranchSnapshot Snapshot() const {
+    BranchSnapshot snap;
+    LoadHint hint = Hint();
+    snap.time_ns = now_ns();
+    snap.workers = hint.workers;
+    snap.queued = hint.queued;
+    snap.submitted = submitted_.load(std::memory_order_relaxed);
+    snap.urgent = urgent_.load(std::memory_order_relaxed);
+    snap.rejected = rejected_.load(std::memory_order_relaxed);
+    snap.shed = shed_.load(std::memory_order_relaxed);
+    snap.dropped = dropped_.load(std::memory_order_relaxed);
+    snap.caller_ran = caller_ran_.load(std::memory_order_relaxed);
+    snap.migrated_in = migrated_in_.load(std::memory_order_relaxed);
+    snap.migrated_out = migrated_out_.load(std::memory_order_relaxed);
+    std::size_t slots_num = slots_num_.load(std::memory_order_acquire);
+    SlotTable* table = slot_table_.load(std::memory_order_acquire);
+    snap.lane_wait_ns.resize(lanes_.lanes());
+    for (std::size_t i = 0; i < slots_num; i ++) {
+      const WorkerMetrics& metrics = table->slots[i]->metrics;
+      snap.completed += metrics.completed.load(std::memory_order_relaxed);
+      snap.steals += metrics.steals.load(std::memory_order_relaxed);
+      snap.busy_ns += metrics.busy_ns.load(std::memory_order_relaxed);
+      snap.idle_ns += metrics.idle_ns.load(std::memory_order_relaxed);
+      std::uint64_t idle_since = metrics.idle_since.load(std::memory_order_relaxed);
+      if (idle_since != 0 && idle_since < snap.time_ns) {
+        snap.idle_ns += snap.time_ns - idle_since;
+      }
+      metrics.wait_ns.CopyTo(snap.wait_ns);
+      metrics.run_ns.CopyTo(snap.run_ns);
+      for (std::size_t l = 0; l < snap.lane_wait_ns.size(); l ++) {
+        metrics.lane_wait_ns[l].CopyTo(snap.lane_wait_ns[l]);
+      }
+    }
+    return snap;
   }
 
  private:
-  void process() {
+  template <typename Branch>
+  friend class MigrationGroup;
+
+  // A task, the time it was submitted, its lane if any, and its Tracer id
+  // if it was traced.
+  struct Job {
+    Job() = default;
+    Job(Task&& fn, std::uint64_t ns, std::size_t l = 0)
+        : task(std::move(fn)), enqueued_ns(ns), lane((std::uint16_t)l) { }
+    Task task;
+    std::uint64_t enqueued_ns = 0;
+    std::uint16_t lane = 0;
+    bool urgent = false;          // counted in 'urgent_pending_'
+    std::uint32_t trace = 0;
+  };
+
+  // Written only by the worker owning the slot, read by Snapshot().
+  struct WorkerMetrics {
+    std::atomic<std::uint64_t> completed{0};
+    std::atomic<std::uint64_t> steals{0};
+    std::atomic<std::uint64_t> busy_ns{0};
+    std::atomic<std::uint64_t> idle_ns{0};
+    std::atomic<std::uint64_t> idle_since{0};   // 0 while busy
+    base::AtomicHistogram wait_ns;
+    base::AtomicHistogram run_ns;
+    std::unique_ptr<base::AtomicHistogram[]> lane_wait_ns;   // one per lane
+  };
+
+  // A job in a deque of work stealing. Nodes go back to the slot whose
+  // deque held them, see take_node().
+  struct LocalJob {
+    Job job;
+    LocalJob* next = nullptr;
+  };
+
+  // Per-worker state. Slots live as long as the branch and are recycled
+  // by later workers, so thieves may scan them without locking.
+  struct WorkerSlot {
+    explicit WorkerSlot(BasicWorkBranch* branch) : owner(branch) {
+      std::size_t lanes = branch->lanes_.lanes();
+      if (lanes > 0) {
+        metrics.lane_wait_ns.reset(new base::AtomicHistogram[lanes]);
+      }
+    }
+    ~WorkerSlot() {
+      LocalJob* node = nullptr;
+      while (deque.pop(node)) {
+        delete node;
+      }
+      free_nodes(spare);
+      free_nodes(returned.load(std::memory_order_relaxed));
+    }
+    static void free_nodes(LocalJob* node) {
+      while (node != nullptr) {
+        LocalJob* next = node->next;
+        delete node;
+        node = next;
+      }
+    }
+    BasicWorkBranch* const owner;
+    WorkStealingDeque<LocalJob*> deque;
+    LocalJob* spare = nullptr;                        // owner only
+    std::atomic<LocalJob*> returned{nullptr};         // by thieves
+    WorkerMetrics metrics;
+  };
+
+  // Append-only table of slots, published for lock-free readers. A grown
+  // table replaces the old one, which stays alive until destruction.
+  struct SlotTable {
+    explicit SlotTable(std::size_t cap)
+        : capacity(cap), slots(new WorkerSlot*[cap]()) { }
+    const std::size_t capacity;
+    std::unique_ptr<WorkerSlot*[]> slots;
+  };
+
+  static std::vector<int> resolve_cpuset(const BranchOptions& options) {
+    std::vector<int> cpus = options.cpus;
+    if (options.numa_node >= 0) {
+      std::vector<int> node = base::NodeCpus(options.numa_node);
+      if (cpus.empty()) {
+        cpus = node;
+      } else {
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&node](int cpu) {
+          return std::find(node.begin(), node.end(), cpu) == node.end();
+        }), cpus.end());
+      }
+    } else if (cpus.empty() && options.pin_workers) {
+      cpus = base::OnlineCpus();
+    }
+    return cpus;
+  }
+
+  // On failure the worker keeps floating.
+  void place(int cpu) {
+    if (cpu >= 0) {
+      base::SetThreadAffinity(std::vector<int>(1, cpu));
+    } else if (!cpuset_.empty()) {
+      base::SetThreadAffinity(cpuset_);
+    }
+  }
+
+  StrandTable<BasicWorkBranch>& strands() {
+    std::call_once(strands_once_, [this] { strands_.reset(new StrandTable<BasicWorkBranch>(*this)); });
+    return *strands_;
+  }
+
+  static WorkerSlot*& current_slot() {
+    static thread_local WorkerSlot* slot = nullptr;
+    return slot;
+  }
+
+  WorkerSlot* local_slot() {
+    WorkerSlot* slot = current_slot();
+    return (options_.work_stealing && slot != nullptr && slot->owner == this) ? slot : nullptr;
+  }
+
+  static std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static std::uint64_t to_ns(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  }
+
+  static Task make_task(Task&& task) {
+    return std::move(task);
+  }
+
+  template <typename F>
+  static Task make_task(F&& func) {
+    return Task(std::allocator_arg, typename task_allocator<QueuePolicy>::type(), std::forward<F>(func));
+  }
+
+  // For single-writer counters.
+  static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  template <typename T, typename R, typename It>
+  void submit_bulk(It first, It last, std::true_type /* void */) {
+    std::vector<Job> batch;
+    std::uint64_t now = now_ns();
+    for (; first != last; ++ first) {
+      batch.emplace_back(make_task(*first), now);
+    }
+    push_tasks(batch, std::is_same<T, base::urgent>::value);
+  }
+
+  template <typename T, typename R, typename It>
+  std::vector<std::future<R>> submit_bulk(It first, It last, std::false_type /* void */) {
+    using Exec = PromiseTask<typename std::iterator_traits<It>::value_type, R>;
+    std::vector<Job> batch;
+    std::vector<std::future<R>> futures;
+    std::uint64_t now = now_ns();
+    for (; first != last; ++ first) {
+      Exec exec(*first);
+      futures.emplace_back(exec.promise.get_future());
+      batch.emplace_back(make_task(std::move(exec)), now);
+    }
+    push_tasks(batch, std::is_same<T, base::urgent>::value);
+    return futures;
+  }
+
+  void push_tasks(std::vector<Job>& batch, bool urgent) {
+    admit_bulk(batch);
+    if (batch.empty()) {
+      return;
+    }
+    count_submitted(batch.size());
+    if (tracing_.load(std::memory_order_relaxed)) {
+      for (Job& job : batch) {
+        trace_submit(job);
+      }
+    }
+    if (urgent) {
+      urgent_.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+    if (has_lanes()) {
+      std::size_t lane = urgent ? 0 : lanes_.lanes() - 1;
+      for (Job& job : batch) {
+        job.lane = (std::uint16_t)lane;
+      }
+      lanes_.push_bulk(lane, batch.front().enqueued_ns,
+                       std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+      wake(batch.size());
+      return;
+    }
+    WorkerSlot* slot = local_slot();
+    if (slot != nullptr) {
+      if (urgent) {
+        // Pushed in reverse so that the owner pops them in order.
+        for (auto it = batch.rbegin(); it != batch.rend(); ++ it) {
+          slot->deque.push(take_node(slot, std::move(*it)));
+        }
+      } else {
+        for (auto it = batch.begin(); it != batch.end(); ++ it) {
+          slot->deque.push(take_node(slot, std::move(*it)));
+        }
+      }
+      wake(batch.size());
+      return;
+    }
+
+    // Bounded queues take big batches in pieces, otherwise the submitter
+    // could wait for room while the workers are still parked.
+    std::size_t piece = max_batch(tasks_que_, 0);
+    for (std::size_t begin = 0; begin < batch.size(); begin += piece) {
+      std::size_t end = std::min(batch.size(), begin + piece);
+      auto first = std::make_move_iterator(batch.begin() + begin);
+      auto last = std::make_move_iterator(batch.begin() + end);
+      for (std::size_t i = begin; i < end; i ++) {
+        batch[i].urgent = urgent && options_.work_stealing;
+      }
+      enqueue_bulk(first, last, urgent);
+      if (urgent && options_.work_stealing) {
+        urgent_pending_ += end - begin;
+      }
+      wake(end - begin);
+    }
+  }
+
+  template <typename Queue>
+  static auto max_batch(const Queue& que, int) -> decltype(que.max_batch()) {
+    return std::max<std::size_t>(1, que.max_batch());
+  }
+
+  template <typename Queue>
+  static std::size_t max_batch(const Queue&, long) {
+    return SIZE_MAX;
+  }
+
+  // Queued tasks are counted by admit() and admit_bulk().
+  void count_submitted(std::size_t num) {
+    pending_.fetch_add(num, std::memory_order_relaxed);
+    submitted_.fetch_add(num, std::memory_order_relaxed);
+  }
+
+  bool bounded() const {
+    return options_.capacity > 0 || options_.shed_target.count() > 0;
+  }
+
+  // Called with 'mtx_' held.
+  std::size_t workers_num() const {
+    std::size_t gone = declines_ + reserved_;
+    return workers_map_.size() > gone ? workers_map_.size() - gone : 0;
+  }
+
+  bool in_worker() {
+    WorkerSlot* slot = current_slot();
+    return slot != nullptr && slot->owner == this;
+  }
+
+  // Counts up to 'num' more queued tasks within the capacity, returns how
+  // many fit.
+  std::size_t reserve(std::size_t num) {
+    if (options_.capacity == 0) {
+      queued_.fetch_add(num);
+      return num;
+    }
+    std::size_t queued = queued_.load();
+    std::size_t fits = 0;
+    do {
+      fits = queued < options_.capacity ? std::min(num, options_.capacity - queued) : 0;
+      if (fits == 0) {
+        return 0;
+      }
+    } while (!queued_.compare_exchange_weak(queued, queued + fits));
+    return fits;
+  }
+
+  // Makes room for one task. Leaves 'task' to be queued if admitted, takes
+  // it otherwise: runs it with caller_runs, destroys it if rejected or
+  // shed. Without 'wait', block and caller_runs reject.
+  Admission admit(Task& task, bool wait = true) {
+    if (!bounded() || in_worker()) {
+      queued_.fetch_add(1, std::memory_order_relaxed);
+      return Admission::accepted;
+    }
+    if (shedding_.load(std::memory_order_relaxed)) {
+      task = nullptr;
+      shed_.fetch_add(1, std::memory_order_relaxed);
+      return Admission::shed;
+    }
+    if (reserve(1) == 1) {
+      return Admission::accepted;
+    }
+    Overflow overflow = options_.overflow;
+    if (!wait && overflow != Overflow::drop_oldest) {
+      overflow = Overflow::reject;
+    }
+    switch (overflow) {
+      case Overflow::block:
+        if (wait_room()) {
+          return Admission::accepted;
+        }
+        break;
+      case Overflow::caller_runs: {
+        Task run(std::move(task));
+        caller_ran_.fetch_add(1, std::memory_order_relaxed);
+        run();
+        return Admission::accepted;
+      }
+      case Overflow::drop_oldest:
+        drop_oldest();
+        return Admission::accepted;
+      case Overflow::reject:
+        break;
+    }
+    task = nullptr;
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return Admission::rejected;
+  }
+
+  // Queues what fits at once, the rest goes through admit() one by one.
+  // Erases the jobs not admitted.
+  void admit_bulk(std::vector<Job>& batch) {
+    if (!bounded() || in_worker()) {
+      queued_.fetch_add(batch.size(), std::memory_order_relaxed);
+      return;
+    }
+    std::size_t fits = shedding_.load(std::memory_order_relaxed) ? 0 : reserve(batch.size());
+    if (fits == batch.size()) {
+      return;
+    }
+    for (std::size_t i = fits; i < batch.size(); i ++) {
+      admit(batch[i].task);
+    }
+    batch.erase(std::remove_if(batch.begin() + fits, batch.end(), [](const Job& job) {
+      return !job.task;
+    }), batch.end());
+  }
+
+  // Pairs with the notification in process(): either the worker sees the
+  // blocked submitter, or the submitter sees the room.
+  bool wait_room() {
+    std::unique_lock<std::mutex> ulk(room_mtx_);
+    blocked_ ++;
+    auto has_room = [this] { return reserve(1) == 1; };
+    bool admitted = true;
+    if (options_.block_timeout.count() > 0) {
+      admitted = room_cv_.wait_for(ulk, options_.block_timeout, has_room);
+    } else {
+      room_cv_.wait(ulk, has_room);
+    }
+    blocked_ --;
+    return admitted;
+  }
+
+  // Destroys the tasks next in line until one more fits. Tasks in the
+  // deques of work stealing are left alone, meanwhile the submitter yields.
+  void drop_oldest() {
+    while (reserve(1) == 0) {
+      Job oldest;
+      if (has_lanes() ? lanes_.try_pop(oldest) : tasks_que_.try_pop(oldest)) {
+        forget_urgent(oldest);
+        queued_.fetch_sub(1);
+        count_finished();
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Once every task started during a whole interval waited longer than
+  // the target, as in CoDel, the branch sheds new submissions. Workers may
+  // race on these hints.
+  void track_sojourn(std::uint64_t now, std::uint64_t wait) {
+    std::uint64_t target = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.shed_target).count();
+    if (wait < target) {
+      above_since_.store(0, std::memory_order_relaxed);
+      shedding_.store(false, std::memory_order_relaxed);
+      return;
+    }
+    std::uint64_t since = above_since_.load(std::memory_order_relaxed);
+    if (since == 0) {
+      above_since_.store(now, std::memory_order_relaxed);
+    } else if (now - since >= (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   options_.shed_interval).count()) {
+      shedding_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  // Pairs with WaitIdle(): either the waiter sees no pending task, or the
+  // worker finishing the last one sees the waiter.
+  void count_finished() {
+    if (pending_.fetch_sub(1) == 1 && idle_waiters_ > 0) {
+      std::lock_guard<Mutex> lock(mtx_);
+      drained_cv_.notify_all();
+    }
+  }
+
+  Admission push_back_task(Task&& task, bool wait = true) {
+    Admission admission = admit(task, wait);
+    if (!task) {
+      return admission;
+    }
+    if (has_lanes()) {
+      push_lane_task(SIZE_MAX, now_ns(), std::move(task));
+      return admission;
+    }
+    count_submitted(1);
+    Job job(std::move(task), now_ns());
+    if (tracing_.load(std::memory_order_relaxed)) {
+      trace_submit(job);
+    }
+    WorkerSlot* slot = local_slot();
+    if (slot != nullptr) {
+      slot->deque.push(take_node(slot, std::move(job)));
+    } else {
+      enqueue(std::move(job), false);
+    }
+    wake_one();
+    return admission;
+  }
+
+  // Inside a worker the owner pops its deque LIFO, so the task runs next
+  // either way; outside, the counter sends workers to the shared queue
+  // before their own deques.
+  Admission push_front_task(Task&& task, bool wait = true) {
+    Admission admission = admit(task, wait);
+    if (!task) {
+      return admission;
+    }
+    urgent_.fetch_add(1, std::memory_order_relaxed);
+    if (has_lanes()) {
+      push_lane_task(0, now_ns(), std::move(task));
+      return admission;
+    }
+    count_submitted(1);
+    Job job(std::move(task), now_ns());
+    if (tracing_.load(std::memory_order_relaxed)) {
+      trace_submit(job);
+    }
+    WorkerSlot* slot = local_slot();
+    if (slot != nullptr) {
+      slot->deque.push(take_node(slot, std::move(job)));
+    } else {
+      job.urgent = options_.work_stealing;
+      enqueue(std::move(job), true);
+      if (options_.work_stealing) {
+        urgent_pending_ ++;
+      }
+    }
+    wake_one();
+    return admission;
+  }
+
+  // Only workers make room in a bounded queue, so a worker pushing into a
+  // full one runs a queued task meanwhile rather than wait for itself.
+  void enqueue(Job&& job, bool front) {
+    if (in_worker()) {
+      push_as_worker(tasks_que_, job, front, 0);
+    } else if (front) {
+      tasks_que_.push_front(std::move(job));
+    } else {
+      tasks_que_.push_back(std::move(job));
+    }
+  }
+
+  template <typename It>
+  void enqueue_bulk(It first, It last, bool front) {
+    if (in_worker() && bounded_queue(&tasks_que_, 0)) {
+      for (; first != last; ++ first) {
+        Job job(*first);
+        push_as_worker(tasks_que_, job, front, 0);
+      }
+    } else if (front) {
+      tasks_que_.push_front_bulk(first, last);
+    } else {
+      tasks_que_.push_back_bulk(first, last);
+    }
+  }
+
+  template <typename Queue>
+  auto push_as_worker(Queue& que, Job& job, bool front, int)
+      -> decltype(que.try_push_back(std::move(job)), void()) {
+    while (!(front ? que.try_push_front(std::move(job)) : que.try_push_back(std::move(job)))) {
+      help();
+    }
+  }
+
+  template <typename Queue>
+  void push_as_worker(Queue& que, Job& job, bool front, long) {
+    if (front) {
+      que.push_front(std::move(job));
+    } else {
+      que.push_back(std::move(job));
+    }
+  }
+
+  template <typename Queue>
+  static constexpr auto bounded_queue(Queue* que, int) -> decltype(que->try_push_back(std::declval<Job>()), true) {
+    return true;
+  }
+
+  template <typename Queue>
+  static constexpr bool bounded_queue(Queue*, long) {
+    return false;
+  }
+
+  // Runs a task of the shared queue on the current worker, to make room.
+  void help() {
+    Job job;
+    if (tasks_que_.try_pop(job)) {
+      run_fetched(current_slot(), job);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  bool has_lanes() const {
+    return lanes_.lanes() > 0;
+  }
+
+  static std::size_t lane_index(base::normal) { return SIZE_MAX; }    // the last one
+  static std::size_t lane_index(base::urgent) { return 0; }
+
+  template <std::size_t N>
+  static std::size_t lane_index(base::lane<N>) { return N; }
+
+  // Without lanes, lane tags and deadlines fall back to 'normal' tasks.
+  template <typename T>
+  Admission push_tagged(std::uint64_t key, Task&& task, bool wait = true) {
+    if (!has_lanes()) {
+      if (std::is_same<T, base::urgent>::value) {
+        return push_front_task(std::move(task), wait);
+      }
+      return push_back_task(std::move(task), wait);
+    }
+    Admission admission = admit(task, wait);
+    if (!task) {
+      return admission;
+    }
+    if (std::is_same<T, base::urgent>::value) {
+      urgent_.fetch_add(1, std::memory_order_relaxed);
+    }
+    push_lane_task(lane_index(T()), key, std::move(task));
+    return admission;
+  }
+
+  // 'key' orders the task inside its lane, 'lane' is clamped to the last.
+  // The task was admitted already.
+  void push_lane_task(std::size_t lane, std::uint64_t key, Task&& task) {
+    count_submitted(1);
+    lane = std::min(lane, lanes_.lanes() - 1);
+    Job job(std::move(task), now_ns(), lane);
+    if (tracing_.load(std::memory_order_relaxed)) {
+      trace_submit(job);
+    }
+    lanes_.push(lane, key, std::move(job));
+    wake_one();
+  }
+
+  void trace_submit(Job& job) {
+    job.trace = Tracer::NextTask();
+    Tracer::Record(TraceKind::submit, this, job.trace, TraceLabel::current());
+  }
+
+  // The other half of MigrateTo(), only the local workers are woken.
+  void take_migrated(std::vector<Job>& batch) {
+    std::size_t num = batch.size();
+    queued_.fetch_add(num);
+    pending_.fetch_add(num);
+    migrated_in_.fetch_add(num, std::memory_order_relaxed);
+    if (has_lanes()) {
+      for (Job& job : batch) {
+        job.lane = (std::uint16_t)std::min<std::size_t>(job.lane, lanes_.lanes() - 1);
+        std::uint64_t key = job.enqueued_ns;
+        lanes_.push(job.lane, key, std::move(job));
+      }
+    } else {
+      enqueue_bulk(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()), false);
+    }
+    notify_parked(num);
+  }
+
+  std::size_t lane_tasks_num() {
+    return has_lanes() ? lanes_.size() : 0;
+  }
+
+  // Called with 'mtx_' held.
+  WorkerSlot* acquire_slot() {
+    if (!free_slots_.empty()) {
+      WorkerSlot* slot = free_slots_.back();
+      free_slots_.pop_back();
+      return slot;
+    }
+    std::size_t num = slots_.size();
+    slots_.emplace_back(new WorkerSlot(this));
+    SlotTable* table = slot_table_.load(std::memory_order_relaxed);
+    if (table == nullptr || table->capacity <= num) {
+      SlotTable* bigger = new SlotTable(table == nullptr ? 16 : table->capacity * 2);
+      for (std::size_t i = 0; i < num; i ++) {
+        bigger->slots[i] = table->slots[i];
+      }
+      slot_tables_.emplace_back(bigger);
+      table = bigger;
+    }
+    table->slots[num] = slots_.back().get();
+    slot_table_.store(table, std::memory_order_release);
+    slots_num_.store(num + 1, std::memory_order_release);
+    return slots_.back().get();
+  }
+
+  // Called with 'mtx_' held by an exiting worker.
+  void release_slot(WorkerSlot* slot) {
+    drain_slot(slot);
+    current_slot() = nullptr;
+    free_slots_.push_back(slot);
+  }
+
+  // Hands the tasks of the slot's deque to the others before its worker
+  // declines. Called without 'mtx_': the shared queue may be full, then a
+  // task that does not fit runs here.
+  void hand_off(WorkerSlot* slot) {
+    LocalJob* node = nullptr;
+    while (slot->deque.pop(node)) {
+      Job own(std::move(node->job));
+      give_back(slot, node);
+      requeue(tasks_que_, own, 0);
+      wake_one();
+    }
+  }
+
+  template <typename Queue>
+  auto requeue(Queue& que, Job& job, int) -> decltype(que.try_push_back(std::move(job)), void()) {
+    if (!que.try_push_back(std::move(job))) {
+      run_fetched(current_slot(), job);
+    }
+  }
+
+  template <typename Queue>
+  void requeue(Queue& que, Job& job, long) {
+    que.push_back(std::move(job));
+  }
+
+  // Stops counting the idle time of a slot whose deque was handed off.
+  // Called with 'mtx_' held.
+  void drain_slot(WorkerSlot* slot) {
+    WorkerMetrics& metrics = slot->metrics;
+    std::uint64_t idle_since = metrics.idle_since.load(std::memory_order_relaxed);
+    if (idle_since != 0) {
+      bump(metrics.idle_ns, now_ns() - idle_since);
+      metrics.idle_since.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Parks a declining worker in the reserve, keeping its slot. True if it
+  // goes back to work: revived by AddWorker(), or to take its decline from
+  // the destructor. False once 'reserve_timeout' passed, then it exits.
+  bool hibernate(WorkerSlot* slot, std::unique_lock<Mutex>& ulk) {
+    drain_slot(slot);
+    reserved_ ++;
+    if (is_waiting_) {
+      waiting_cv_.notify_one();
+    }
+    bool woken = reserve_cv_.wait_for(ulk, options_.reserve_timeout, [this] {
+      return revivals_ > 0 || is_destructing_;
+    });
+    if (woken && revivals_ > 0) {
+      revivals_ --;       // AddWorker() took it out of the reserve
+      return true;
+    }
+    reserved_ --;
+    return woken;
+  }
+
+  std::size_t local_tasks_num() {
+    std::size_t num = 0;
+    if (options_.work_stealing) {
+      std::size_t slots_num = slots_num_.load(std::memory_order_acquire);
+      SlotTable* table = slot_table_.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < slots_num; i ++) {
+        num += table->slots[i]->deque.size();
+      }
+    }
+    return num;
+  }
+
+  // Owner only. Reuses a spare node, or the ones thieves gave back, and
+  // allocates only when there is none.
+  static LocalJob* take_node(WorkerSlot* slot, Job&& job) {
+    LocalJob* node = slot->spare;
+    if (node == nullptr) {
+      node = slot->returned.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (node == nullptr) {
+      node = new LocalJob();
+    } else {
+      slot->spare = node->next;
+    }
+    node->job = std::move(job);
+    return node;
+  }
+
+  // Owner only.
+  static void give_back(WorkerSlot* slot, LocalJob* node) {
+    node->next = slot->spare;
+    slot->spare = node;
+  }
+
+  // Any thread, for a node stolen from 'victim'.
+  static void give_back_stolen(WorkerSlot* victim, LocalJob* node) {
+    LocalJob* head = victim->returned.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!victim->returned.compare_exchange_weak(head, node, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+  }
+
+  bool steal(WorkerSlot* thief, Job& job) {
+    std::size_t slots_num = slots_num_.load(std::memory_order_acquire);
+    SlotTable* table = slot_table_.load(std::memory_order_acquire);
+    std::size_t start = base::fast_rand() % slots_num;
+    for (std::size_t i = 0; i < slots_num; i ++) {
+      WorkerSlot* victim = table->slots[(start + i) % slots_num];
+      LocalJob* stolen = nullptr;
+      if (victim != thief && victim->deque.steal(stolen)) {
+        job = std::move(stolen->job);
+        give_back_stolen(victim, stolen);
+        bump(thief->metrics.steals, 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // For an urgent job leaving the shared queue unrun, so that workers do
+  // not keep looking for it there first.
+  void forget_urgent(Job& job) {
+    if (job.urgent) {
+      job.urgent = false;
+      claim_urgent();
+    }
+  }
+
+  bool claim_urgent() {
+    std::size_t pending = urgent_pending_.load(std::memory_order_relaxed);
+    while (pending > 0) {
+      if (urgent_pending_.compare_exchange_weak(pending, pending - 1)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool fetch(WorkerSlot* slot, Job& job) {
+    if (has_lanes()) {
+      return lanes_.try_pop(job);
+    }
+    if (!options_.work_stealing) {
+      return tasks_que_.try_pop(job);
+    }
+    if (claim_urgent() && tasks_que_.try_pop(job)) {
+      return true;
+    }
+    LocalJob* local = nullptr;
+    if (slot->deque.pop(local)) {
+      job = std::move(local->job);
+      give_back(slot, local);
+      return true;
+    }
+    return tasks_que_.try_pop(job) || steal(slot, job);
+  }
+
+  bool has_tasks() {
+    if (!tasks_que_.empty() || lane_tasks_num() > 0) {
+      return true;
+    }
+    // Pairs with the fence in wake_one() for tasks pushed to local deques.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return local_tasks_num() > 0;
+  }
+
+  void process(int cpu) {
+    place(cpu);
+    WorkerSlot* slot = nullptr;
+    {
+      std::lock_guard<Mutex> lock(mtx_);
+      slot = acquire_slot();
+    }
+    current_slot() = slot;
+    slot->metrics.idle_since.store(now_ns(), std::memory_order_relaxed);
+    std::size_t idle_rounds = 0;
     while(true) {
-      Task task;
+      Job job;
       if (declines_ > 0) {
-        std::lock_guard<std::mutex> lock(mtx_);
+        hand_off(slot);
+        std::unique_lock<Mutex> ulk(mtx_);
         if (declines_ > 0) {    // double check
           declines_ --;
+          if (!is_destructing_ && reserved_ < options_.reserve_workers && hibernate(slot, ulk)) {
+            idle_rounds = 0;
+            continue;
+          }
+          release_slot(slot);
           workers_map_.erase(std::this_thread::get_id());
           if (is_destructing_) {
             destructing_cv_.notify_one();
@@ -156,46 +1476,233 @@ class WorkBranch {
       }
 
       if (is_waiting_) {
-        std::unique_lock<std::mutex> ulk(mtx_);
+        std::unique_lock<Mutex> ulk(mtx_);
         tasks_done_ ++;
         waiting_cv_.notify_one();
         recover_cv_.wait(ulk);
       }
 
-      if (tasks_que_.try_pop(task)) {
-        task();
+      if (fetch(slot, job)) {
+        idle_rounds = 0;
+        run_fetched(slot, job);
       } else {
-        std::this_thread::yield();
+        if (idle_rounds == 0) {
+          slot->metrics.idle_since.store(now_ns(), std::memory_order_relaxed);
+          shedding_.store(false, std::memory_order_relaxed);
+        }
+        idle(idle_rounds ++);
       }
     }
   }
 
-  template <typename F>
-  void recursive_exec(F&& task) {
-    task();
+  // A job just taken from a queue.
+  void run_fetched(WorkerSlot* slot, Job& job) {
+    queued_.fetch_sub(1);
+    if (tracing_.load(std::memory_order_relaxed)) {
+      Tracer::Record(TraceKind::dequeue, this, job.trace);
+    }
+    if (blocked_ > 0) {
+      std::lock_guard<std::mutex> lock(room_mtx_);
+      room_cv_.notify_one();
+    }
+    offer();    // the backlog may have grown while workers were waking
+    run(slot, job);
+    count_finished();
   }
-  
-  template <typename F, typename... Fs>
-  void recursive_exec(F&& task, Fs&&... tasks) {
-    task();
-    recursive_exec(std::forward<Fs>(tasks)...);
+
+  // Runs the job, records the worker's metrics and folds the run time into
+  // the EWMA (weight 1/8). Concurrent workers may overwrite each other's
+  // update, which is fine for a hint.
+  void run(WorkerSlot* slot, Job& job) {
+    WorkerMetrics& metrics = slot->metrics;
+    std::uint64_t begin = now_ns();
+    std::uint64_t idle_since = metrics.idle_since.load(std::memory_order_relaxed);
+    if (idle_since != 0) {
+      bump(metrics.idle_ns, begin - idle_since);
+      metrics.idle_since.store(0, std::memory_order_relaxed);
+    }
+    std::uint64_t wait = begin > job.enqueued_ns ? begin - job.enqueued_ns : 0;
+    metrics.wait_ns.Record(wait);
+    if (metrics.lane_wait_ns) {
+      metrics.lane_wait_ns[job.lane].Record(wait);
+    }
+    if (options_.shed_target.count() > 0) {
+      track_sojourn(begin, wait);
+    }
+    bool traced = tracing_.load(std::memory_order_relaxed);
+    if (traced) {
+      Tracer::Record(TraceKind::start, this, job.trace);
+    }
+    job.task();
+    if (traced) {
+      Tracer::Record(TraceKind::end, this, job.trace);
+    }
+    std::int64_t sample = (std::int64_t)(now_ns() - begin);
+    metrics.run_ns.Record(sample);
+    bump(metrics.busy_ns, sample);
+    bump(metrics.completed, 1);
+    std::int64_t ewma = (std::int64_t)run_ns_.load(std::memory_order_relaxed);
+    ewma = ewma == 0 ? sample : ewma + (sample - ewma) / 8;
+    run_ns_.store((std::uint64_t)std::max<std::int64_t>(1, ewma), std::memory_order_relaxed);
+  }
+
+  void idle(std::size_t round) {
+    if (round < options_.idle_spins) {
+      for (std::size_t i = 0; i < DEFAULT_IDLE_SPINS; i ++) {
+        base::cpu_relax();
+      }
+    } else if (round - options_.idle_spins < options_.idle_yields) {
+      std::this_thread::yield();
+    } else if (!migrate()) {
+      park();
+    }
+  }
+
+  // Before parking, a worker of a migration group takes tasks from a
+  // loaded sibling.
+  bool migrate() {
+    MigrationGroup<BasicWorkBranch>* group = migration_.load(std::memory_order_acquire);
+    return group != nullptr && group->Steal(*this) > 0;
   }
 
+  void park() {
+    std::unique_lock<std::mutex> ulk(idle_mtx_);
+    parked_ ++;
+    idle_cv_.wait(ulk, [this] {
+      return declines_ > 0 || is_waiting_ || nudged_.exchange(false) || has_tasks();
+    });
+    parked_ --;
+  }
+
+  // Called by the migration group: a parked worker gets up to steal.
+  void nudge() {
+    std::lock_guard<std::mutex> lock(idle_mtx_);
+    nudged_ = true;
+    idle_cv_.notify_one();
+  }
+
+  // With a backlog and no parked worker left, asks the migration group for
+  // help.
+  void offer() {
+    MigrationGroup<BasicWorkBranch>* group = migration_.load(std::memory_order_acquire);
+    if (group != nullptr && queued_.load(std::memory_order_relaxed) > active_.load(std::memory_order_relaxed)) {
+      group->Nudge(*this);
+    }
+  }
+
+  // Pairs with park(): the worker publishes 'parked_' before re-checking
+  // the queue, the submitter publishes the task before reading 'parked_'.
+  void wake_one() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_ > 0) {
+      std::lock_guard<std::mutex> lock(idle_mtx_);
+      idle_cv_.notify_one();
+    } else {
+      offer();
+    }
+  }
+
+  // Wakes as many parked workers as there are new tasks, at most.
+  void wake(std::size_t tasks) {
+    if (!notify_parked(tasks)) {
+      offer();
+    }
+  }
+
+  // False if no worker is parked.
+  bool notify_parked(std::size_t tasks) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_ == 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(idle_mtx_);
+    std::size_t parked = parked_;
+    for (std::size_t i = 0; i < tasks && i < parked; i ++) {
+      idle_cv_.notify_one();
+    }
+    return true;
+  }
+
+  void wake_all() {
+    std::lock_guard<std::mutex> lock(idle_mtx_);
+    idle_cv_.notify_all();
+  }
+
+  // Runs the callables one after another on the same worker.
+  template <typename... Fs>
+  struct SequenceTask {
+    template <typename... Args>
+    explicit SequenceTask(Args&&... args) : funcs(std::forward<Args>(args)...) { }
+    void operator()() {
+      exec(typename base::make_index_sequence<sizeof...(Fs)>::type());
+    }
+    template <std::size_t... Is>
+    void exec(base::index_sequence<Is...>) {
+      int order[] = { (std::get<Is>(funcs)(), 0)... };   // left to right
+      (void)order;
+    }
+    std::tuple<Fs...> funcs;
+  };
+
 
   std::size_t tasks_done_ = 0;
-  std::size_t declines_ = 0;                   // For Destructor and RemoveWorker
+  std::size_t reserved_ = 0;                    // Parked workers, under 'mtx_'
+  std::size_t revivals_ = 0;
+  std::atomic<std::size_t> declines_{0};       // For Destructor and RemoveWorker
   bool is_destructing_ = false;
-  bool is_waiting_ = false;
+  std::atomic<bool> is_waiting_{false};
+  std::atomic<std::size_t> parked_{0};
+  std::atomic<std::size_t> urgent_pending_{0};  // For work stealing mode
+  std::atomic<std::size_t> pending_{0};         // For WaitIdle
+  std::atomic<std::size_t> idle_waiters_{0};
+  std::atomic<std::size_t> queued_{0};          // Load hints
+  std::atomic<std::size_t> active_{0};
+  std::atomic<std::uint64_t> run_ns_{0};
+  std::atomic<std::uint64_t> submitted_{0};     // Metrics
+  std::atomic<std::uint64_t> urgent_{0};
+  std::atomic<std::uint64_t> rejected_{0};
+  std::atomic<std::uint64_t> shed_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<std::uint64_t> caller_ran_{0};
+  std::atomic<std::uint64_t> migrated_in_{0};
+  std::atomic<std::uint64_t> migrated_out_{0};
+  std::atomic<std::size_t> blocked_{0};         // For bounded branches
+  std::atomic<std::uint64_t> above_since_{0};
+  std::atomic<bool> shedding_{false};
+  std::atomic<MigrationGroup<BasicWorkBranch>*> migration_{nullptr};   // Set by the group
+  std::atomic<bool> nudged_{false};
+  std::atomic<bool> tracing_{false};
+
+  const BranchOptions options_;
+  const std::vector<int> cpuset_;               // empty: no restriction
+  std::size_t placed_ = 0;                      // workers pinned so far
+  std::unique_ptr<StrandTable<BasicWorkBranch>> strands_;   // Before the queues holding its turns
+  std::once_flag strands_once_;
+  base::LaneQueue<Job> lanes_;                  // empty without lane weights
+  base::FuturePool* const future_pool_;
 
-  std::condition_variable destructing_cv_;
-  std::condition_variable waiting_cv_;
-  std::condition_variable recover_cv_;
-  std::mutex mtx_;
+  CondVar destructing_cv_;
+  CondVar waiting_cv_;
+  CondVar recover_cv_;
+  CondVar drained_cv_;
+  std::condition_variable room_cv_;
+  CondVar reserve_cv_;
+  std::condition_variable idle_cv_;
+  Mutex mtx_;                                   // Profiled with COS_PROFILE_LOCKS
+  std::mutex idle_mtx_;
+  std::mutex room_mtx_;
 
   std::unordered_map<id, worker> workers_map_;
-  ThreadSafeQueue<Task> tasks_que_;
+  std::vector<std::unique_ptr<WorkerSlot>> slots_;
+  std::vector<WorkerSlot*> free_slots_;
+  std::vector<std::unique_ptr<SlotTable>> slot_tables_;
+  std::atomic<SlotTable*> slot_table_{nullptr};
+  std::atomic<std::size_t> slots_num_{0};
+  typename QueuePolicy::template type<Job> tasks_que_;
 };
 
+using WorkBranch = BasicWorkBranch<>;
+
 
 } // namespace workspace
 } // namespace cos
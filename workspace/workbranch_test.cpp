@@ -1,10 +1,49 @@
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
 #include "workbranch.h"
 
 using cos::workspace::WorkBranch;
+using cos::workspace::BranchOptions;
+using cos::workspace::BasicWorkBranch;
+using cos::workspace::LockFreeQueue;
+using cos::workspace::SlabQueue;
+using cos::workspace::BranchSnapshot;
+
+// Counts heap allocations made by the current thread.
+static thread_local std::size_t thread_allocations = 0;
+
+void* operator new(std::size_t size) {
+  thread_allocations ++;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
 
 TEST(WorkBranch, add_and_remove) {
   WorkBranch workers_pool(1000);
@@ -58,6 +97,778 @@ TEST(WorkBranch, submit) {
   sleep(1);
 }
 
+TEST(WorkBranch, idle_workers_park) {
+  WorkBranch workers_pool(16);
+  workers_pool.Submit([]{ return 0; }).get();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // Parked workers should not burn CPU while the branch is idle.
+  std::clock_t begin = std::clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  double cpu_ms = 1000.0 * (std::clock() - begin) / CLOCKS_PER_SEC;
+  std::cout << "idle cpu time: " << cpu_ms << " ms" << std::endl;
+  EXPECT_LT(cpu_ms, 50.0);
+}
+
+TEST(WorkBranch, bursty_wakeup) {
+  using clock = std::chrono::steady_clock;
+  BranchOptions options;
+  options.idle_spins = 0;
+  options.idle_yields = 0;   // park as soon as the queue is empty
+  WorkBranch workers_pool(4, options);
+
+  int64_t worst = 0;
+  for (int burst = 0; burst < 10; burst ++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::vector<std::future<int64_t>> results;
+    for (int i = 0; i < 100; i ++) {
+      auto submitted = clock::now();
+      results.emplace_back(workers_pool.Submit([submitted] {
+        return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            clock::now() - submitted).count();
+      }));
+    }
+    for (auto& res : results) {
+      worst = std::max(worst, res.get());
+    }
+  }
+  std::cout << "worst submit-to-start latency: " << worst << " us" << std::endl;
+  EXPECT_LT(worst, 200000);
+}
+
+TEST(WorkBranch, lockfree_queue) {
+  BasicWorkBranch<LockFreeQueue> workers_pool(4);
+  std::atomic<int> count(0);
+  for (int i = 0; i < 100000; i ++) {
+    workers_pool.Submit([&count]{ count ++; });
+  }
+  workers_pool.Submit<cos::base::urgent>([&count]{ count ++; });
+  std::future<int> res = workers_pool.Submit([]{ return 10; });
+  EXPECT_EQ(res.get(), 10);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (count.load() < 100001 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(count.load(), 100001);
+}
+
+// Recursive fan-out: every task below the leaves submits two children
+// from inside a worker, which land in that worker's own deque.
+static void FanOut(WorkBranch& branch, int depth, std::atomic<int>& leaves) {
+  if (depth == 0) {
+    leaves ++;
+    return;
+  }
+  branch.Submit([&branch, depth, &leaves] { FanOut(branch, depth - 1, leaves); });
+  branch.Submit([&branch, depth, &leaves] { FanOut(branch, depth - 1, leaves); });
+}
+
+TEST(WorkBranch, work_stealing) {
+  BranchOptions options;
+  options.work_stealing = true;
+  WorkBranch workers_pool(4, options);
+
+  std::atomic<int> leaves(0);
+  workers_pool.Submit([&workers_pool, &leaves] { FanOut(workers_pool, 14, leaves); });
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (leaves.load() < (1 << 14) && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(leaves.load(), 1 << 14);
+
+  std::future<int> res = workers_pool.Submit<cos::base::urgent>([]{ return 10; });
+  EXPECT_EQ(res.get(), 10);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(workers_pool.TasksNum(), 0);
+
+  // Removing workers hands their local tasks back to the shared queue.
+  workers_pool.RemoveWorker();
+  workers_pool.RemoveWorker();
+  workers_pool.WaitTasks();
+  EXPECT_EQ(workers_pool.WorkersNum(), 2);
+}
+
+TEST(WorkBranch, work_stealing_urgent_runs_next) {
+  BranchOptions options;
+  options.work_stealing = true;
+  WorkBranch workers_pool(1, options);
+
+  std::vector<int> order;
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  workers_pool.Submit([opened] { opened.wait(); });
+  for (int i = 0; i < 10; i ++) {
+    workers_pool.Submit([&order, i] { order.push_back(i); });
+  }
+  workers_pool.Submit<cos::base::urgent>([&order] { order.push_back(-1); });
+  gate.set_value();
+
+  std::future<int> res = workers_pool.Submit([]{ return 0; });
+  res.get();
+  ASSERT_EQ(order.size(), 11);
+  EXPECT_EQ(order.front(), -1);
+
+  // An urgent task submitted from inside a worker runs next on it.
+  order.clear();
+  workers_pool.Submit([&workers_pool, &order] {
+    workers_pool.Submit([&order] { order.push_back(2); });
+    workers_pool.Submit<cos::base::urgent>([&order] { order.push_back(1); });
+  });
+  workers_pool.Submit([]{ return 0; }).get();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_EQ(order.size(), 2);
+  EXPECT_EQ(order[0], 1);
+  EXPECT_EQ(order[1], 2);
+}
+
+TEST(WorkBranch, submit_without_allocation) {
+  BasicWorkBranch<LockFreeQueue> workers_pool(2);
+  std::atomic<int> count(0);
+  int a = 1, b = 2, c = 3;
+
+  std::size_t before = thread_allocations;
+  for (int i = 0; i < 1000; i ++) {
+    workers_pool.Submit([&count, &a, &b, &c, i] { count += a + b + c + i - i; });
+    workers_pool.Submit<cos::base::urgent>([&count] { count ++; });
+  }
+  EXPECT_EQ(thread_allocations - before, 0);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (count.load() < 7000 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(count.load(), 7000);
+}
+
+// Tasks submitted from a worker go to its deque through recycled nodes.
+TEST(WorkBranch, work_stealing_submit_without_allocation) {
+  BranchOptions options;
+  options.work_stealing = true;
+  WorkBranch workers_pool(1, options);
+  std::atomic<int> count(0);
+  const int num = 32;
+  auto submit_all = [&workers_pool, &count, num] {
+    for (int i = 0; i < num; i ++) {
+      workers_pool.Submit([&count] { count ++; });
+      workers_pool.Submit<cos::base::urgent>([&count] { count ++; });
+    }
+  };
+  workers_pool.Submit(submit_all);    // allocates the nodes once
+  workers_pool.WaitIdle();
+
+  std::size_t allocations = 1;
+  workers_pool.Submit([&submit_all, &allocations] {
+    std::size_t before = thread_allocations;
+    submit_all();
+    allocations = thread_allocations - before;
+  });
+  workers_pool.WaitIdle();
+  EXPECT_EQ(allocations, 0);
+  EXPECT_EQ(count.load(), 4 * num);
+}
+
+TEST(WorkBranch, slab_queue_without_allocation) {
+  BasicWorkBranch<SlabQueue> workers_pool(2);
+  std::atomic<int> count(0);
+  char big[128] = {1};
+
+  std::size_t before = thread_allocations;
+  for (int i = 0; i < 1000; i ++) {
+    workers_pool.Submit([&count, big] { count += big[0]; });
+    workers_pool.Submit<cos::base::urgent>([&count] { count ++; });
+  }
+  EXPECT_EQ(thread_allocations - before, 0);
+  workers_pool.WaitIdle();
+  EXPECT_EQ(count.load(), 2000);
+}
+
+TEST(WorkBranch, submit_move_only) {
+  struct Owner {
+    std::unique_ptr<int> value;
+    std::atomic<int>* out;
+    void operator()() { *out += *value; }
+  };
+  struct Producer {
+    std::unique_ptr<int> value;
+    int operator()() { return *value; }
+  };
+
+  WorkBranch workers_pool(2);
+  std::atomic<int> out(0);
+  workers_pool.Submit(Owner{std::unique_ptr<int>(new int(1)), &out});
+  workers_pool.Submit<cos::base::urgent>(Owner{std::unique_ptr<int>(new int(2)), &out});
+  workers_pool.Submit<cos::base::sequence>(Owner{std::unique_ptr<int>(new int(3)), &out},
+                                           Owner{std::unique_ptr<int>(new int(4)), &out});
+  std::future<int> res = workers_pool.Submit(Producer{std::unique_ptr<int>(new int(5))});
+  EXPECT_EQ(res.get(), 5);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (out.load() < 10 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(out.load(), 10);
+}
+
+TEST(WorkBranch, submit_fast) {
+  WorkBranch workers_pool(2);
+  auto res1 = workers_pool.SubmitFast([]{ return 10; });
+  auto res2 = workers_pool.SubmitFast<cos::base::urgent>([]{ return 100; });
+  int x = 0;
+  auto res3 = workers_pool.SubmitFast([&x]{ x = 1; });
+  EXPECT_EQ(res1.get(), 10);
+  EXPECT_EQ(res2.get(), 100);
+  res3.get();
+  EXPECT_EQ(x, 1);
+
+  auto slow = workers_pool.SubmitFast([]{
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return 1;
+  });
+  EXPECT_EQ(slow.wait_for(std::chrono::milliseconds(1)), std::future_status::timeout);
+  EXPECT_EQ(slow.get(), 1);
+}
+
+TEST(WorkBranch, submit_exception) {
+  WorkBranch workers_pool(1);
+  auto fast = workers_pool.SubmitFast([]() -> int { throw std::runtime_error("fast"); });
+  std::future<int> slow = workers_pool.Submit([]() -> int { throw std::runtime_error("slow"); });
+  EXPECT_THROW(fast.get(), std::runtime_error);
+  EXPECT_THROW(slow.get(), std::runtime_error);
+}
+
+TEST(WorkBranch, submit_fast_without_allocation) {
+  BasicWorkBranch<LockFreeQueue> workers_pool(2);
+  workers_pool.SubmitFast([]{ return 0; }).get();    // warm up the pool
+
+  std::size_t before = thread_allocations;
+  for (int i = 0; i < 1000; i ++) {
+    auto res = workers_pool.SubmitFast([i]{ return i; });
+    ASSERT_EQ(res.get(), i);
+  }
+  EXPECT_EQ(thread_allocations - before, 0);
+}
+
+TEST(WorkBranch, submit_bulk) {
+  WorkBranch workers_pool(4);
+  std::atomic<int> count(0);
+  std::vector<std::function<void()>> tasks(10000, [&count]{ count ++; });
+  workers_pool.SubmitBulk(tasks.begin(), tasks.end());
+
+  std::vector<std::function<int()>> producers;
+  for (int i = 0; i < 100; i ++) {
+    producers.emplace_back([i]{ return i; });
+  }
+  std::vector<std::future<int>> results = workers_pool.SubmitBulk(std::move(producers));
+  ASSERT_EQ(results.size(), 100);
+  for (int i = 0; i < 100; i ++) {
+    EXPECT_EQ(results[i].get(), i);
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (count.load() < 10000 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(count.load(), 10000);
+}
+
+TEST(WorkBranch, submit_bulk_urgent_keeps_order) {
+  WorkBranch workers_pool(1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  workers_pool.Submit([opened] { opened.wait(); });
+
+  std::vector<int> order;
+  workers_pool.Submit([&order] { order.push_back(100); });
+  std::vector<std::function<void()>> urgent;
+  for (int i = 0; i < 3; i ++) {
+    urgent.emplace_back([&order, i] { order.push_back(i); });
+  }
+  workers_pool.SubmitBulk<cos::base::urgent>(std::move(urgent));
+  gate.set_value();
+  workers_pool.Submit([]{ return 0; }).get();
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2, 100}));
+}
+
+TEST(WorkBranch, submit_bulk_lockfree) {
+  BasicWorkBranch<LockFreeQueue> workers_pool(2);
+  std::atomic<int> count(0);
+  // Larger than the ring, so the batch goes in several reservations.
+  std::vector<std::function<void()>> tasks(3 * cos::base::DEFAULT_RING_CAPACITY, [&count]{ count ++; });
+  workers_pool.SubmitBulk(tasks.begin(), tasks.end());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (count.load() < (int)tasks.size() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(count.load(), (int)tasks.size());
+}
+
+// The only worker fills the ring itself, it must run queued tasks to make
+// room instead of waiting for it.
+TEST(WorkBranch, submit_from_worker_past_ring_capacity) {
+  BasicWorkBranch<LockFreeQueue> workers_pool(1);
+  const int num = (int)cos::base::DEFAULT_RING_CAPACITY + 4000;
+  std::atomic<int> count(0);
+  workers_pool.Submit([&workers_pool, &count, num] {
+    for (int i = 0; i < num; i ++) {
+      workers_pool.Submit([&count] { count ++; });
+    }
+    workers_pool.Submit<cos::base::urgent>([&count] { count ++; });
+    std::vector<std::function<void()>> batch(100, [&count] { count ++; });
+    workers_pool.SubmitBulk(batch.begin(), batch.end());
+  });
+  workers_pool.WaitIdle();
+  EXPECT_EQ(count.load(), num + 101);
+}
+
+// A removed worker hands its deque to a full ring: what does not fit runs
+// on the way out, without holding the branch up.
+TEST(WorkBranch, remove_worker_with_full_ring) {
+  BranchOptions options;
+  options.work_stealing = true;
+  BasicWorkBranch<LockFreeQueue> workers_pool(1, options);
+  const int ring = (int)cos::base::DEFAULT_RING_CAPACITY, local = 100;
+  std::atomic<int> count(0);
+  std::promise<void> gate, started;
+  std::shared_future<void> opened = gate.get_future().share();
+  workers_pool.Submit([&workers_pool, &count, &started, opened, local] {
+    started.set_value();
+    opened.wait();
+    for (int i = 0; i < local; i ++) {
+      workers_pool.Submit([&count] { count ++; });    // to its own deque
+    }
+    workers_pool.RemoveWorker();
+  });
+  started.get_future().wait();
+  for (int i = 0; i < ring; i ++) {
+    workers_pool.Submit([&count] { count ++; });
+  }
+  gate.set_value();
+  while (workers_pool.WorkersNum() > 0 || count.load() < local) {
+    std::this_thread::yield();
+  }
+  workers_pool.AddWorker();
+  workers_pool.WaitIdle();
+  EXPECT_EQ(count.load(), ring + local);
+}
+
+TEST(WorkBranch, snapshot) {
+  WorkBranch br(2);
+  BranchSnapshot first = br.Snapshot();
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 20; i ++) {
+    results.push_back(br.Submit([] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      return 0;
+    }));
+  }
+  br.Submit<cos::base::urgent>([] {});
+  for (auto& result : results) {
+    result.wait();
+  }
+  while (br.Snapshot().completed < 21) {
+    std::this_thread::yield();
+  }
+
+  BranchSnapshot snap = br.Snapshot();
+  EXPECT_EQ(snap.workers, 2);
+  EXPECT_EQ(snap.queued, 0);
+  EXPECT_EQ(snap.submitted, 21);
+  EXPECT_EQ(snap.urgent, 1);
+  EXPECT_EQ(snap.steals, 0);
+  EXPECT_EQ(snap.run_ns.Count(), 21);
+  EXPECT_EQ(snap.wait_ns.Count(), 21);
+  EXPECT_GE(snap.run_ns.Percentile(0.5), 2000000);
+  EXPECT_GE(snap.wait_ns.Max(), 2000000);      // 20 tasks on 2 workers
+  EXPECT_GE(snap.busy_ns, 40000000);
+  EXPECT_GT(snap.Utilization(), 0.0);
+  EXPECT_LE(snap.Utilization(), 1.0);
+  EXPECT_GT(snap.Throughput(first), 0.0);
+}
+
+TEST(WorkBranch, snapshot_counts_steals) {
+  BranchOptions options;
+  options.work_stealing = true;
+  WorkBranch br(4, options);
+  std::atomic<int> count(0);
+  std::promise<void> done;
+  br.Submit([&br, &count, &done] {
+    for (int i = 0; i < 1000; i ++) {
+      br.Submit([&count] {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        count ++;
+      });
+    }
+    while (count < 1000) {
+      std::this_thread::yield();
+    }
+    done.set_value();
+  });
+  done.get_future().wait();
+  EXPECT_GT(br.Snapshot().steals, 0);
+}
+
+TEST(WorkBranch, lanes_deadline_order) {
+  BranchOptions options;
+  options.lane_weights = {1};
+  WorkBranch br(1, options);
+  EXPECT_EQ(br.LanesNum(), 1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened] { opened.wait(); });
+
+  std::vector<int> order;
+  auto now = std::chrono::steady_clock::now();
+  br.SubmitDeadline(now + std::chrono::milliseconds(30), [&order] { order.push_back(3); });
+  br.SubmitDeadline(now + std::chrono::milliseconds(10), [&order] { order.push_back(1); });
+  br.SubmitDeadline(now + std::chrono::milliseconds(20), [&order] { order.push_back(2); });
+  br.Submit([&order] { order.push_back(0); });     // due now
+  auto last = br.SubmitDeadline(now + std::chrono::hours(1), [] { return 0; });
+  gate.set_value();
+  last.wait();
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3}));
+}
+
+TEST(WorkBranch, lanes_no_starvation) {
+  BranchOptions options;
+  options.lane_weights = {3, 1};
+  WorkBranch br(1, options);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened] { opened.wait(); });
+
+  std::vector<int> order;
+  std::atomic<int> count(0);
+  for (int i = 0; i < 40; i ++) {
+    br.Submit<cos::base::urgent>([&order, &count] { order.push_back(0); count ++; });
+  }
+  for (int i = 0; i < 10; i ++) {
+    br.Submit<cos::base::lane<1>>([&order, &count] { order.push_back(1); count ++; });
+  }
+  gate.set_value();
+  while (br.Snapshot().completed < 51) {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(count, 50);
+  // The urgent lane goes first, yet the other one gets its quarter.
+  EXPECT_EQ(order[0], 0);
+  int normal = (int)std::count(order.begin(), order.begin() + 20, 1);
+  EXPECT_GE(normal, 4);
+  EXPECT_LE(normal, 6);
+
+  BranchSnapshot snap = br.Snapshot();
+  ASSERT_EQ(snap.lane_wait_ns.size(), 2);
+  EXPECT_EQ(snap.lane_wait_ns[0].Count(), 40);
+  EXPECT_EQ(snap.lane_wait_ns[1].Count(), 11);
+  EXPECT_EQ(snap.urgent, 40);
+  EXPECT_EQ(br.TasksNum(), 0);
+}
+
+TEST(WorkBranch, lane_tags_without_lanes) {
+  WorkBranch br(1);
+  EXPECT_EQ(br.LanesNum(), 0);
+  auto in_lane = br.Submit<cos::base::lane<2>>([] { return 2; });
+  auto urgent = br.SubmitDeadline<cos::base::urgent>(std::chrono::steady_clock::now(), [] { return 1; });
+  EXPECT_EQ(in_lane.get(), 2);
+  EXPECT_EQ(urgent.get(), 1);
+  EXPECT_TRUE(br.Snapshot().lane_wait_ns.empty());
+}
+
+TEST(WorkBranch, wait_idle) {
+  WorkBranch br(2);
+  br.WaitIdle();      // nothing submitted
+  std::atomic<int> count(0);
+  for (int i = 0; i < 50; i ++) {
+    br.Submit([&br, &count] {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      br.Submit([&count] { count ++; });    // counted before the parent ends
+      count ++;
+    });
+  }
+  br.WaitIdle();
+  EXPECT_EQ(count, 100);
+  EXPECT_EQ(br.PendingNum(), 0);
+  EXPECT_EQ(br.Snapshot().completed, 100);
+}
+
+TEST(WorkBranch, wait_idle_timeout) {
+  WorkBranch br(2);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened] { opened.wait(); });
+  EXPECT_FALSE(br.WaitIdle(std::chrono::milliseconds(10)));
+  EXPECT_EQ(br.PendingNum(), 1);
+  // The other worker is not paused meanwhile.
+  EXPECT_EQ(br.Submit([] { return 1; }).get(), 1);
+  gate.set_value();
+  EXPECT_TRUE(br.WaitIdle(std::chrono::milliseconds(1000)));
+}
+
+// Occupies the only worker of 'br' until 'gate' is set.
+static void Block(WorkBranch& br, std::promise<void>& gate) {
+  std::promise<void> started;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([opened, &started] {
+    started.set_value();
+    opened.wait();
+  });
+  started.get_future().wait();
+}
+
+TEST(WorkBranch, bounded_reject) {
+  BranchOptions options;
+  options.capacity = 2;
+  options.overflow = cos::workspace::Overflow::reject;
+  WorkBranch br(1, options);
+  std::promise<void> gate;
+  Block(br, gate);
+  EXPECT_EQ(br.TrySubmit([] {}), cos::workspace::Admission::accepted);
+  br.Submit([] {});
+  EXPECT_FALSE(br.HasRoom());
+  EXPECT_EQ(br.TrySubmit([] {}), cos::workspace::Admission::rejected);
+  std::future<int> lost = br.Submit([] { return 1; });
+  EXPECT_THROW(lost.get(), std::future_error);
+  std::vector<std::function<void()>> batch(3, [] {});
+  br.SubmitBulk(std::move(batch));
+  EXPECT_EQ(br.Snapshot().rejected, 5);
+  gate.set_value();
+  br.WaitIdle();
+  EXPECT_EQ(br.Snapshot().completed, 3);
+  EXPECT_TRUE(br.HasRoom());
+}
+
+TEST(WorkBranch, bounded_block) {
+  BranchOptions options;
+  options.capacity = 1;
+  options.block_timeout = std::chrono::milliseconds(20);
+  WorkBranch br(1, options);
+  std::promise<void> gate;
+  Block(br, gate);
+  br.Submit([] {});
+  auto begin = std::chrono::steady_clock::now();
+  EXPECT_EQ(br.TrySubmit([] {}), cos::workspace::Admission::rejected);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(20));
+
+  std::thread opener([&gate] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    gate.set_value();
+  });
+  EXPECT_EQ(br.TrySubmit([] {}), cos::workspace::Admission::accepted);
+  opener.join();
+  br.WaitIdle();
+  EXPECT_EQ(br.Snapshot().completed, 3);
+}
+
+// Dropped urgent tasks no longer send the worker to the shared queue
+// before its own deque.
+TEST(WorkBranch, bounded_drop_oldest_urgent_work_stealing) {
+  BranchOptions options;
+  options.capacity = 2;
+  options.overflow = cos::workspace::Overflow::drop_oldest;
+  options.work_stealing = true;
+  WorkBranch br(1, options);
+  std::mutex mtx;
+  std::vector<int> order;
+  auto record = [&mtx, &order](int id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    order.push_back(id);
+  };
+  std::promise<void> gate, started;
+  std::shared_future<void> opened = gate.get_future().share();
+  br.Submit([&br, &record, opened, &started] {
+    started.set_value();
+    opened.wait();
+    br.Submit([&record] { record(0); });      // to the worker's own deque
+  });
+  started.get_future().wait();
+  br.Submit<cos::base::urgent>([&record] { record(-1); });
+  br.Submit<cos::base::urgent>([&record] { record(-1); });
+  br.Submit([&record] { record(1); });        // drops both urgent tasks
+  br.Submit([&record] { record(2); });
+  EXPECT_EQ(br.Snapshot().dropped, 2);
+  gate.set_value();
+  br.WaitIdle();
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2}));
+}
+
+TEST(WorkBranch, bounded_caller_runs) {
+  BranchOptions options;
+  options.capacity = 1;
+  options.overflow = cos::workspace::Overflow::caller_runs;
+  WorkBranch br(1, options);
+  std::promise<void> gate;
+  Block(br, gate);
+  br.Submit([] {});
+  std::thread::id where;
+  EXPECT_EQ(br.TrySubmit([&where] { where = std::this_thread::get_id(); }),
+            cos::workspace::Admission::accepted);
+  EXPECT_EQ(where, std::this_thread::get_id());
+  EXPECT_EQ(br.Snapshot().caller_ran, 1);
+  gate.set_value();
+  br.WaitIdle();
+}
+
+TEST(WorkBranch, bounded_drop_oldest) {
+  BranchOptions options;
+  options.capacity = 2;
+  options.overflow = cos::workspace::Overflow::drop_oldest;
+  WorkBranch br(1, options);
+  std::promise<void> gate;
+  Block(br, gate);
+  std::future<int> first = br.Submit([] { return 1; });
+  std::future<int> second = br.Submit([] { return 2; });
+  std::future<int> third = br.Submit([] { return 3; });
+  EXPECT_THROW(first.get(), std::future_error);
+  gate.set_value();
+  EXPECT_EQ(second.get(), 2);
+  EXPECT_EQ(third.get(), 3);
+  br.WaitIdle();
+  EXPECT_EQ(br.Snapshot().dropped, 1);
+  EXPECT_EQ(br.PendingNum(), 0);
+}
+
+TEST(WorkBranch, shed_on_sojourn) {
+  BranchOptions options;
+  options.shed_target = std::chrono::microseconds(1000);
+  options.shed_interval = std::chrono::milliseconds(5);
+  WorkBranch br(1, options);
+  for (int i = 0; i < 40; i ++) {
+    br.Submit([] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+  }
+  bool shed = false;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!shed && std::chrono::steady_clock::now() < deadline) {
+    shed = br.TrySubmit([] {}) == cos::workspace::Admission::shed;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  EXPECT_TRUE(shed);
+  EXPECT_GT(br.Snapshot().shed, 0);
+  br.WaitIdle();
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));    // the worker finds the queue empty
+  EXPECT_EQ(br.TrySubmit([] {}), cos::workspace::Admission::accepted);
+}
+
+// Cpus a thread of this process may run on, from /proc/self/task/<tid>/status.
+static std::vector<int> AllowedCpus(long tid) {
+  std::ifstream in("/proc/self/task/" + std::to_string(tid) + "/status");
+  std::string line;
+  const std::string key = "Cpus_allowed_list:";
+  while (std::getline(in, line)) {
+    if (line.compare(0, key.size(), key) == 0) {
+      return cos::base::ParseCpuList(line.substr(line.find_first_not_of(" \t", key.size())));
+    }
+  }
+  return std::vector<int>();
+}
+
+// Thread ids of the 'num' workers of 'br', which must be idle.
+static std::vector<long> WorkerTids(WorkBranch& br, std::size_t num) {
+  std::vector<long> tids(num);
+  std::atomic<std::size_t> started(0);
+  std::vector<std::future<int>> futures;
+  for (std::size_t i = 0; i < num; i ++) {
+    futures.push_back(br.Submit([&tids, &started, num] {
+      tids[started ++] = syscall(SYS_gettid);
+      while (started < num) {
+        std::this_thread::yield();
+      }
+      return 0;
+    }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+  return tids;
+}
+
+TEST(WorkBranch, pin_workers) {
+  std::vector<int> allowed = AllowedCpus(syscall(SYS_gettid));
+  ASSERT_FALSE(allowed.empty());
+  BranchOptions options;
+  options.cpus = allowed;
+  options.pin_workers = true;
+  WorkBranch br(2, options);
+  std::vector<int> pinned;
+  for (long tid : WorkerTids(br, 2)) {
+    std::vector<int> cpus = AllowedCpus(tid);
+    ASSERT_EQ(cpus.size(), 1);
+    pinned.push_back(cpus[0]);
+  }
+  std::sort(pinned.begin(), pinned.end());
+  std::vector<int> expected = {allowed[0], allowed[1 % allowed.size()]};
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(pinned, expected);
+}
+
+TEST(WorkBranch, numa_node) {
+  int node = cos::base::NumaNodes()[0];
+  std::vector<int> node_cpus = cos::base::NodeCpus(node);
+  BranchOptions options;
+  options.numa_node = node;
+  WorkBranch br(2, options);
+  EXPECT_EQ(br.NumaNode(), node);
+  for (long tid : WorkerTids(br, 2)) {
+    for (int cpu : AllowedCpus(tid)) {
+      EXPECT_NE(std::find(node_cpus.begin(), node_cpus.end(), cpu), node_cpus.end());
+    }
+  }
+}
+
+static void WaitReserved(WorkBranch& br, std::size_t num) {
+  while (br.ReservedNum() != num) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+TEST(WorkBranch, reserve_reuses_threads) {
+  BranchOptions options;
+  options.reserve_workers = 2;
+  WorkBranch br(3, options);
+  std::vector<long> before = WorkerTids(br, 3);
+  for (int i = 0; i < 3; i ++) {
+    br.RemoveWorker();
+  }
+  WaitReserved(br, 2);    // the third one exits
+  EXPECT_EQ(br.WorkersNum(), 0);
+  br.AddWorker();
+  br.AddWorker();
+  EXPECT_EQ(br.ReservedNum(), 0);
+  EXPECT_EQ(br.WorkersNum(), 2);
+  for (long tid : WorkerTids(br, 2)) {
+    EXPECT_NE(std::find(before.begin(), before.end(), tid), before.end());
+  }
+  br.WaitTasks();
+  br.RemoveWorker();
+  WaitReserved(br, 1);    // destroyed while parked
+}
+
+TEST(WorkBranch, remove_with_every_worker_in_reserve) {
+  BranchOptions options;
+  options.reserve_workers = 2;
+  WorkBranch br(2, options);
+  br.RemoveWorker();
+  br.RemoveWorker();
+  WaitReserved(br, 2);
+  br.RemoveWorker();      // ignored, no active worker
+  EXPECT_EQ(br.Hint().workers, 0);
+  EXPECT_EQ(br.WorkersNum(), 0);
+  br.AddWorker();
+  EXPECT_EQ(br.WorkersNum(), 1);
+  EXPECT_EQ(br.Hint().workers, 1);
+  EXPECT_EQ(br.Submit([] { return 1; }).get(), 1);
+}
+
+TEST(WorkBranch, reserve_timeout) {
+  BranchOptions options;
+  options.reserve_workers = 1;
+  options.reserve_timeout = std::chrono::milliseconds(20);
+  WorkBranch br(2, options);
+  br.RemoveWorker();
+  WaitReserved(br, 1);
+  WaitReserved(br, 0);
+  EXPECT_EQ(br.WorkersNum(), 1);
+  br.AddWorker();
+  EXPECT_EQ(WorkerTids(br, 2).size(), 2);
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,10 +1,19 @@
 #ifndef WORKSPACE_WORKSPACE_H_
 #define WORKSPACE_WORKSPACE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "supervisor.h"
+#include "task_group.h"
+#include "timer.h"
 #include "workbranch.h"
 
 
@@ -18,6 +27,26 @@ using BranchList = std::list<std::unique_ptr<WorkBranch>>;
 using SupervisorMap = std::map<const Supervisor*, std::unique_ptr<Supervisor>>;
 using pos_t = BranchList::iterator;
 
+// How Submit picks a branch. All of them read WorkBranch::Hint() only.
+//  round_robin:   the next branch in turn, or the one after it if that one
+//                 has fewer queued tasks
+//  power_of_two:  the less loaded of two random branches
+//  least_loaded:  the lowest queued tasks per worker
+//  shortest_wait: the lowest expected wait, queued tasks per worker times
+//                 the average task run time
+//  local_node:    least_loaded among the branches bound to the submitter's
+//                 NUMA node, or among all if there are none
+enum class Dispatch {
+  round_robin,
+  power_of_two,
+  least_loaded,
+  shortest_wait,
+  local_node,
+};
+
+// A custom dispatcher returns the index of the branch to submit to.
+using DispatchFunc = std::function<std::size_t(const std::vector<WorkBranch*>&)>;
+
 class Bid {
  friend class WorkSpace;
  public:
@@ -91,6 +120,8 @@ class Workspace {
   explicit Workspace() {};
   
   ~Workspace() {
+    timer_.reset();
+    migration_.Clear();
     branches_list_.clear();
     supers_map_.clear();
   }
@@ -102,7 +133,13 @@ class Workspace {
   Bid Attach(WorkBranch* branch) {
     assert(branch != nullptr);
     branches_list_.emplace_back(branch);
-    current_ = branches_list_.begin();
+    branches_.push_back(branch);
+    if (migrating_) {
+      migration_.Add(branch);
+    }
+    if (tracing_) {
+      branch->SetTracing(true);
+    }
     return Bid(branch);
   }
 
@@ -115,14 +152,10 @@ class Workspace {
   auto Detach(Bid bid) -> std::unique_ptr<WorkBranch> {
     for (auto it = branches_list_.begin(); it != branches_list_.end(); it ++) {
       if (it->get() == bid.branch()) {
-        if (it == current_) {
-          Forward(current_);
-        }
+        migration_.Remove(it->get());
         WorkBranch* branch = it->release();
         branches_list_.erase(it);
-        if (branches_list_.empty()) {
-          current_ = {};
-        }
+        branches_.erase(std::find(branches_.begin(), branches_.end(), branch));
         return std::unique_ptr<WorkBranch>(branch);
       }
     }
@@ -159,6 +192,99 @@ class Workspace {
     return *(sid.super());
   }
 
+  // Attaches one branch bound to each NUMA node, with 'workers' workers or
+  // one per cpu of the node, and dispatches to the submitter's node.
+  std::vector<Bid> AttachPerNode(std::size_t workers = 0, BranchOptions options = BranchOptions()) {
+    std::vector<Bid> bids;
+    for (int node : cos::base::NumaNodes()) {
+      options.numa_node = node;
+      std::size_t num = workers > 0 ? workers : cos::base::NodeCpus(node).size();
+      bids.push_back(Attach(new WorkBranch((int)std::max<std::size_t>(1, num), options)));
+    }
+    SetDispatch(Dispatch::local_node);
+    return bids;
+  }
+
+  void SetDispatch(Dispatch policy) {
+    dispatch_ = policy;
+    custom_ = nullptr;
+  }
+
+  void SetDispatch(DispatchFunc func) {
+    custom_ = std::move(func);
+  }
+
+  // Lets idle branches take queued tasks from loaded ones, see
+  // MigrationGroup. Branches attached later join too, except those that
+  // are not 'migratable'.
+  void EnableMigration(bool enable = true) {
+    migrating_ = enable;
+    migration_.Clear();
+    if (enable) {
+      for (WorkBranch* branch : branches_) {
+        migration_.Add(branch);
+      }
+    }
+  }
+
+  // Tracing of every branch, those attached later included. Dump with
+  // Tracer::Dump().
+  void SetTracing(bool enable) {
+    tracing_ = enable;
+    for (WorkBranch* branch : branches_) {
+      branch->SetTracing(enable);
+    }
+  }
+
+  // Moves tasks once from loaded branches to idle ones, returns how many.
+  // Migration alone waits for a worker to park or a backlog to grow; call
+  // this e.g. from a Supervisor tick callback to move tasks regardless.
+  std::size_t Rebalance() {
+    return migration_.Rebalance();
+  }
+
+  // Waits for each branch in turn to be idle, see WorkBranch::WaitIdle,
+  // and again while tasks moving between branches left one busy.
+  void WaitIdle() {
+    bool idle = false;
+    while (!idle) {
+      for (WorkBranch* branch : branches_) {
+        branch->WaitIdle();
+      }
+      idle = std::all_of(branches_.begin(), branches_.end(), [](WorkBranch* branch) {
+        return branch->PendingNum() == 0;
+      });
+    }
+  }
+
+  // False on timeout, which covers all the branches.
+  template <typename Rep, typename Period>
+  bool WaitIdle(const std::chrono::duration<Rep, Period>& timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    bool idle = false;
+    while (!idle) {
+      for (WorkBranch* branch : branches_) {
+        auto left = deadline - std::chrono::steady_clock::now();
+        if (!branch->WaitIdle(std::max(left, decltype(left)::zero()))) {
+          return false;
+        }
+      }
+      idle = std::all_of(branches_.begin(), branches_.end(), [](WorkBranch* branch) {
+        return branch->PendingNum() == 0;
+      });
+    }
+    return true;
+  }
+
+  // One snapshot per branch, in attach order.
+  std::vector<BranchSnapshot> Snapshot() const {
+    std::vector<BranchSnapshot> snaps;
+    for (WorkBranch* branch : branches_) {
+      snaps.push_back(branch->Snapshot());
+    }
+    return snaps;
+  }
+
   WorkBranch& GetRef(Bid bid) {
     return *(bid.branch());
   }
@@ -171,54 +297,298 @@ class Workspace {
            typename R = cos::base::result_of_t<F>,
            typename DR = typename std::enable_if<std::is_void<R>::value>::type>
   void Submit(F&& task) {
-    assert(!branches_list_.empty());
-    auto this_branch = current_->get();
-    auto next_branch = Forward(current_)->get();
-    if (next_branch->TasksNum() < this_branch->TasksNum()) {
-      next_branch->Submit<T>(std::forward<F>(task));
-    } else {
-      this_branch->Submit<T>(std::forward<F>(task));
-    }
+    Pick()->Submit<T>(std::forward<F>(task));
   }
   
   template<typename T = cos::base::normal, typename F,
            typename R = cos::base::result_of_t<F>,
            typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
   auto Submit(F&& task) -> std::future<R> {
-    assert(!branches_list_.empty());
-    auto this_branch = current_->get();
-    auto next_branch = Forward(current_)->get();
-    if (next_branch->TasksNum() < this_branch->TasksNum()) {
-      return next_branch->Submit<T>(std::forward<F>(task));
-    } else {
-      return this_branch->Submit<T>(std::forward<F>(task));
-    }
+    return Pick()->Submit<T>(std::forward<F>(task));
+  }
+
+  template<typename T = cos::base::normal, typename F>
+  Admission TrySubmit(F&& task) {
+    return Pick()->TrySubmit<T>(std::forward<F>(task));
+  }
+
+  // See WorkBranch::TrySubmitNow().
+  template<typename T = cos::base::normal, typename F>
+  Admission TrySubmitNow(F&& task) {
+    return Pick()->TrySubmitNow<T>(std::forward<F>(task));
+  }
+
+  template<typename T = cos::base::normal, typename F,
+           typename R = cos::base::result_of_t<F>>
+  auto SubmitFast(F&& task) -> cos::base::FastFuture<R> {
+    return Pick()->SubmitFast<T>(std::forward<F>(task));
+  }
+
+  // To the lane of 'T' on the picked branch, see WorkBranch::SubmitDeadline.
+  template<typename T = cos::base::normal, typename F,
+           typename R = cos::base::result_of_t<F>,
+           typename DR = typename std::enable_if<std::is_void<R>::value>::type>
+  void SubmitDeadline(std::chrono::steady_clock::time_point deadline, F&& task) {
+    Pick()->SubmitDeadline<T>(deadline, std::forward<F>(task));
+  }
+
+  template<typename T = cos::base::normal, typename F,
+           typename R = cos::base::result_of_t<F>,
+           typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
+  auto SubmitDeadline(std::chrono::steady_clock::time_point deadline, F&& task) -> std::future<R> {
+    return Pick()->SubmitDeadline<T>(deadline, std::forward<F>(task));
+  }
+
+  // Split a batch across the branches in proportion to their free
+  // capacity, one bulk submission per branch. Futures keep the input order.
+  template <typename T = cos::base::normal, typename It,
+            typename R = cos::base::result_of_t<typename std::iterator_traits<It>::value_type>>
+  auto SubmitBulk(It first, It last) -> typename bulk_result<R>::type {
+    assert(!branches_.empty());
+    return submit_bulk<T, R>(first, last, std::is_void<R>());
+  }
+
+  template <typename T = cos::base::normal, typename F,
+            typename R = cos::base::result_of_t<F>>
+  auto SubmitBulk(std::vector<F>&& tasks) -> typename bulk_result<R>::type {
+    return SubmitBulk<T>(std::make_move_iterator(tasks.begin()),
+                         std::make_move_iterator(tasks.end()));
   }
 
   template <typename T, typename F, typename... Fs>
   auto Submit(F&& task, Fs&&... tasks) 
       -> typename std::enable_if<std::is_same<T, cos::base::sequence>::value>::type {
-    assert(!branches_list_.empty());
-    auto this_branch = current_->get();
-    auto next_branch = Forward(current_)->get();
-    if (next_branch->TasksNum() < this_branch->TasksNum()) {
-      return next_branch->Submit<T>(std::forward<F>(task), std::forward<Fs>(tasks)...);
-    } else {
-      return this_branch->Submit<T>(std::forward<F>(task), std::forward<Fs>(tasks)...);
-    }
+    return Pick()->Submit<T>(std::forward<F>(task), std::forward<Fs>(tasks)...);
+  }
+
+  // Keyed tasks run in order per key, see WorkBranch::SubmitKeyed. Each
+  // turn of a key is dispatched like Submit(), so a key may move between
+  // branches, one turn at a time.
+  template <typename K, typename F,
+            typename R = cos::base::result_of_t<F>,
+            typename DR = typename std::enable_if<std::is_void<R>::value>::type>
+  bool SubmitKeyed(const K& key, F&& task) {
+    return Strands().Submit(std::hash<K>()(key), cos::base::UniqueTask(std::forward<F>(task)));
+  }
+
+  template <typename K, typename F,
+            typename R = cos::base::result_of_t<F>,
+            typename DR = typename std::enable_if<!std::is_void<R>::value>::type>
+  std::future<R> SubmitKeyed(const K& key, F&& task) {
+    PromiseTask<typename std::decay<F>::type, R> exec(std::forward<F>(task));
+    std::future<R> res = exec.promise.get_future();
+    Strands().Submit(std::hash<K>()(key), cos::base::UniqueTask(std::move(exec)));
+    return res;
+  }
+
+  // Delayed and periodic submissions, dispatched like Submit() when due.
+  // They share one timer thread, started on first use.
+  template <typename F>
+  TimerHandle SubmitAt(Timer::Clock::time_point when, F&& task) {
+    return GetTimer().SubmitAt(*this, when, std::forward<F>(task));
+  }
+
+  template <typename Rep, typename Period, typename F>
+  TimerHandle SubmitAfter(std::chrono::duration<Rep, Period> delay, F&& task) {
+    return GetTimer().SubmitAfter(*this, delay, std::forward<F>(task));
+  }
+
+  template <typename Rep, typename Period, typename F>
+  TimerHandle SubmitEvery(std::chrono::duration<Rep, Period> period, F&& task) {
+    return GetTimer().SubmitEvery(*this, period, std::forward<F>(task));
+  }
+
+  // Also for timers on a given branch: GetTimer().SubmitAfter(space[bid], ...)
+  Timer& GetTimer() {
+    std::call_once(timer_once_, [this] { timer_.reset(new Timer()); });
+    return *timer_;
+  }
+
+  // 'co_await space.Schedule()' resumes a coroutine on the branch picked by
+  // the dispatch policy.
+  template <typename Self = Workspace>
+  coro::ScheduleAwaiter<Self> Schedule() {
+    return coro::ScheduleAwaiter<Self>(*this);
   }
 
   private:
-   const pos_t& Forward(pos_t& current) {
-    if (++current == branches_list_.end()) {
-      current = branches_list_.begin();
-    }
-    return current;
+   template <typename T, typename R, typename It>
+   void submit_bulk(It first, It last, std::true_type /* void */) {
+     std::vector<std::size_t> shares = BulkShares(std::distance(first, last));
+     std::size_t i = 0;
+     for (WorkBranch* branch : branches_) {
+       It next = std::next(first, shares[i ++]);
+       branch->SubmitBulk<T>(first, next);
+       first = next;
+     }
+   }
+
+   template <typename T, typename R, typename It>
+   std::vector<std::future<R>> submit_bulk(It first, It last, std::false_type /* void */) {
+     std::vector<std::size_t> shares = BulkShares(std::distance(first, last));
+     std::vector<std::future<R>> futures;
+     std::size_t i = 0;
+     for (WorkBranch* branch : branches_) {
+       It next = std::next(first, shares[i ++]);
+       std::vector<std::future<R>> part = branch->SubmitBulk<T>(first, next);
+       std::move(part.begin(), part.end(), std::back_inserter(futures));
+       first = next;
+     }
+     return futures;
+   }
+
+   // Water-filling: find the level of queued tasks per worker that 'num'
+   // new tasks reach, and give every branch what it lacks to get there.
+   std::vector<std::size_t> BulkShares(std::size_t num) {
+     std::vector<double> queued, workers;
+     for (WorkBranch* branch : branches_) {
+       LoadHint hint = branch->Hint();
+       queued.push_back((double)hint.queued);
+       workers.push_back((double)std::max<std::size_t>(1, hint.workers));
+     }
+     auto demand = [&](double level) {
+       double sum = 0;
+       for (std::size_t i = 0; i < queued.size(); i ++) {
+         sum += std::max(0.0, level * workers[i] - queued[i]);
+       }
+       return sum;
+     };
+     double lo = 0, hi = 1;
+     while (demand(hi) < num) {
+       hi *= 2;
+     }
+     for (int round = 0; round < 64; round ++) {
+       double mid = (lo + hi) / 2;
+       if (demand(mid) < num) {
+         lo = mid;
+       } else {
+         hi = mid;
+       }
+     }
+
+     std::vector<std::size_t> shares(queued.size());
+     std::size_t given = 0;
+     for (std::size_t i = 0; i < queued.size(); i ++) {
+       shares[i] = std::min<std::size_t>(num - given,
+           (std::size_t)std::max(0.0, lo * workers[i] - queued[i]));
+       given += shares[i];
+     }
+     // Rounding leftovers go to the least loaded branches.
+     while (given < num) {
+       std::size_t best = 0;
+       for (std::size_t i = 1; i < shares.size(); i ++) {
+         if ((queued[i] + shares[i]) / workers[i] < (queued[best] + shares[best]) / workers[best]) {
+           best = i;
+         }
+       }
+       shares[best] ++;
+       given ++;
+     }
+     return shares;
+   }
+
+   // A full or shedding branch is passed over for one with room, if any,
+   // before its overflow policy applies.
+   WorkBranch* Pick() {
+     WorkBranch* branch = Choose();
+     if (branch->HasRoom()) {
+       return branch;
+     }
+     for (WorkBranch* other : branches_) {
+       if (other->HasRoom()) {
+         return other;
+       }
+     }
+     return branch;
+   }
+
+   StrandTable<Workspace>& Strands() {
+     std::call_once(strands_once_, [this] { strands_.reset(new StrandTable<Workspace>(*this)); });
+     return *strands_;
+   }
+
+   WorkBranch* Choose() {
+     assert(!branches_.empty());
+     std::size_t num = branches_.size();
+     if (custom_) {
+       return branches_[custom_(branches_) % num];
+     }
+     if (num == 1) {
+       return branches_[0];
+     }
+     std::size_t start = cursor_.fetch_add(1, std::memory_order_relaxed) % num;
+     switch (dispatch_) {
+       case Dispatch::round_robin: {
+         WorkBranch* this_branch = branches_[start];
+         WorkBranch* next_branch = branches_[(start + 1) % num];
+         return next_branch->Hint().queued < this_branch->Hint().queued ? next_branch : this_branch;
+       }
+       case Dispatch::power_of_two: {
+         std::size_t i = cos::base::fast_rand() % num;
+         std::size_t j = cos::base::fast_rand() % (num - 1);
+         j += j >= i ? 1 : 0;
+         return Cost(branches_[j]->Hint(), false) < Cost(branches_[i]->Hint(), false) ?
+             branches_[j] : branches_[i];
+       }
+       default: {
+         // Branches without a measured run time are assumed as fast as the
+         // fastest measured one. Scanning from a rotating start spreads ties.
+         std::uint64_t fallback = 0;
+         for (WorkBranch* branch : branches_) {
+           std::uint64_t run_ns = branch->Hint().run_ns;
+           if (run_ns > 0 && (fallback == 0 || run_ns < fallback)) {
+             fallback = run_ns;
+           }
+         }
+         bool wait = dispatch_ == Dispatch::shortest_wait;
+         int node = -1;
+         if (dispatch_ == Dispatch::local_node) {
+           node = cos::base::CurrentNode();
+           bool any = false;
+           for (WorkBranch* branch : branches_) {
+             any = any || branch->NumaNode() == node;
+           }
+           node = any ? node : -1;
+         }
+         std::size_t best = num;
+         double best_cost = 0;
+         for (std::size_t i = 0; i < num; i ++) {
+           WorkBranch* branch = branches_[(start + i) % num];
+           if (node >= 0 && branch->NumaNode() != node) {
+             continue;
+           }
+           double cost = Cost(branch->Hint(), wait, fallback);
+           if (best == num || cost < best_cost) {
+             best = i;
+             best_cost = cost;
+           }
+         }
+         return branches_[(start + best) % num];
+       }
+     }
+   }
+
+   // Queued tasks per worker counting the new one, optionally weighted by
+   // the branch's average run time.
+   static double Cost(const LoadHint& hint, bool wait, std::uint64_t fallback = 1) {
+     double cost = (double)(hint.queued + 1) / (double)std::max<std::size_t>(1, hint.workers);
+     std::uint64_t run_ns = hint.run_ns > 0 ? hint.run_ns : fallback;
+     return wait ? cost * (double)std::max<std::uint64_t>(1, run_ns) : cost;
    }
 
+   std::unique_ptr<Timer> timer_;            // Reset first, it submits to branches
+   std::once_flag timer_once_;
+   std::unique_ptr<StrandTable<Workspace>> strands_;   // Outlives the branches
+   std::once_flag strands_once_;
+   MigrationGroup<WorkBranch> migration_;    // Cleared before the branches go
+   bool migrating_ = false;
+   bool tracing_ = false;
    BranchList branches_list_;
    SupervisorMap supers_map_;
-   pos_t current_ = {};
+   std::vector<WorkBranch*> branches_;       // Same order as 'branches_list_'
+   std::atomic<std::size_t> cursor_{0};
+   Dispatch dispatch_ = Dispatch::round_robin;
+   DispatchFunc custom_;
 };
 
 }  // namespace workspace
@@ -1,5 +1,8 @@
 
+#include <atomic>
+#include <future>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "workspace.h"
@@ -7,6 +10,7 @@
 using cos::workspace::Workspace;
 using cos::workspace::WorkBranch;
 using cos::workspace::Supervisor;
+using cos::workspace::Dispatch;
 #define TID() std::this_thread::get_id()
 
 TEST(Workspace, base) {
@@ -41,6 +45,321 @@ TEST(Workspace, base) {
   space.ForEach([](WorkBranch& each){ each.WaitTasks(); });
 }
 
+TEST(Workspace, submit_fast) {
+  Workspace space;
+  space.Attach(new WorkBranch(1));
+  space.Attach(new WorkBranch(1));
+  auto res1 = space.SubmitFast([]{ return 1; });
+  auto res2 = space.SubmitFast<cos::base::urgent>([]{ return 2; });
+  EXPECT_EQ(res1.get() + res2.get(), 3);
+}
+
+TEST(Workspace, then) {
+  Workspace space;
+  auto b1 = space.Attach(new WorkBranch(1));
+  auto b2 = space.Attach(new WorkBranch(1));
+  std::thread::id first, second;
+  auto res = space[b1].SubmitFast([&first] {
+    first = std::this_thread::get_id();
+    return 20;
+  }).Then(space[b2], [&second](int v) {
+    second = std::this_thread::get_id();
+    return v + 1;
+  }).Then(space, [](int v) { return v * 2; });
+  EXPECT_EQ(res.get(), 42);
+  EXPECT_NE(first, second);
+  EXPECT_NE(second, std::this_thread::get_id());
+}
+
+TEST(Workspace, attach_per_node) {
+  Workspace space;
+  std::vector<cos::workspace::Bid> bids = space.AttachPerNode(1);
+  ASSERT_EQ(bids.size(), cos::base::NumaNodes().size());
+  int local = cos::base::CurrentNode();
+  std::thread submitter([&space, local] {
+    cos::base::SetThreadAffinity(cos::base::NodeCpus(local));   // stay on the node
+    for (int i = 0; i < 20; i ++) {
+      space.Submit([] { return 0; }).get();
+    }
+  });
+  submitter.join();
+  for (auto bid : bids) {
+    EXPECT_EQ(space[bid].WorkersNum(), 1);
+    std::uint64_t submitted = space[bid].Snapshot().submitted;
+    EXPECT_EQ(submitted, space[bid].NumaNode() == local ? 20 : 0);
+  }
+}
+
+TEST(Workspace, submit_bulk) {
+  Workspace space;
+  auto b1 = space.Attach(new WorkBranch(3));
+  auto b2 = space.Attach(new WorkBranch(1));
+
+  // Block every worker so the shares stay in the queues.
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  for (int i = 0; i < 3; i ++) {
+    space[b1].Submit([opened] { opened.wait(); });
+  }
+  space[b2].Submit([opened] { opened.wait(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::atomic<int> count(0);
+  std::vector<std::function<void()>> tasks(400, [&count]{ count ++; });
+  space.SubmitBulk(tasks.begin(), tasks.end());
+  EXPECT_EQ(space[b1].TasksNum(), 300);
+  EXPECT_EQ(space[b2].TasksNum(), 100);
+
+  std::vector<std::function<int()>> producers;
+  for (int i = 0; i < 10; i ++) {
+    producers.emplace_back([i]{ return i; });
+  }
+  auto results = space.SubmitBulk(std::move(producers));
+  gate.set_value();
+  for (int i = 0; i < 10; i ++) {
+    EXPECT_EQ(results[i].get(), i);
+  }
+}
+
+TEST(Workspace, dispatch_least_loaded) {
+  Workspace space;
+  space.SetDispatch(Dispatch::least_loaded);
+  auto b1 = space.Attach(new WorkBranch(3));
+  auto b2 = space.Attach(new WorkBranch(1));
+
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  for (int i = 0; i < 3; i ++) {
+    space[b1].Submit([opened] { opened.wait(); });
+  }
+  space[b2].Submit([opened] { opened.wait(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(space[b1].Hint().workers, 3);
+  EXPECT_EQ(space[b1].Hint().queued, 0);
+
+  std::atomic<int> count(0);
+  for (int i = 0; i < 40; i ++) {
+    space.Submit([&count]{ count ++; });
+  }
+  EXPECT_NEAR(space[b1].Hint().queued, 30, 1);
+  EXPECT_EQ(space[b1].Hint().queued + space[b2].Hint().queued, 40);
+  EXPECT_EQ(space[b1].Hint().queued, space[b1].TasksNum());
+  gate.set_value();
+  while (count < 40) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(space[b1].Hint().queued + space[b2].Hint().queued, 0);
+}
+
+TEST(Workspace, dispatch_shortest_wait) {
+  Workspace space;
+  space.SetDispatch(Dispatch::shortest_wait);
+  auto slow = space.Attach(new WorkBranch(1));
+  auto fast = space.Attach(new WorkBranch(1));
+
+  // Teach the run time averages.
+  std::vector<std::future<int>> warmup;
+  for (int i = 0; i < 3; i ++) {
+    warmup.push_back(space[slow].Submit([] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      return 0;
+    }));
+    warmup.push_back(space[fast].Submit([] { return 0; }));
+  }
+  for (auto& result : warmup) {
+    result.get();
+  }
+  EXPECT_GT(space[slow].Hint().run_ns, space[fast].Hint().run_ns);
+
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  space[slow].Submit([opened] { opened.wait(); });
+  space[fast].Submit([opened] { opened.wait(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  for (int i = 0; i < 10; i ++) {
+    space.Submit([] {});
+  }
+  EXPECT_EQ(space[slow].TasksNum(), 0);
+  EXPECT_EQ(space[fast].TasksNum(), 10);
+  gate.set_value();
+}
+
+TEST(Workspace, dispatch_policies) {
+  Workspace space;
+  auto b1 = space.Attach(new WorkBranch(2));
+  auto b2 = space.Attach(new WorkBranch(1));
+  auto b3 = space.Attach(new WorkBranch(1));
+  Dispatch policies[] = {Dispatch::round_robin, Dispatch::power_of_two,
+                         Dispatch::least_loaded, Dispatch::shortest_wait};
+  for (Dispatch policy : policies) {
+    space.SetDispatch(policy);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; i ++) {
+      results.push_back(space.Submit([i] { return i; }));
+    }
+    for (int i = 0; i < 100; i ++) {
+      EXPECT_EQ(results[i].get(), i);
+    }
+  }
+
+  // Custom dispatcher
+  space.SetDispatch([](const std::vector<WorkBranch*>& branches) { return branches.size() - 1; });
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  space[b3].Submit([opened] { opened.wait(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (int i = 0; i < 5; i ++) {
+    space.Submit([] {});
+  }
+  EXPECT_EQ(space[b3].TasksNum(), 5);
+  EXPECT_EQ(space[b1].TasksNum() + space[b2].TasksNum(), 0);
+  gate.set_value();
+
+  space.Detach(b1);
+  space.SetDispatch(Dispatch::least_loaded);
+  EXPECT_EQ(space.Submit([] { return 1; }).get(), 1);    // still valid after Detach
+}
+
+TEST(Workspace, snapshot) {
+  Workspace space;
+  space.Attach(new WorkBranch(1));
+  space.Attach(new WorkBranch(2));
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 30; i ++) {
+    results.push_back(space.Submit([i] { return i; }));
+  }
+  for (auto& result : results) {
+    result.get();
+  }
+  auto snaps = space.Snapshot();
+  ASSERT_EQ(snaps.size(), 2);
+  cos::workspace::BranchSnapshot total;
+  for (auto& snap : snaps) {
+    total.Merge(snap);
+  }
+  EXPECT_EQ(total.workers, 3);
+  EXPECT_EQ(total.submitted, 30);
+  EXPECT_EQ(total.wait_ns.Count() + total.queued, 30);
+}
+
+TEST(Workspace, bounded_branches) {
+  cos::workspace::BranchOptions options;
+  options.capacity = 1;
+  options.overflow = cos::workspace::Overflow::reject;
+  Workspace space;
+  auto full = space.Attach(new WorkBranch(1, options));
+  auto other = space.Attach(new WorkBranch(1, options));
+  std::promise<void> gate, started;
+  std::shared_future<void> opened = gate.get_future().share();
+  space[full].Submit([opened, &started] {
+    started.set_value();
+    opened.wait();
+  });
+  started.get_future().wait();
+  space[full].Submit([] {});
+  EXPECT_FALSE(space[full].HasRoom());
+
+  // Every submission skips the full branch while the other has room.
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; i ++) {
+    space.Submit([&count] { count ++; });
+    space[other].WaitIdle();
+  }
+  EXPECT_EQ(count, 10);
+  EXPECT_EQ(space[full].Snapshot().rejected, 0);
+  gate.set_value();
+  space.WaitIdle();
+}
+
+// Runs 16 sleeps submitted to one of two branches, returns the makespan.
+static std::chrono::milliseconds SkewedMakespan(bool migrate, std::uint64_t* migrated) {
+  Workspace space;
+  auto loaded = space.Attach(new WorkBranch(1));
+  auto idle = space.Attach(new WorkBranch(1));
+  space.EnableMigration(migrate);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));   // both park
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < 16; i ++) {
+    space[loaded].Submit([] { std::this_thread::sleep_for(std::chrono::milliseconds(10)); });
+  }
+  space.WaitIdle();
+  auto end = std::chrono::steady_clock::now();
+  *migrated = space[idle].Snapshot().migrated_in;
+  EXPECT_EQ(space[loaded].Snapshot().migrated_out, *migrated);
+  return std::chrono::duration_cast<std::chrono::milliseconds>(end - begin);
+}
+
+TEST(Workspace, migration_makespan) {
+  std::uint64_t migrated = 0;
+  auto alone = SkewedMakespan(false, &migrated);
+  EXPECT_EQ(migrated, 0);
+  auto shared = SkewedMakespan(true, &migrated);
+  EXPECT_GT(migrated, 0);
+  EXPECT_LT(shared.count() * 4, alone.count() * 3);
+}
+
+// Blocks the only worker of 'branch' until 'gate' opens.
+static void Block(WorkBranch& branch, std::shared_future<void> gate) {
+  std::promise<void> started;
+  branch.Submit([gate, &started] {
+    started.set_value();
+    gate.wait();
+  });
+  started.get_future().wait();
+}
+
+TEST(Workspace, migration_drains_blocked_branch) {
+  Workspace space;
+  auto blocked = space.Attach(new WorkBranch(1));
+  auto idle = space.Attach(new WorkBranch(1));
+  space.EnableMigration();
+  std::promise<void> gate;
+  Block(space[blocked], gate.get_future().share());
+
+  // The idle branch takes half the surplus at a time, the last task waits
+  // for a worker of its own branch.
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; i ++) {
+    space[blocked].Submit([&count] { count ++; });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (count < 9 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(count, 9);
+  EXPECT_EQ(space[idle].Snapshot().migrated_in, 9);
+  gate.set_value();
+  space.WaitIdle();
+  EXPECT_EQ(count, 10);
+}
+
+TEST(Workspace, migration_rebalance) {
+  cos::workspace::BranchOptions isolated;
+  isolated.migratable = false;
+  Workspace space;
+  auto blocked = space.Attach(new WorkBranch(1));
+  auto pinned = space.Attach(new WorkBranch(1, isolated));
+  auto idle = space.Attach(new WorkBranch(1));
+  std::promise<void> gate;
+  Block(space[blocked], gate.get_future().share());
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; i ++) {
+    space[blocked].Submit([&count] { count ++; });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));   // all park
+
+  // Half the surplus of nine moves at once, the branch that opted out
+  // takes nothing.
+  space.EnableMigration();
+  EXPECT_EQ(space.Rebalance(), 5);
+  space[idle].WaitIdle();
+  EXPECT_GE(count, 5);
+  EXPECT_EQ(space[pinned].Snapshot().migrated_in, 0);
+  gate.set_value();
+  space.WaitIdle();
+  EXPECT_EQ(count, 10);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();